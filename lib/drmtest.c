@@ -37,15 +37,220 @@
 #include <pciaccess.h>
 #include <math.h>
 #include <getopt.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 #include "drmtest.h"
 #include "i915_drm.h"
 #include "intel_chipset.h"
 #include "intel_gpu_tools.h"
+#include "fake_i915.h"
 
 /* This file contains a bunch of wrapper functions to directly use gem ioctls.
  * Mostly useful to write kernel tests. */
 
+/*
+ * Instrumentation. While results are being recorded (--results or the
+ * DRMTEST_RESULTS environment variable) every ioctl issued through the
+ * gem_* helpers and do_ioctl() is counted and timed, and the gem_mmap__*
+ * helpers count mappings. The counters are cumulative for the process;
+ * per-subtest numbers are deltas against a copy taken at subtest start.
+ */
+#define IOCTL_STATS_SIZE 64	/* power of two */
+
+struct ioctl_stat {
+	unsigned long request;
+	uint64_t count;
+	uint64_t errors;
+	uint64_t ns;
+};
+
+enum { MMAP_GTT, MMAP_CPU, NUM_MMAP_TYPES };
+
+struct drmtest_stats {
+	struct ioctl_stat ioctl[IOCTL_STATS_SIZE];
+	uint64_t mmap_count[NUM_MMAP_TYPES];
+	uint64_t mmap_bytes[NUM_MMAP_TYPES];
+};
+
+static bool stats_enabled;
+static struct drmtest_stats process_stats;
+
+/*
+ * While a signal helper runs, drmtest_ioctl() does the EINTR/EAGAIN restart
+ * loop itself instead of leaving it to drmIoctl(), to count restarts and
+ * the time lost in the interrupted attempts.
+ */
+static bool restart_stats_enabled;
+static struct {
+	uint64_t ioctls;
+	uint64_t interrupted;	/* ioctls restarted at least once */
+	uint64_t eintr;
+	uint64_t eagain;
+	uint64_t lost_ns;
+	uint64_t max_lost_ns;
+} restart_stats;
+
+static const struct {
+	unsigned long request;
+	const char *name;
+} ioctl_names[] = {
+#define IOCTL_NAME(x) { DRM_IOCTL_##x, #x }
+	IOCTL_NAME(GEM_CLOSE),
+	IOCTL_NAME(GEM_FLINK),
+	IOCTL_NAME(GEM_OPEN),
+	IOCTL_NAME(PRIME_HANDLE_TO_FD),
+	IOCTL_NAME(PRIME_FD_TO_HANDLE),
+	IOCTL_NAME(I915_GETPARAM),
+	IOCTL_NAME(I915_GEM_EXECBUFFER),
+	IOCTL_NAME(I915_GEM_EXECBUFFER2),
+	IOCTL_NAME(I915_GEM_PIN),
+	IOCTL_NAME(I915_GEM_UNPIN),
+	IOCTL_NAME(I915_GEM_BUSY),
+	IOCTL_NAME(I915_GEM_THROTTLE),
+	IOCTL_NAME(I915_GEM_CREATE),
+	IOCTL_NAME(I915_GEM_PREAD),
+	IOCTL_NAME(I915_GEM_PWRITE),
+	IOCTL_NAME(I915_GEM_MMAP),
+	IOCTL_NAME(I915_GEM_MMAP_GTT),
+	IOCTL_NAME(I915_GEM_SET_DOMAIN),
+	IOCTL_NAME(I915_GEM_SW_FINISH),
+	IOCTL_NAME(I915_GEM_SET_TILING),
+	IOCTL_NAME(I915_GEM_GET_TILING),
+	IOCTL_NAME(I915_GEM_GET_APERTURE),
+	IOCTL_NAME(I915_GEM_MADVISE),
+#undef IOCTL_NAME
+};
+
+static const char *ioctl_name(unsigned long request, char *buf, size_t size)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(ioctl_names); i++)
+		if (ioctl_names[i].request == request)
+			return ioctl_names[i].name;
+
+	snprintf(buf, size, "0x%08lx", request);
+	return buf;
+}
+
+/* Slots are never freed, so a slot index stays valid across snapshots. */
+static struct ioctl_stat *ioctl_stat(unsigned long request)
+{
+	unsigned i, hash = (request ^ (request >> 8)) & (IOCTL_STATS_SIZE - 1);
+
+	for (i = 0; i < IOCTL_STATS_SIZE; i++) {
+		struct ioctl_stat *st =
+			&process_stats.ioctl[(hash + i) & (IOCTL_STATS_SIZE - 1)];
+
+		if (st->request == request)
+			return st;
+		if (st->request == 0) {
+			st->request = request;
+			return st;
+		}
+	}
+
+	return NULL;
+}
+
+static void stats_delta(struct drmtest_stats *delta,
+			const struct drmtest_stats *start)
+{
+	int i;
+
+	*delta = process_stats;
+	for (i = 0; i < IOCTL_STATS_SIZE; i++) {
+		delta->ioctl[i].count -= start->ioctl[i].count;
+		delta->ioctl[i].errors -= start->ioctl[i].errors;
+		delta->ioctl[i].ns -= start->ioctl[i].ns;
+	}
+	for (i = 0; i < NUM_MMAP_TYPES; i++) {
+		delta->mmap_count[i] -= start->mmap_count[i];
+		delta->mmap_bytes[i] -= start->mmap_bytes[i];
+	}
+}
+
+static void count_mmap(int type, int size)
+{
+	if (!stats_enabled)
+		return;
+
+	process_stats.mmap_count[type]++;
+	process_stats.mmap_bytes[type] += size;
+}
+
+static int do_drm_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct timespec start, retry;
+	uint64_t lost;
+	int ret, restarts = 0;
+
+	if (fake_i915_is_fake(fd))
+		return fake_i915_ioctl(fd, request, arg);
+
+	/* the real one, not our drmIoctl() override */
+	if (!restart_stats_enabled)
+		return (drmIoctl)(fd, request, arg);
+
+	restart_stats.ioctls++;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((ret = ioctl(fd, request, arg)) == -1 &&
+	       (errno == EINTR || errno == EAGAIN)) {
+		if (errno == EINTR)
+			restart_stats.eintr++;
+		else
+			restart_stats.eagain++;
+		restarts++;
+		clock_gettime(CLOCK_MONOTONIC, &retry);
+	}
+
+	if (restarts) {
+		lost = (retry.tv_sec - start.tv_sec) * 1000000000ULL +
+			retry.tv_nsec - start.tv_nsec;
+		restart_stats.interrupted++;
+		restart_stats.lost_ns += lost;
+		if (lost > restart_stats.max_lost_ns)
+			restart_stats.max_lost_ns = lost;
+	}
+
+	return ret;
+}
+
+/*
+ * drmIoctl() which, while results are recorded, accounts the call to the
+ * current subtest. Also routes ioctls on DRMTEST_FAKE_I915 fds to the
+ * software backend.
+ */
+int drmtest_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct ioctl_stat *st;
+	struct timespec start, end;
+	int ret;
+
+	if (!stats_enabled)
+		return do_drm_ioctl(fd, request, arg);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = do_drm_ioctl(fd, request, arg);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	st = ioctl_stat(request);
+	if (st) {
+		st->count++;
+		if (ret)
+			st->errors++;
+		st->ns += (end.tv_sec - start.tv_sec) * 1000000000ULL +
+			end.tv_nsec - start.tv_nsec;
+	}
+
+	return ret;
+}
+
 drm_intel_bo *
 gem_handle_to_libdrm_bo(drm_intel_bufmgr *bufmgr, int fd, const char *name, uint32_t handle)
 {
@@ -54,7 +259,7 @@ gem_handle_to_libdrm_bo(drm_intel_bufmgr *bufmgr, int fd, const char *name, uint
 	drm_intel_bo *bo;
 
 	flink.handle = handle;
-	ret = ioctl(fd, DRM_IOCTL_GEM_FLINK, &flink);
+	ret = drmtest_ioctl(fd, DRM_IOCTL_GEM_FLINK, &flink);
 	assert(ret == 0);
 
 	bo = drm_intel_bo_gem_create_from_name(bufmgr, name, flink.name);
@@ -72,7 +277,7 @@ is_intel(int fd)
 	gp.param = I915_PARAM_CHIPSET_ID;
 	gp.value = &devid;
 
-	if (ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp)))
+	if (drmtest_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp))
 		return 0;
 
 	return IS_INTEL(devid);
@@ -86,7 +291,7 @@ bool gem_uses_aliasing_ppgtt(int fd)
 	gp.param = 18; /* HAS_ALIASING_PPGTT */
 	gp.value = &val;
 
-	if (ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp)))
+	if (drmtest_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp))
 		return 0;
 
 	return val;
@@ -100,7 +305,7 @@ int gem_available_fences(int fd)
 	gp.param = I915_PARAM_NUM_FENCES_AVAIL;
 	gp.value = &val;
 
-	if (ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp)))
+	if (drmtest_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp))
 		return 0;
 
 	return val;
@@ -176,6 +381,10 @@ int drm_get_card(int master)
 	char *name;
 	int i, fd;
 
+	/* the fake device has no node, but callers want a card number */
+	if (fake_i915_enabled())
+		return 0;
+
 	for (i = 0; i < 16; i++) {
 		int ret;
 
@@ -215,6 +424,9 @@ int drm_open_any(void)
 	char *name;
 	int ret, fd;
 
+	if (fake_i915_enabled())
+		return fake_i915_open();
+
 	ret = asprintf(&name, "/dev/dri/card%d", drm_get_card(0));
 	if (ret == -1)
 		return -1;
@@ -238,6 +450,9 @@ int drm_open_any_master(void)
 	char *name;
 	int ret, fd;
 
+	if (fake_i915_enabled())
+		return fake_i915_open();
+
 	ret = asprintf(&name, "/dev/dri/card%d", drm_get_card(1));
 	if (ret == -1)
 		return -1;
@@ -258,13 +473,12 @@ void gem_set_tiling(int fd, uint32_t handle, int tiling, int stride)
 	int ret;
 
 	memset(&st, 0, sizeof(st));
-	do {
-		st.handle = handle;
-		st.tiling_mode = tiling;
-		st.stride = tiling ? stride : 0;
+	st.handle = handle;
+	st.tiling_mode = tiling;
+	st.stride = tiling ? stride : 0;
 
-		ret = ioctl(fd, DRM_IOCTL_I915_GEM_SET_TILING, &st);
-	} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+	/* drmIoctl restarts on EINTR and EAGAIN */
+	ret = drmtest_ioctl(fd, DRM_IOCTL_I915_GEM_SET_TILING, &st);
 	assert(ret == 0);
 	assert(st.tiling_mode == tiling);
 }
@@ -291,7 +505,7 @@ int gem_has_cacheing(int fd)
 		return 0;
 
 	arg.cacheing = 0;
-	ret = ioctl(fd, LOCAL_DRM_IOCTL_I915_GEM_SET_CACHEING, &arg);
+	ret = drmtest_ioctl(fd, LOCAL_DRM_IOCTL_I915_GEM_SET_CACHEING, &arg);
 	gem_close(fd, arg.handle);
 
 	return ret == 0;
@@ -304,7 +518,7 @@ void gem_set_cacheing(int fd, uint32_t handle, int cacheing)
 
 	arg.handle = handle;
 	arg.cacheing = cacheing;
-	ret = ioctl(fd, LOCAL_DRM_IOCTL_I915_GEM_SET_CACHEING, &arg);
+	ret = drmtest_ioctl(fd, LOCAL_DRM_IOCTL_I915_GEM_SET_CACHEING, &arg);
 	assert(ret == 0);
 }
 
@@ -315,7 +529,7 @@ int gem_get_cacheing(int fd, uint32_t handle)
 
 	arg.handle = handle;
 	arg.cacheing = 0;
-	ret = ioctl(fd, LOCAL_DRM_IOCTL_I915_GEM_GET_CACHEING, &arg);
+	ret = drmtest_ioctl(fd, LOCAL_DRM_IOCTL_I915_GEM_GET_CACHEING, &arg);
 	assert(ret == 0);
 
 	return arg.cacheing;
@@ -386,12 +600,17 @@ void *gem_mmap__gtt(int fd, uint32_t handle, int size, int prot)
 	void *ptr;
 
 	mmap_arg.handle = handle;
-	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_MMAP_GTT, &mmap_arg))
+	if (drmtest_ioctl(fd, DRM_IOCTL_I915_GEM_MMAP_GTT, &mmap_arg))
 		return NULL;
 
-	ptr = mmap64(0, size, prot, MAP_SHARED, fd, mmap_arg.offset);
+	if (fake_i915_is_fake(fd))
+		ptr = fake_i915_mmap_gtt(fd, handle, size, prot);
+	else
+		ptr = mmap64(0, size, prot, MAP_SHARED, fd, mmap_arg.offset);
 	if (ptr == MAP_FAILED)
 		ptr = NULL;
+	if (ptr)
+		count_mmap(MMAP_GTT, size);
 
 	return ptr;
 }
@@ -403,9 +622,11 @@ void *gem_mmap__cpu(int fd, uint32_t handle, int size, int prot)
 	mmap_arg.handle = handle;
 	mmap_arg.offset = 0;
 	mmap_arg.size = size;
-	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_MMAP, &mmap_arg))
+	if (drmtest_ioctl(fd, DRM_IOCTL_I915_GEM_MMAP, &mmap_arg))
 		return NULL;
 
+	count_mmap(MMAP_CPU, size);
+
 	return (void *)(uintptr_t)mmap_arg.addr_ptr;
 }
 
@@ -422,6 +643,10 @@ uint64_t gem_mappable_aperture_size(void)
 {
 	struct pci_device *pci_dev;
 	int bar;
+
+	if (fake_i915_enabled())
+		return fake_i915_mappable_aperture_size();
+
 	pci_dev = intel_get_pci_device();
 
 	if (intel_gen(pci_dev->device_id) < 3)
@@ -472,28 +697,161 @@ uint32_t prime_fd_to_handle(int fd, int dma_buf_fd)
 }
 
 /* signal interrupt helpers */
+#define SIGNAL_BURST_GAP_NS	20000
+
 static pid_t signal_helper = -1;
+static timer_t signal_timer;
+static bool signal_timer_armed;
+static struct drmtest_signal_opts signal_opts;
+static unsigned signal_burst_left;
+static uint32_t signal_jitter_state;
 long long int sig_stat;
+
+/* private generator, so the helper doesn't perturb drmtest_random() */
+static uint64_t signal_delay_ns(void)
+{
+	uint64_t period = 1000000000ULL * signal_opts.burst / signal_opts.rate;
+	int64_t jitter;
+
+	if (signal_burst_left) {
+		signal_burst_left--;
+		return SIGNAL_BURST_GAP_NS;
+	}
+	signal_burst_left = signal_opts.burst - 1;
+
+	if (!signal_opts.jitter)
+		return period;
+
+	signal_jitter_state ^= signal_jitter_state << 13;
+	signal_jitter_state ^= signal_jitter_state >> 17;
+	signal_jitter_state ^= signal_jitter_state << 5;
+
+	jitter = period * signal_opts.jitter / 100;
+	return period - jitter + signal_jitter_state % (2 * jitter + 1);
+}
+
 static void __attribute__((noreturn)) signal_helper_process(pid_t pid)
 {
-	/* Interrupt the parent process at 500Hz, just to be annoying */
+	struct timespec ts;
+	uint64_t ns;
+
 	while (1) {
-		usleep(1000 * 1000 / 500);
+		ns = signal_delay_ns();
+		ts.tv_sec = ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		nanosleep(&ts, NULL);
 		if (kill(pid, SIGUSR1)) /* Parent has died, so must we. */
 			exit(0);
 	}
 }
 
+static void arm_signal_timer(void)
+{
+	struct itimerspec its;
+	uint64_t ns = signal_delay_ns();
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ns / 1000000000;
+	its.it_value.tv_nsec = ns % 1000000000;
+	timer_settime(signal_timer, 0, &its, NULL);
+}
+
 static void sig_handler(int i)
 {
+	int saved_errno = errno;
+
 	sig_stat++;
+	/* one-shot, so that jitter and bursts can vary the next expiry */
+	if (signal_timer_armed)
+		arm_signal_timer();
+
+	errno = saved_errno;
 }
 
-void drmtest_fork_signal_helper(void)
+static void parse_signal_opts(struct drmtest_signal_opts *opts)
+{
+	char *env = getenv("DRMTEST_SIGNAL_HELPER"), *copy, *tok, *save;
+
+	if (!env)
+		return;
+
+	copy = strdup(env);
+	for (tok = strtok_r(copy, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if (!strncmp(tok, "rate=", 5))
+			opts->rate = atoi(tok + 5);
+		else if (!strncmp(tok, "jitter=", 7))
+			opts->jitter = atoi(tok + 7);
+		else if (!strncmp(tok, "burst=", 6))
+			opts->burst = atoi(tok + 6);
+		else if (!strcmp(tok, "timer"))
+			opts->use_timer = true;
+		else if (!strcmp(tok, "interrupt"))
+			opts->interrupt = true;
+		else
+			fprintf(stderr, "unknown signal helper option \"%s\"\n",
+				tok);
+	}
+	free(copy);
+}
+
+/**
+ * drmtest_start_signal_helper() - interrupt the test with SIGUSR1
+ *
+ * Signals are sent by a forked process, or with @opts->use_timer by a
+ * POSIX timer in this process. @opts may be NULL for the defaults of
+ * 500Hz without jitter, and DRMTEST_SIGNAL_HELPER (e.g.
+ * "rate=2000,jitter=50,burst=4,timer,interrupt") overrides the fields it
+ * names, so any test using the helper can be tuned from the outside.
+ *
+ * While the helper runs drmtest_ioctl() counts ioctls which failed with
+ * EINTR or EAGAIN and had to be restarted, and the time the interrupted
+ * attempts cost; drmtest_stop_signal_helper() reports them.
+ */
+void drmtest_start_signal_helper(const struct drmtest_signal_opts *opts)
 {
+	struct sigaction sa;
+	struct sigevent sev;
 	pid_t pid;
 
-	signal(SIGUSR1, sig_handler);
+	memset(&signal_opts, 0, sizeof(signal_opts));
+	if (opts)
+		signal_opts = *opts;
+	parse_signal_opts(&signal_opts);
+	if (signal_opts.rate <= 0)
+		signal_opts.rate = 500;
+	if (signal_opts.burst <= 0)
+		signal_opts.burst = 1;
+	if (signal_opts.jitter > 100)
+		signal_opts.jitter = 100;
+	signal_burst_left = 0;
+	signal_jitter_state = getpid() | 1;
+
+	/*
+	 * Without SA_RESTART interrupted ioctls come back to userspace with
+	 * EINTR instead of being restarted by the kernel, which makes the
+	 * restarts visible, but also other syscalls in the test.
+	 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_handler;
+	sa.sa_flags = signal_opts.interrupt ? 0 : SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	memset(&restart_stats, 0, sizeof(restart_stats));
+	restart_stats_enabled = true;
+
+	if (signal_opts.use_timer) {
+		memset(&sev, 0, sizeof(sev));
+		sev.sigev_notify = SIGEV_SIGNAL;
+		sev.sigev_signo = SIGUSR1;
+		if (timer_create(CLOCK_MONOTONIC, &sev, &signal_timer) == 0) {
+			signal_timer_armed = true;
+			arm_signal_timer();
+			return;
+		}
+		perror("timer_create, falling back to a helper process");
+	}
+
 	pid = fork();
 	if (pid == 0) {
 		signal_helper_process(getppid());
@@ -503,221 +861,1084 @@ void drmtest_fork_signal_helper(void)
 	signal_helper = pid;
 }
 
+void drmtest_fork_signal_helper(void)
+{
+	drmtest_start_signal_helper(NULL);
+}
+
 void drmtest_stop_signal_helper(void)
 {
 	if (signal_helper != -1)
 		kill(signal_helper, SIGQUIT);
 
+	if (signal_timer_armed) {
+		signal_timer_armed = false;
+		timer_delete(signal_timer);
+	}
+
 	if (sig_stat)
 		fprintf(stderr, "signal handler called %llu times\n", sig_stat);
 
+	if (restart_stats_enabled && restart_stats.interrupted)
+		fprintf(stderr, "%llu of %llu ioctls restarted "
+			"(%llu EINTR, %llu EAGAIN), "
+			"%.3fms lost, worst %.3fms\n",
+			(unsigned long long)restart_stats.interrupted,
+			(unsigned long long)restart_stats.ioctls,
+			(unsigned long long)restart_stats.eintr,
+			(unsigned long long)restart_stats.eagain,
+			restart_stats.lost_ns / 1e6,
+			restart_stats.max_lost_ns / 1e6);
+
+	restart_stats_enabled = false;
 	signal_helper = -1;
 }
 
 /* subtests helpers */
 static bool list_subtests = false;
-static char *run_single_subtest = NULL;
+static char **subtest_filters;
+static int num_subtest_filters;
 
-void drmtest_subtest_init(int argc, char **argv)
+/*
+ * Runner state. With --fork every subtest runs in a child process which
+ * exits as soon as it reaches the next drmtest_run_subtest() call, while
+ * the parent skips all subtest bodies and only collects the results.
+ * Without --fork the subtests run in-process as before and only their
+ * timings are recorded.
+ *
+ * A forked subtest hands its instrumentation counters back to the parent
+ * through a pipe when it exits; resource usage comes from wait4().
+ */
+enum subtest_result {
+	SUBTEST_PASS,
+	SUBTEST_SKIP,
+	SUBTEST_FAIL,
+	SUBTEST_CRASH,
+	SUBTEST_RUNNING,
+};
+
+static const char *subtest_result_names[] = {
+	"pass", "skip", "fail", "crash", "running"
+};
+
+struct subtest {
+	char *name;
+	pid_t pid;
+	int status;
+	enum subtest_result result;
+	struct timespec start;
+	struct rusage rusage;
+	double wall, user, sys;
+	long maxrss, minflt, majflt;
+	int stats_fd;
+	bool has_stats;
+	struct drmtest_stats stats;
+};
+
+static struct subtest *subtests;
+static int num_subtests, max_subtests;
+static struct subtest *current_subtest;
+static bool runner_mode, fork_subtests, in_subtest_child;
+static int subtest_jobs = 1, running_subtests;
+static char *subtest_results_file;
+static bool exit_handler_installed;
+static pid_t exit_handler_pid;	/* the process the handler works for */
+static int subtest_stats_fd = -1;
+static struct timespec process_start;
+static bool seed_override;
+static uint64_t seed_override_value;
+static uint64_t rng_state;
+static bool rng_seeded;
+
+static double timespec_elapsed(const struct timespec *start)
 {
-	int c, option_index = 0;
-	static struct option long_options[] = {
-		{"list-subtests", 0, 0, 'l'},
-		{"run-subtest", 1, 0, 'r'},
-		{NULL, 0, 0, 0,}
-	};
+	struct timespec now;
 
-	/* supress getopt errors about unknown options */
-	opterr = 0;
-	while((c = getopt_long(argc, argv, "",
-			       long_options, &option_index)) != -1) {
-		switch(c) {
-		case 'l':
-			list_subtests = true;
-			goto out;
-		case 'r':
-			run_single_subtest = strdup(optarg);
-			goto out;
-		}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static double timeval_seconds(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec * 1e-6;
+}
+
+static void subtest_set_rusage(struct subtest *st, const struct rusage *ru,
+			       const struct rusage *start)
+{
+	st->user = timeval_seconds(&ru->ru_utime);
+	st->sys = timeval_seconds(&ru->ru_stime);
+	st->maxrss = ru->ru_maxrss;
+	st->minflt = ru->ru_minflt;
+	st->majflt = ru->ru_majflt;
+	if (start) {
+		st->user -= timeval_seconds(&start->ru_utime);
+		st->sys -= timeval_seconds(&start->ru_stime);
+		st->minflt -= start->ru_minflt;
+		st->majflt -= start->ru_majflt;
 	}
+}
 
-out:
-	/* reset opt parsing */
-	optind = 1;
+static enum subtest_result subtest_result_from_status(int status)
+{
+	if (WIFSIGNALED(status))
+		return SUBTEST_CRASH;
+
+	switch (WEXITSTATUS(status)) {
+	case 0:
+		return SUBTEST_PASS;
+	case 77:
+		return SUBTEST_SKIP;
+	default:
+		return SUBTEST_FAIL;
+	}
 }
 
 /*
- * Note: Testcases which use these helpers MUST NOT output anything to stdout
- * outside of places protected by drmtest_run_subtest checks - the piglit
- * runner adds every line to the subtest list.
+ * Collects the result of one forked subtest. Returns false if it is still
+ * running and @block is not set.
  */
-bool drmtest_run_subtest(const char *subtest_name)
+static bool reap_subtest(struct subtest *st, bool block)
 {
-	if (list_subtests) {
-		printf("%s\n", subtest_name);
+	struct rusage ru;
+	int status;
+	pid_t pid;
+
+	do {
+		pid = wait4(st->pid, &status, block ? 0 : WNOHANG, &ru);
+	} while (pid < 0 && errno == EINTR);
+
+	if (pid == 0)
 		return false;
+
+	/* The test reaped it behind our back, so the result is lost. */
+	if (pid < 0) {
+		status = W_EXITCODE(1, 0);
+		memset(&ru, 0, sizeof(ru));
 	}
 
-	if (!run_single_subtest) {
-		return true;
-	} else {
-		if (strcmp(subtest_name, run_single_subtest) == 0)
-			return true;
+	st->status = status;
+	st->result = subtest_result_from_status(status);
+	st->wall = timespec_elapsed(&st->start);
+	subtest_set_rusage(st, &ru, NULL);
+	running_subtests--;
+
+	/* The child is gone, so this can't block. A crashed child never
+	 * got to send its counters. */
+	if (st->stats_fd >= 0) {
+		st->has_stats = read(st->stats_fd, &st->stats,
+				     sizeof(st->stats)) == sizeof(st->stats);
+		close(st->stats_fd);
+		st->stats_fd = -1;
+	}
 
-		return false;
+	return true;
+}
+
+/*
+ * Waits until at most @limit forked subtests are left running. Only the
+ * subtests' own pids are waited for, any other child belongs to the test
+ * and it may want to wait for it itself. If none of them has finished,
+ * this blocks on the oldest one.
+ */
+static void reap_subtests(int limit)
+{
+	struct subtest *oldest;
+	bool reaped;
+	int i;
+
+	while (running_subtests > limit) {
+		oldest = NULL;
+		reaped = false;
+
+		for (i = 0; i < num_subtests; i++) {
+			if (subtests[i].result != SUBTEST_RUNNING ||
+			    subtests[i].pid <= 0)
+				continue;
+
+			if (!oldest)
+				oldest = &subtests[i];
+			if (reap_subtest(&subtests[i], false))
+				reaped = true;
+		}
+
+		if (!oldest)
+			break;
+		if (!reaped)
+			reap_subtest(oldest, true);
 	}
 }
 
-bool drmtest_only_list_subtests(void)
+/* Closes the timing of an in-process subtest */
+static void finish_current_subtest(int status)
 {
-	return list_subtests;
+	struct subtest *st = current_subtest;
+	struct rusage ru;
+
+	if (!st)
+		return;
+
+	getrusage(RUSAGE_SELF, &ru);
+	st->status = W_EXITCODE(status, 0);
+	st->result = subtest_result_from_status(st->status);
+	st->wall = timespec_elapsed(&st->start);
+	subtest_set_rusage(st, &ru, &st->rusage);
+	if (stats_enabled) {
+		struct drmtest_stats delta;
+
+		stats_delta(&delta, &st->stats);
+		st->stats = delta;
+		st->has_stats = true;
+	}
+	current_subtest = NULL;
 }
 
-/* other helpers */
-void drmtest_exchange_int(void *array, unsigned i, unsigned j)
+static void write_stats(FILE *file, const struct drmtest_stats *stats)
 {
-	int *int_arr, tmp;
-	int_arr = array;
+	static const char *mmap_names[NUM_MMAP_TYPES] = { "gtt", "cpu" };
+	bool first = true;
+	char buf[16];
+	int i;
 
-	tmp = int_arr[i];
-	int_arr[i] = int_arr[j];
-	int_arr[j] = tmp;
+	fprintf(file, ", \"ioctls\": {");
+	for (i = 0; i < IOCTL_STATS_SIZE; i++) {
+		const struct ioctl_stat *st = &stats->ioctl[i];
+
+		if (!st->count)
+			continue;
+
+		fprintf(file, "%s \"%s\": { \"count\": %llu, \"errors\": %llu, "
+			"\"ns\": %llu }", first ? "" : ",",
+			ioctl_name(st->request, buf, sizeof(buf)),
+			(unsigned long long)st->count,
+			(unsigned long long)st->errors,
+			(unsigned long long)st->ns);
+		first = false;
+	}
+	fprintf(file, " }, \"mmaps\": {");
+	for (i = 0; i < NUM_MMAP_TYPES; i++)
+		fprintf(file, "%s \"%s\": { \"count\": %llu, \"bytes\": %llu }",
+			i ? "," : "", mmap_names[i],
+			(unsigned long long)stats->mmap_count[i],
+			(unsigned long long)stats->mmap_bytes[i]);
+	fprintf(file, " }");
 }
 
-void drmtest_permute_array(void *array, unsigned size,
-			   void (*exchange_func)(void *array,
-						 unsigned i,
-						 unsigned j))
+static void write_subtest_results(const char *filename)
 {
+	struct subtest process;
+	struct rusage ru;
+	FILE *file;
 	int i;
 
-	for (i = size - 1; i > 1; i--) {
-		/* yes, not perfectly uniform, who cares */
-		long l = random() % (i +1);
-		if (i != l)
-			exchange_func(array, i, l);
+	file = fopen(filename, "w");
+	if (!file) {
+		fprintf(stderr, "Couldn't open %s: %s\n",
+			filename, strerror(errno));
+		return;
+	}
+
+	fprintf(file, "{\n  \"subtests\": [");
+	for (i = 0; i < num_subtests; i++) {
+		struct subtest *st = &subtests[i];
+
+		fprintf(file, "%s\n    { \"name\": \"%s\", \"result\": \"%s\"",
+			i ? "," : "", st->name,
+			subtest_result_names[st->result]);
+		if (WIFSIGNALED(st->status))
+			fprintf(file, ", \"signal\": %d", WTERMSIG(st->status));
+		else
+			fprintf(file, ", \"exit\": %d", WEXITSTATUS(st->status));
+		fprintf(file, ", \"wall\": %.6f, \"user\": %.6f, \"sys\": %.6f",
+			st->wall, st->user, st->sys);
+		fprintf(file, ", \"maxrss_kb\": %ld, \"minflt\": %ld, "
+			"\"majflt\": %ld", st->maxrss, st->minflt, st->majflt);
+		if (st->has_stats)
+			write_stats(file, &st->stats);
+		fprintf(file, " }");
 	}
+	fprintf(file, "\n  ],\n");
+
+	/* Everything this process did, including setup outside of
+	 * subtests but not including forked subtests. */
+	memset(&process, 0, sizeof(process));
+	getrusage(RUSAGE_SELF, &ru);
+	subtest_set_rusage(&process, &ru, NULL);
+	fprintf(file, "  \"process\": { \"wall\": %.6f, \"user\": %.6f, "
+		"\"sys\": %.6f, \"maxrss_kb\": %ld, \"minflt\": %ld, "
+		"\"majflt\": %ld", timespec_elapsed(&process_start),
+		process.user, process.sys, process.maxrss,
+		process.minflt, process.majflt);
+	write_stats(file, &process_stats);
+	fprintf(file, " }\n}\n");
+	fclose(file);
 }
 
-void drmtest_progress(const char *header, uint64_t i, uint64_t total)
+static void subtest_exit_handler(int status, void *arg)
 {
-	int divider = 200;
+	int count[SUBTEST_RUNNING + 1] = { 0 };
+	int i, ret;
 
-	if (!isatty(fileno(stderr)))
+	/* some other child of the test, e.g. the signal helper */
+	if (getpid() != exit_handler_pid)
 		return;
 
-	if (i+1 >= total) {
-		fprintf(stderr, "\r%s100%%\n", header);
+	if (in_subtest_child) {
+		struct drmtest_stats delta;
+
+		if (subtest_stats_fd >= 0) {
+			stats_delta(&delta, &subtests[num_subtests - 1].stats);
+			write(subtest_stats_fd, &delta, sizeof(delta));
+		}
 		return;
 	}
 
-	if (total / 200 == 0)
-		divider = 1;
+	if (list_subtests)
+		return;
 
-	/* only bother updating about every 0.5% */
-	if (i % (total / divider) == 0 || i+1 >= total) {
-		fprintf(stderr, "\r%s%3llu%%", header,
-			(long long unsigned) i * 100 / total);
-	}
-}
+	reap_subtests(0);
+	finish_current_subtest(status);
 
-/* mappable aperture trasher helper */
-drm_intel_bo **trash_bos;
-int num_trash_bos;
+	if (subtest_results_file)
+		write_subtest_results(subtest_results_file);
 
-void drmtest_init_aperture_trashers(drm_intel_bufmgr *bufmgr)
-{
-	int i;
+	if (!fork_subtests)
+		return;
 
-	num_trash_bos = gem_mappable_aperture_size() / (1024*1024);
+	for (i = 0; i < num_subtests; i++) {
+		struct subtest *st = &subtests[i];
 
-	trash_bos = malloc(num_trash_bos * sizeof(drm_intel_bo *));
-	assert(trash_bos);
+		count[st->result]++;
+		if (st->result == SUBTEST_FAIL || st->result == SUBTEST_CRASH)
+			fprintf(stderr, "subtest %s: %s\n", st->name,
+				subtest_result_names[st->result]);
+	}
+	fprintf(stderr, "%d subtests: %d passed, %d skipped, %d failed, "
+		"%d crashed\n", num_subtests, count[SUBTEST_PASS],
+		count[SUBTEST_SKIP], count[SUBTEST_FAIL],
+		count[SUBTEST_CRASH]);
+
+	/*
+	 * Only the subtest results are aggregated, the parent never ran a
+	 * subtest body. But a failure in its own setup or teardown must not
+	 * be hidden by passing subtests.
+	 */
+	if (status != 0 && status != 77)
+		fprintf(stderr, "test exited with %d outside of subtests\n",
+			status);
+
+	if (count[SUBTEST_FAIL] || count[SUBTEST_CRASH] ||
+	    (status != 0 && status != 77))
+		ret = 1;
+	else if (count[SUBTEST_PASS])
+		ret = 0;
+	else
+		ret = 77;
 
-	for (i = 0; i < num_trash_bos; i++)
-		trash_bos[i] = drm_intel_bo_alloc(bufmgr, "trash bo", 1024*1024, 4096);
+	fflush(NULL);
+	_exit(ret);
 }
 
-void drmtest_trash_aperture(void)
+static void install_exit_handler(void)
 {
-	int i;
-	uint8_t *gtt_ptr;
+	exit_handler_pid = getpid();
+	on_exit(subtest_exit_handler, NULL);
+	exit_handler_installed = true;
+}
 
-	for (i = 0; i < num_trash_bos; i++) {
-		drm_intel_gem_bo_map_gtt(trash_bos[i]);
-		gtt_ptr = trash_bos[i]->virtual;
-		*gtt_ptr = 0;
-		drm_intel_gem_bo_unmap_gtt(trash_bos[i]);
+static void add_subtest_filters(const char *patterns)
+{
+	char *copy = strdup(patterns), *tok, *save;
+
+	assert(copy);
+	for (tok = strtok_r(copy, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		subtest_filters = realloc(subtest_filters,
+					  (num_subtest_filters + 1) *
+					  sizeof(*subtest_filters));
+		assert(subtest_filters);
+		subtest_filters[num_subtest_filters++] = strdup(tok);
 	}
+	free(copy);
 }
 
-void drmtest_cleanup_aperture_trashers(void)
+static bool subtest_selected(const char *subtest_name)
 {
 	int i;
 
-	for (i = 0; i < num_trash_bos; i++)
-		drm_intel_bo_unreference(trash_bos[i]);
+	if (!num_subtest_filters)
+		return true;
 
-	free(trash_bos);
+	for (i = 0; i < num_subtest_filters; i++)
+		if (fnmatch(subtest_filters[i], subtest_name, 0) == 0)
+			return true;
+
+	return false;
 }
 
-/* helpers to create nice-looking framebuffers */
-static cairo_surface_t *
-paint_allocate_surface(int fd, int width, int height, int depth, int bpp,
-		       bool tiled,
-		       struct kmstest_fb *fb_info)
+/*
+ * DRMTEST_RESULTS=file records timings and instrumentation for any test,
+ * including ones that never call drmtest_subtest_init().
+ */
+static void __attribute__((constructor)) drmtest_results_from_env(void)
 {
-	cairo_format_t format;
-	struct drm_i915_gem_set_tiling set_tiling;
-	int size;
-	unsigned stride;
-	uint32_t *fb_ptr;
+	const char *file = getenv("DRMTEST_RESULTS");
 
-	if (tiled) {
-		int v;
+	clock_gettime(CLOCK_MONOTONIC, &process_start);
 
-		/* Round the tiling up to the next power-of-two and the
-		 * region up to the next pot fence size so that this works
-		 * on all generations.
-		 *
-		 * This can still fail if the framebuffer is too large to
-		 * be tiled. But then that failure is expected.
-		 */
+	if (!file || !*file)
+		return;
 
-		v = width * bpp / 8;
-		for (stride = 512; stride < v; stride *= 2)
-			;
+	subtest_results_file = strdup(file);
+	runner_mode = true;
+	stats_enabled = true;
+	install_exit_handler();
+}
 
-		v = stride * height;
-		for (size = 1024*1024; size < v; size *= 2)
-			;
-	} else {
-		/* Scan-out has a 64 byte alignment restriction */
-		stride = (width * (bpp / 8) + 63) & ~63;
-		size = stride * height;
+void drmtest_subtest_init(int argc, char **argv)
+{
+	bool run_all_subtests = false;
+	int c, option_index = 0;
+	static struct option long_options[] = {
+		{"list-subtests", 0, 0, 'l'},
+		{"run-subtest", 1, 0, 'r'},
+		{"run-all", 0, 0, 'a'},
+		{"fork", 0, 0, 'f'},
+		{"jobs", 1, 0, 'j'},
+		{"results", 1, 0, 'o'},
+		{"seed", 1, 0, 's'},
+		{NULL, 0, 0, 0,}
+	};
+
+	/* supress getopt errors about unknown options */
+	opterr = 0;
+	while((c = getopt_long(argc, argv, "",
+			       long_options, &option_index)) != -1) {
+		switch(c) {
+		case 'l':
+			list_subtests = true;
+			break;
+		case 'r':
+			add_subtest_filters(optarg);
+			break;
+		case 'a':
+			run_all_subtests = true;
+			/* fall through */
+		case 'f':
+			runner_mode = true;
+			fork_subtests = true;
+			break;
+		case 'j':
+			subtest_jobs = atoi(optarg);
+			if (subtest_jobs <= 0)
+				subtest_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+			runner_mode = true;
+			fork_subtests = true;
+			break;
+		case 'o':
+			free(subtest_results_file);
+			subtest_results_file = strdup(optarg);
+			runner_mode = true;
+			stats_enabled = true;
+			break;
+		case 's':
+			seed_override = true;
+			seed_override_value = strtoull(optarg, NULL, 0);
+			/* reseed on next use, even if the test already did */
+			rng_seeded = false;
+			break;
+		}
 	}
 
-	switch (depth) {
-	case 16:
-		format = CAIRO_FORMAT_RGB16_565;
-		break;
-	case 24:
-		format = CAIRO_FORMAT_RGB24;
-		break;
-#if 0
-	case 30:
-		format = CAIRO_FORMAT_RGB30;
-		break;
-#endif
-	case 32:
-		format = CAIRO_FORMAT_ARGB32;
-		break;
+	if (run_all_subtests)
+		num_subtest_filters = 0;
+
+	if (runner_mode && !list_subtests && !exit_handler_installed)
+		install_exit_handler();
+
+	/* reset opt parsing */
+	optind = 1;
+}
+
+static bool start_subtest(const char *subtest_name, bool parallel)
+{
+	struct subtest *st;
+	pid_t pid;
+
+	if (!runner_mode)
+		return true;
+
+	/* Serial subtests must not overlap with anything else. */
+	if (fork_subtests)
+		reap_subtests(parallel ? subtest_jobs - 1 : 0);
+
+	if (num_subtests == max_subtests) {
+		max_subtests = max_subtests ? 2 * max_subtests : 16;
+		subtests = realloc(subtests, max_subtests * sizeof(*subtests));
+		assert(subtests);
+	}
+	st = &subtests[num_subtests++];
+	memset(st, 0, sizeof(*st));
+	st->name = strdup(subtest_name);
+	st->result = SUBTEST_RUNNING;
+	st->stats_fd = -1;
+	/* starting point for the instrumentation deltas */
+	st->stats = process_stats;
+	clock_gettime(CLOCK_MONOTONIC, &st->start);
+
+	if (!fork_subtests) {
+		getrusage(RUSAGE_SELF, &st->rusage);
+		current_subtest = st;
+		return true;
+	}
+
+	if (stats_enabled) {
+		int fds[2];
+
+		if (pipe2(fds, O_CLOEXEC) == 0) {
+			st->stats_fd = fds[0];
+			subtest_stats_fd = fds[1];
+		}
+	}
+
+	/* Don't let the child inherit (and later flush) pending output. */
+	fflush(NULL);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		in_subtest_child = true;
+		exit_handler_pid = getpid();
+		return true;
+	}
+
+	if (subtest_stats_fd >= 0) {
+		close(subtest_stats_fd);
+		subtest_stats_fd = -1;
+	}
+
+	st->pid = pid;
+	running_subtests++;
+	if (!parallel)
+		reap_subtests(0);
+
+	return false;
+}
+
+static bool run_subtest(const char *subtest_name, bool parallel)
+{
+	if (list_subtests) {
+		printf("%s\n", subtest_name);
+		return false;
+	}
+
+	/* A forked subtest ends where the next one starts. */
+	if (in_subtest_child)
+		exit(0);
+
+	finish_current_subtest(0);
+
+	if (!subtest_selected(subtest_name))
+		return false;
+
+	return start_subtest(subtest_name, parallel);
+}
+
+/*
+ * Note: Testcases which use these helpers MUST NOT output anything to stdout
+ * outside of places protected by drmtest_run_subtest checks - the piglit
+ * runner adds every line to the subtest list.
+ */
+bool drmtest_run_subtest(const char *subtest_name)
+{
+	return run_subtest(subtest_name, false);
+}
+
+/*
+ * Like drmtest_run_subtest(), but declares that the subtest doesn't touch
+ * any state shared with other subtests (like the GPU or a drm fd opened
+ * before it), so that with --jobs it may run concurrently with other
+ * parallel subtests.
+ */
+bool drmtest_run_parallel_subtest(const char *subtest_name)
+{
+	return run_subtest(subtest_name, true);
+}
+
+bool drmtest_only_list_subtests(void)
+{
+	return list_subtests;
+}
+
+/* other helpers */
+
+/*
+ * Seedable random numbers for the tests, a PCG32 generator. The seed is
+ * logged on first use, and DRMTEST_SEED or --seed override whatever the
+ * test asks for, so randomised failures can be replayed exactly.
+ */
+#define PCG_MULT	6364136223846793005ULL
+#define PCG_INC		1442695040888963407ULL
+#define DEFAULT_SEED	0xdeadbeef
+
+uint32_t drmtest_random(void)
+{
+	uint64_t old;
+	uint32_t xorshifted, rot;
+
+	if (!rng_seeded)
+		drmtest_srandom(DEFAULT_SEED);
+
+	old = rng_state;
+	rng_state = old * PCG_MULT + PCG_INC;
+
+	xorshifted = ((old >> 18) ^ old) >> 27;
+	rot = old >> 59;
+	return (xorshifted >> rot) | (xorshifted << (-rot & 31));
+}
+
+/**
+ * drmtest_srandom() - seed drmtest_random()
+ *
+ * Returns the seed actually used, which differs from @seed when it has been
+ * overridden from the environment or the command line. Tests which also
+ * use random() should pass it on to srandom().
+ */
+uint64_t drmtest_srandom(uint64_t seed)
+{
+	const char *env = getenv("DRMTEST_SEED");
+
+	if (seed_override)
+		seed = seed_override_value;
+	else if (env && *env)
+		seed = strtoull(env, NULL, 0);
+
+	rng_seeded = true;
+	rng_state = 0;
+	drmtest_random();
+	rng_state += seed;
+	drmtest_random();
+
+	fprintf(stderr, "random seed 0x%llx\n", (unsigned long long)seed);
+
+	return seed;
+}
+
+/* uniform in [0, bound), without the bias of a plain modulo */
+uint32_t drmtest_random_range(uint32_t bound)
+{
+	uint64_t m;
+	uint32_t threshold;
+
+	assert(bound);
+
+	m = (uint64_t)drmtest_random() * bound;
+	if ((uint32_t)m < bound) {
+		threshold = -bound % bound;
+		while ((uint32_t)m < threshold)
+			m = (uint64_t)drmtest_random() * bound;
+	}
+
+	return m >> 32;
+}
+
+#define SHUFFLE(type, array, size) do { \
+	type *arr__ = (array), tmp__; \
+	unsigned i__, j__; \
+	for (i__ = (size) - 1; i__ > 0; i__--) { \
+		j__ = drmtest_random_range(i__ + 1); \
+		tmp__ = arr__[i__]; \
+		arr__[i__] = arr__[j__]; \
+		arr__[j__] = tmp__; \
+	} \
+} while (0)
+
+/**
+ * drmtest_shuffle() - uniformly permute an array in place
+ *
+ * Element sizes of 4 and 8 bytes get dedicated loops, anything else is
+ * swapped with memcpy.
+ */
+void drmtest_shuffle(void *array, unsigned count, size_t size)
+{
+	char *bytes = array;
+	char tmp[size];
+	unsigned i, j;
+
+	if (count < 2)
+		return;
+
+	switch (size) {
+	case 4:
+		SHUFFLE(uint32_t, array, count);
+		return;
+	case 8:
+		SHUFFLE(uint64_t, array, count);
+		return;
+	}
+
+	for (i = count - 1; i > 0; i--) {
+		j = drmtest_random_range(i + 1);
+		if (i == j)
+			continue;
+
+		memcpy(tmp, bytes + i * size, size);
+		memcpy(bytes + i * size, bytes + j * size, size);
+		memcpy(bytes + j * size, tmp, size);
+	}
+}
+
+void drmtest_exchange_int(void *array, unsigned i, unsigned j)
+{
+	int *int_arr, tmp;
+	int_arr = array;
+
+	tmp = int_arr[i];
+	int_arr[i] = int_arr[j];
+	int_arr[j] = tmp;
+}
+
+void drmtest_permute_array(void *array, unsigned size,
+			   void (*exchange_func)(void *array,
+						 unsigned i,
+						 unsigned j))
+{
+	unsigned i, l;
+
+	if (size < 2)
+		return;
+
+	for (i = size - 1; i > 0; i--) {
+		l = drmtest_random_range(i + 1);
+		if (i != l)
+			exchange_func(array, i, l);
+	}
+}
+
+void drmtest_progress(const char *header, uint64_t i, uint64_t total)
+{
+	int divider = 200;
+
+	if (!isatty(fileno(stderr)))
+		return;
+
+	if (i+1 >= total) {
+		fprintf(stderr, "\r%s100%%\n", header);
+		return;
+	}
+
+	if (total / 200 == 0)
+		divider = 1;
+
+	/* only bother updating about every 0.5% */
+	if (i % (total / divider) == 0 || i+1 >= total) {
+		fprintf(stderr, "\r%s%3llu%%", header,
+			(long long unsigned) i * 100 / total);
+	}
+}
+
+/*
+ * mappable aperture trasher helper
+ *
+ * Cycles GTT mmap access through a working set of objects, by default as
+ * large as the mappable aperture, so that faulting them in evicts whatever
+ * the test had bound there. Object size, working set, access order, thread
+ * count and a target rate are tunable through drmtest_trash_opts or
+ * DRMTEST_APERTURE_TRASH (e.g. "size=262144,set=512,pattern=random,
+ * threads=4,rate=20000", set in MiB).
+ */
+struct trash_thread {
+	pthread_t thread;
+	int id;
+	uint64_t xorshift;
+	struct drmtest_trash_stats stats;
+};
+
+static drm_intel_bo **trash_bos;
+static int num_trash_bos;
+static uint64_t *trash_last_touch;
+static uint64_t trash_touches;	/* global sequence number, atomic */
+static struct drmtest_trash_opts trash_opts;
+static struct drmtest_trash_stats trash_stats;
+static unsigned trash_stride;
+static int trash_capacity;	/* objects which fit the mappable aperture */
+
+static unsigned gcd(unsigned a, unsigned b)
+{
+	while (b) {
+		unsigned t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static void parse_trash_opts(struct drmtest_trash_opts *opts)
+{
+	char *env = getenv("DRMTEST_APERTURE_TRASH"), *copy, *tok, *save;
+
+	if (!env)
+		return;
+
+	copy = strdup(env);
+	for (tok = strtok_r(copy, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if (!strncmp(tok, "size=", 5))
+			opts->object_size = strtoul(tok + 5, NULL, 0);
+		else if (!strncmp(tok, "set=", 4))
+			opts->working_set = strtoull(tok + 4, NULL, 0) << 20;
+		else if (!strcmp(tok, "pattern=sequential"))
+			opts->pattern = DRMTEST_TRASH_SEQUENTIAL;
+		else if (!strcmp(tok, "pattern=random"))
+			opts->pattern = DRMTEST_TRASH_RANDOM;
+		else if (!strcmp(tok, "pattern=strided"))
+			opts->pattern = DRMTEST_TRASH_STRIDED;
+		else if (!strncmp(tok, "stride=", 7))
+			opts->stride = atoi(tok + 7);
+		else if (!strncmp(tok, "threads=", 8))
+			opts->threads = atoi(tok + 8);
+		else if (!strncmp(tok, "rate=", 5))
+			opts->rate = atoi(tok + 5);
+		else
+			fprintf(stderr, "unknown aperture trash option \"%s\"\n",
+				tok);
+	}
+	free(copy);
+}
+
+void drmtest_init_aperture_trashers_opts(drm_intel_bufmgr *bufmgr,
+					 const struct drmtest_trash_opts *opts)
+{
+	uint64_t mappable = gem_mappable_aperture_size();
+	int i;
+
+	memset(&trash_opts, 0, sizeof(trash_opts));
+	if (opts)
+		trash_opts = *opts;
+	parse_trash_opts(&trash_opts);
+
+	if (trash_opts.object_size == 0)
+		trash_opts.object_size = 1024*1024;
+	trash_opts.object_size = (trash_opts.object_size + 4095) & ~4095;
+	if (trash_opts.working_set == 0)
+		trash_opts.working_set = mappable;
+	if (trash_opts.threads <= 0)
+		trash_opts.threads = 1;
+
+	num_trash_bos = trash_opts.working_set / trash_opts.object_size;
+	if (num_trash_bos == 0)
+		num_trash_bos = 1;
+	trash_capacity = mappable / trash_opts.object_size;
+
+	/* a stride coprime to the object count visits every object */
+	trash_stride = trash_opts.stride > 0 ? trash_opts.stride : 17;
+	while (gcd(trash_stride, num_trash_bos) != 1)
+		trash_stride++;
+
+	trash_bos = malloc(num_trash_bos * sizeof(drm_intel_bo *));
+	assert(trash_bos);
+	trash_last_touch = calloc(num_trash_bos, sizeof(*trash_last_touch));
+	assert(trash_last_touch);
+
+	for (i = 0; i < num_trash_bos; i++)
+		trash_bos[i] = drm_intel_bo_alloc(bufmgr, "trash bo",
+						  trash_opts.object_size, 4096);
+
+	memset(&trash_stats, 0, sizeof(trash_stats));
+	trash_touches = 0;
+}
+
+void drmtest_init_aperture_trashers(drm_intel_bufmgr *bufmgr)
+{
+	drmtest_init_aperture_trashers_opts(bufmgr, NULL);
+}
+
+static int trash_index(struct trash_thread *t, int i)
+{
+	switch (trash_opts.pattern) {
+	case DRMTEST_TRASH_RANDOM:
+		t->xorshift ^= t->xorshift << 13;
+		t->xorshift ^= t->xorshift >> 7;
+		t->xorshift ^= t->xorshift << 17;
+		return t->xorshift % num_trash_bos;
+	case DRMTEST_TRASH_STRIDED:
+		return ((uint64_t)i * trash_stride) % num_trash_bos;
 	default:
-		fprintf(stderr, "bad depth %d\n", depth);
-		return NULL;
+		return i;
 	}
+}
 
-	assert (bpp >= depth);
+static void *trash_thread(void *data)
+{
+	struct trash_thread *t = data;
+	struct timespec start, before, after, due;
+	uint64_t ns, seq, interval = 0;
+	int i, idx, n = 0;
+
+	if (trash_opts.rate > 0)
+		interval = 1000000000ULL * trash_opts.threads / trash_opts.rate;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = t->id; i < num_trash_bos; i += trash_opts.threads) {
+		if (interval) {
+			ns = start.tv_nsec + interval * n++;
+			due.tv_sec = start.tv_sec + ns / 1000000000;
+			due.tv_nsec = ns % 1000000000;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&due, NULL);
+		}
+
+		idx = trash_index(t, i);
+
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		drm_intel_gem_bo_map_gtt(trash_bos[idx]);
+		*(volatile uint8_t *)trash_bos[idx]->virtual = 0;
+		drm_intel_gem_bo_unmap_gtt(trash_bos[idx]);
+		clock_gettime(CLOCK_MONOTONIC, &after);
+
+		ns = (after.tv_sec - before.tv_sec) * 1000000000ULL +
+			after.tv_nsec - before.tv_nsec;
+		t->stats.touches++;
+		t->stats.fault_ns += ns;
+		if (ns > t->stats.max_fault_ns)
+			t->stats.max_fault_ns = ns;
+
+		/*
+		 * Estimate evictions assuming LRU: an object not touched
+		 * within the last aperture's worth of touches was unbound,
+		 * and binding it again pushed another one out.
+		 */
+		seq = __sync_add_and_fetch(&trash_touches, 1);
+		if (seq > (uint64_t)trash_capacity &&
+		    (trash_last_touch[idx] == 0 ||
+		     seq - trash_last_touch[idx] > (uint64_t)trash_capacity))
+			t->stats.evictions++;
+		trash_last_touch[idx] = seq;
+	}
+
+	return NULL;
+}
+
+void drmtest_trash_aperture(void)
+{
+	struct trash_thread *threads;
+	struct timespec start, end;
+	int i;
+
+	threads = calloc(trash_opts.threads, sizeof(*threads));
+	assert(threads);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < trash_opts.threads; i++) {
+		threads[i].id = i;
+		/* derived from the logged seed, so runs are reproducible */
+		if (trash_opts.pattern == DRMTEST_TRASH_RANDOM)
+			threads[i].xorshift = ((uint64_t)drmtest_random() << 32 |
+					       drmtest_random()) | 1;
+		if (trash_opts.threads == 1)
+			trash_thread(&threads[i]);
+		else
+			assert(pthread_create(&threads[i].thread, NULL,
+					      trash_thread, &threads[i]) == 0);
+	}
+
+	for (i = 0; i < trash_opts.threads; i++) {
+		if (trash_opts.threads > 1)
+			pthread_join(threads[i].thread, NULL);
+
+		trash_stats.touches += threads[i].stats.touches;
+		trash_stats.evictions += threads[i].stats.evictions;
+		trash_stats.fault_ns += threads[i].stats.fault_ns;
+		if (threads[i].stats.max_fault_ns > trash_stats.max_fault_ns)
+			trash_stats.max_fault_ns = threads[i].stats.max_fault_ns;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	trash_stats.ns += (end.tv_sec - start.tv_sec) * 1000000000ULL +
+		end.tv_nsec - start.tv_nsec;
+	free(threads);
+}
+
+void drmtest_aperture_trash_stats(struct drmtest_trash_stats *stats)
+{
+	*stats = trash_stats;
+}
+
+void drmtest_cleanup_aperture_trashers(void)
+{
+	int i;
+
+	if (trash_stats.touches && trash_stats.ns)
+		fprintf(stderr, "aperture trasher: %llu objects of %uKiB, "
+			"%.0f evictions/s, fault latency avg %.1fus, "
+			"max %.1fus\n",
+			(unsigned long long)trash_stats.touches,
+			trash_opts.object_size >> 10,
+			trash_stats.evictions * 1e9 / trash_stats.ns,
+			trash_stats.fault_ns / 1e3 / trash_stats.touches,
+			trash_stats.max_fault_ns / 1e3);
+
+	for (i = 0; i < num_trash_bos; i++)
+		drm_intel_bo_unreference(trash_bos[i]);
+
+	free(trash_bos);
+	free(trash_last_touch);
+	trash_bos = NULL;
+	trash_last_touch = NULL;
+	num_trash_bos = 0;
+}
+
+/*
+ * helpers to create nice-looking framebuffers
+ *
+ * The pattern is rendered into a malloc'ed linear buffer, tiled in software
+ * if needed and uploaded with pwrite, instead of drawing through an
+ * uncached GTT mapping. The base pattern (gradients and corner markers)
+ * only depends on the framebuffer layout, so the most recently used ones
+ * are cached, up to FB_PATTERN_CACHE_BYTES in total.
+ */
+#define FB_PATTERN_CACHE_BYTES (64 << 20)
+
+struct fb_pattern {
+	int width, height, bpp, depth;
+	unsigned stride;
+	uint8_t *data;
+	struct fb_pattern *next;
+};
+
+static struct fb_pattern *fb_patterns;
+
+static unsigned
+fb_alloc(int fd, int width, int height, int bpp, bool tiled,
+	 struct kmstest_fb *fb_info)
+{
+	struct drm_i915_gem_set_tiling set_tiling;
+	unsigned size, stride;
+
+	if (tiled) {
+		unsigned v;
+
+		/* Round the tiling up to the next power-of-two and the
+		 * region up to the next pot fence size so that this works
+		 * on all generations.
+		 *
+		 * This can still fail if the framebuffer is too large to
+		 * be tiled. But then that failure is expected.
+		 */
+
+		v = width * bpp / 8;
+		for (stride = 512; stride < v; stride *= 2)
+			;
+
+		v = stride * height;
+		for (size = 1024*1024; size < v; size *= 2)
+			;
+	} else {
+		/* Scan-out has a 64 byte alignment restriction */
+		stride = (width * (bpp / 8) + 63) & ~63;
+		size = stride * height;
+	}
 
 	fb_info->gem_handle = gem_create(fd, size);
 
@@ -725,60 +1946,135 @@ paint_allocate_surface(int fd, int width, int height, int depth, int bpp,
 		set_tiling.handle = fb_info->gem_handle;
 		set_tiling.tiling_mode = I915_TILING_X;
 		set_tiling.stride = stride;
-		if (ioctl(fd, DRM_IOCTL_I915_GEM_SET_TILING, &set_tiling)) {
+		if (drmtest_ioctl(fd, DRM_IOCTL_I915_GEM_SET_TILING,
+				  &set_tiling)) {
 			fprintf(stderr, "set tiling failed: %s (stride=%d, size=%d)\n",
 				strerror(errno), stride, size);
-			return NULL;
+			return 0;
 		}
 	}
 
-	fb_ptr = gem_mmap(fd, fb_info->gem_handle, size, PROT_READ | PROT_WRITE);
-
 	fb_info->stride = stride;
 	fb_info->size = size;
 
-	return cairo_image_surface_create_for_data((unsigned char *)fb_ptr,
-						   format, width, height,
-						   stride);
+	return size;
 }
 
+/*
+ * Same as a cairo linear gradient from (r, g, b) at the top left corner to
+ * black at the bottom right one. Along a row each colour channel is a
+ * linear ramp, computed in 16.16 fixed point, so the inner loops are plain
+ * integer arithmetic the compiler can vectorise.
+ */
 static void
-paint_color_gradient(cairo_t *cr, int x, int y, int w, int h,
+paint_color_gradient(struct fb_pattern *pat, int x, int y, int w, int h,
 		     int r, int g, int b)
 {
-	cairo_pattern_t *pat;
+	double len2 = (double)w * w + (double)h * h;
+	int rmax, gmax, bmax, rshift, gshift;
+	uint32_t alpha;
+	int n, px, py;
 
-	pat = cairo_pattern_create_linear(x, y, x + w, y + h);
-	cairo_pattern_add_color_stop_rgba(pat, 1, 0, 0, 0, 1);
-	cairo_pattern_add_color_stop_rgba(pat, 0, r, g, b, 1);
+	if (w <= 0 || h <= 0)
+		return;
 
-	cairo_rectangle(cr, x, y, w, h);
-	cairo_set_source(cr, pat);
-	cairo_fill(cr);
-	cairo_pattern_destroy(pat);
+	if (pat->depth == 16) {
+		rmax = r * 31, gmax = g * 63, bmax = b * 31;
+		rshift = 11, gshift = 5;
+		alpha = 0;
+	} else {
+		rmax = r * 255, gmax = g * 255, bmax = b * 255;
+		rshift = 16, gshift = 8;
+		alpha = 0xff000000;
+	}
+
+	n = w;
+	if (x + n > pat->width)
+		n = pat->width - x;
+
+	for (py = y; py < y + h && py < pat->height; py++) {
+		uint8_t *row = pat->data + py * pat->stride;
+		/*
+		 * The colour is (1 - t) * max with
+		 * t = ((px - x + 0.5) * w + (py - y + 0.5) * h) / len2,
+		 * which stays within [0, 1) for every pixel of the box.
+		 */
+		double c = 1 - (0.5 * w + (py - y + 0.5) * h) / len2;
+		double dc = w / len2;
+		int32_t r0 = (c * rmax + .5) * 65536, dr = dc * rmax * 65536;
+		int32_t g0 = (c * gmax + .5) * 65536, dg = dc * gmax * 65536;
+		int32_t b0 = (c * bmax + .5) * 65536, db = dc * bmax * 65536;
+
+		if (pat->bpp == 16) {
+			uint16_t *p = (uint16_t *)row + x;
+
+			for (px = 0; px < n; px++)
+				p[px] = (r0 - px * dr) >> 16 << rshift |
+					(g0 - px * dg) >> 16 << gshift |
+					(b0 - px * db) >> 16;
+		} else {
+			uint32_t *p = (uint32_t *)row + x;
+
+			for (px = 0; px < n; px++)
+				p[px] = alpha |
+					(r0 - px * dr) >> 16 << rshift |
+					(g0 - px * dg) >> 16 << gshift |
+					(b0 - px * db) >> 16;
+		}
+	}
 }
 
 static void
-paint_test_patterns(cairo_t *cr, int width, int height)
+paint_test_patterns(struct fb_pattern *pat)
 {
-	double gr_height, gr_width;
+	int gr_height, gr_width;
 	int x, y;
 
-	y = height * 0.10;
-	gr_width = width * 0.75;
-	gr_height = height * 0.08;
-	x = (width / 2) - (gr_width / 2);
+	y = pat->height * 0.10;
+	gr_width = pat->width * 0.75;
+	gr_height = pat->height * 0.08;
+	x = (pat->width / 2) - (gr_width / 2);
 
-	paint_color_gradient(cr, x, y, gr_width, gr_height, 1, 0, 0);
+	paint_color_gradient(pat, x, y, gr_width, gr_height, 1, 0, 0);
 
 	y += gr_height;
-	paint_color_gradient(cr, x, y, gr_width, gr_height, 0, 1, 0);
+	paint_color_gradient(pat, x, y, gr_width, gr_height, 0, 1, 0);
 
 	y += gr_height;
-	paint_color_gradient(cr, x, y, gr_width, gr_height, 0, 0, 1);
+	paint_color_gradient(pat, x, y, gr_width, gr_height, 0, 0, 1);
 
 	y += gr_height;
-	paint_color_gradient(cr, x, y, gr_width, gr_height, 1, 1, 1);
+	paint_color_gradient(pat, x, y, gr_width, gr_height, 1, 1, 1);
+}
+
+static cairo_surface_t *
+pattern_surface(int depth, int width, int height, unsigned stride,
+		uint8_t *data)
+{
+	cairo_format_t format;
+
+	switch (depth) {
+	case 16:
+		format = CAIRO_FORMAT_RGB16_565;
+		break;
+	case 24:
+		format = CAIRO_FORMAT_RGB24;
+		break;
+#if 0
+	case 30:
+		format = CAIRO_FORMAT_RGB30;
+		break;
+#endif
+	case 32:
+		format = CAIRO_FORMAT_ARGB32;
+		break;
+	default:
+		fprintf(stderr, "bad depth %d\n", depth);
+		return NULL;
+	}
+
+	return cairo_image_surface_create_for_data(data, format,
+						   width, height, stride);
 }
 
 enum corner {
@@ -842,25 +2138,9 @@ paint_marker(cairo_t *cr, int x, int y, char *str, enum corner text_location)
 	cairo_fill(cr);
 }
 
-unsigned int kmstest_create_fb(int fd, int width, int height, int bpp,
-			       int depth, bool tiled,
-			       struct kmstest_fb *fb_info,
-			       kmstest_paint_func paint_func,
-			       void *func_arg)
+static void paint_markers(cairo_t *cr, int width, int height)
 {
-	cairo_surface_t *surface;
-	cairo_status_t status;
-	cairo_t *cr;
 	char buf[128];
-	unsigned int fb_id;
-
-	surface = paint_allocate_surface(fd, width, height, depth, bpp,
-					 tiled, fb_info);
-	assert(surface);
-
-	cr = cairo_create(surface);
-
-	paint_test_patterns(cr, width, height);
 
 	cairo_set_line_cap(cr, CAIRO_LINE_CAP_SQUARE);
 
@@ -873,20 +2153,219 @@ unsigned int kmstest_create_fb(int fd, int width, int height, int bpp,
 	paint_marker(cr, 0, height, buf, topright);
 	snprintf(buf, sizeof buf, "(%d, %d)", width, height);
 	paint_marker(cr, width, height, buf, topleft);
+}
 
-	if (paint_func)
-		paint_func(cr, width, height, func_arg);
+static struct fb_pattern *
+get_fb_pattern(int width, int height, int bpp, int depth, unsigned stride)
+{
+	struct fb_pattern *pat, **prev;
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	size_t bytes = (size_t)stride * height;
+
+	for (prev = &fb_patterns; (pat = *prev); prev = &pat->next) {
+		if (pat->width == width && pat->height == height &&
+		    pat->bpp == bpp && pat->depth == depth &&
+		    pat->stride == stride) {
+			/* move to front */
+			*prev = pat->next;
+			pat->next = fb_patterns;
+			fb_patterns = pat;
+			return pat;
+		}
+	}
+
+	/*
+	 * Make room by dropping the least recently used ones. The new one is
+	 * kept even if it alone exceeds the limit, kmstest_create_fb() still
+	 * needs it.
+	 */
+	for (prev = &fb_patterns; (pat = *prev); ) {
+		size_t size = (size_t)pat->stride * pat->height;
+
+		if (bytes + size <= FB_PATTERN_CACHE_BYTES) {
+			bytes += size;
+			prev = &pat->next;
+			continue;
+		}
 
-	status = cairo_status(cr);
-	assert(!status);
+		*prev = pat->next;
+		free(pat->data);
+		free(pat);
+	}
+
+	pat = calloc(1, sizeof(*pat));
+	assert(pat);
+	pat->width = width;
+	pat->height = height;
+	pat->bpp = bpp;
+	pat->depth = depth;
+	pat->stride = stride;
+	pat->data = calloc(stride, height);
+	assert(pat->data);
+
+	paint_test_patterns(pat);
+
+	surface = pattern_surface(depth, width, height, stride, pat->data);
+	assert(surface);
+	cr = cairo_create(surface);
+	paint_markers(cr, width, height);
+	assert(!cairo_status(cr));
 	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+
+	pat->next = fb_patterns;
+	fb_patterns = pat;
+
+	return pat;
+}
+
+static int fb_swizzle_mode(int fd, uint32_t handle)
+{
+	struct drm_i915_gem_get_tiling get_tiling;
+
+	get_tiling.handle = handle;
+	if (drmtest_ioctl(fd, DRM_IOCTL_I915_GEM_GET_TILING, &get_tiling))
+		return I915_BIT_6_SWIZZLE_UNKNOWN;
+
+	return get_tiling.swizzle_mode;
+}
+
+/*
+ * Lay out a linear image as X tiles, the way the object's backing pages
+ * are seen by pwrite. Bit 17 swizzling is undone by the kernel in pwrite,
+ * the bit 9/10/11 parts are applied here.
+ */
+static bool
+tile_x(uint8_t *dst, const uint8_t *src, unsigned stride, int height,
+       int swizzle)
+{
+	unsigned x, y, tiles_per_row = stride / 512;
+	unsigned chunk, bits;
+
+	switch (swizzle) {
+	case I915_BIT_6_SWIZZLE_NONE:
+		bits = 0;
+		break;
+	case I915_BIT_6_SWIZZLE_9:
+	case I915_BIT_6_SWIZZLE_9_17:
+		bits = 1 << 9;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10:
+	case I915_BIT_6_SWIZZLE_9_10_17:
+		bits = 1 << 9 | 1 << 10;
+		break;
+	case I915_BIT_6_SWIZZLE_9_11:
+		bits = 1 << 9 | 1 << 11;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10_11:
+		bits = 1 << 9 | 1 << 10 | 1 << 11;
+		break;
+	default:
+		return false;
+	}
+
+	for (y = 0; y < (unsigned)height; y++) {
+		for (x = 0; x < tiles_per_row; x++) {
+			unsigned off = ((y / 8) * tiles_per_row + x) * 4096 +
+				(y % 8) * 512;
+
+			if (!bits) {
+				memcpy(dst + off, src + y * stride + x * 512, 512);
+				continue;
+			}
+
+			for (chunk = 0; chunk < 512; chunk += 64) {
+				unsigned o = off + chunk;
+
+				o ^= (__builtin_popcount(o & bits) & 1) << 6;
+				memcpy(dst + o,
+				       src + y * stride + x * 512 + chunk, 64);
+			}
+		}
+	}
+
+	return true;
+}
+
+static void
+fb_upload(int fd, bool tiled, struct kmstest_fb *fb_info, const uint8_t *data,
+	  int height)
+{
+	unsigned stride = fb_info->stride;
+	unsigned tiled_height = (height + 7) & ~7;
+	uint8_t *tiled_data, *ptr;
+	int y;
+
+	if (!tiled) {
+		gem_write(fd, fb_info->gem_handle, 0, data, stride * height);
+		return;
+	}
+
+	tiled_data = calloc(stride, tiled_height);
+	assert(tiled_data);
+	if (tile_x(tiled_data, data, stride, height,
+		   fb_swizzle_mode(fd, fb_info->gem_handle))) {
+		gem_write(fd, fb_info->gem_handle, 0, tiled_data,
+			  stride * tiled_height);
+		free(tiled_data);
+		return;
+	}
+	free(tiled_data);
+
+	/* unknown swizzling, let the fence detile it */
+	ptr = gem_mmap(fd, fb_info->gem_handle, fb_info->size,
+		       PROT_READ | PROT_WRITE);
+	assert(ptr);
+	for (y = 0; y < height; y++)
+		memcpy(ptr + y * stride, data + y * stride, stride);
+	munmap(ptr, fb_info->size);
+}
+
+unsigned int kmstest_create_fb(int fd, int width, int height, int bpp,
+			       int depth, bool tiled,
+			       struct kmstest_fb *fb_info,
+			       kmstest_paint_func paint_func,
+			       void *func_arg)
+{
+	struct fb_pattern *pat;
+	uint8_t *data;
+	unsigned int fb_id, size;
+
+	assert (bpp >= depth);
+
+	size = fb_alloc(fd, width, height, bpp, tiled, fb_info);
+	assert(size);
+
+	pat = get_fb_pattern(width, height, bpp, depth, fb_info->stride);
+	data = pat->data;
+
+	if (paint_func) {
+		cairo_surface_t *surface;
+		cairo_t *cr;
+
+		data = malloc(fb_info->stride * height);
+		assert(data);
+		memcpy(data, pat->data, fb_info->stride * height);
+
+		surface = pattern_surface(depth, width, height,
+					  fb_info->stride, data);
+		assert(surface);
+		cr = cairo_create(surface);
+		paint_func(cr, width, height, func_arg);
+		assert(!cairo_status(cr));
+		cairo_destroy(cr);
+		cairo_surface_destroy(surface);
+	}
+
+	fb_upload(fd, tiled, fb_info, data, height);
+	if (data != pat->data)
+		free(data);
 
 	do_or_die(drmModeAddFB(fd, width, height, depth, bpp,
 			       fb_info->stride,
 			       fb_info->gem_handle, &fb_id));
 
-	cairo_surface_destroy(surface);
-
 	fb_info->fb_id = fb_id;
 
 	return fb_id;
@@ -37,6 +37,12 @@
 #include "xf86drmMode.h"
 #include "intel_batchbuffer.h"
 
+/*
+ * Send the tests' own drmIoctl() calls through drmtest_ioctl(), so that
+ * they are accounted and work against the fake i915 device.
+ */
+#define drmIoctl(fd, request, arg) drmtest_ioctl(fd, request, arg)
+
 drm_intel_bo * gem_handle_to_libdrm_bo(drm_intel_bufmgr *bufmgr, int fd,
 				       const char *name, uint32_t handle);
 
@@ -47,6 +53,7 @@ int drm_open_any_master(void);
 void gem_quiescent_gpu(int fd);
 
 /* ioctl wrappers and similar stuff for bare metal testing */
+int drmtest_ioctl(int fd, unsigned long request, void *arg);
 void gem_set_tiling(int fd, uint32_t handle, int tiling, int stride);
 int gem_has_cacheing(int fd);
 void gem_set_cacheing(int fd, uint32_t handle, int cacheing);
@@ -76,8 +83,21 @@ int prime_handle_to_fd(int fd, uint32_t handle);
 uint32_t prime_fd_to_handle(int fd, int dma_buf_fd);
 
 /* generally useful helpers */
+struct drmtest_signal_opts {
+	int rate;		/* signals per second, default 500 */
+	int jitter;		/* in percent of the period */
+	int burst;		/* signals sent back to back per period */
+	bool use_timer;		/* POSIX timer instead of a helper process */
+	bool interrupt;		/* no SA_RESTART, ioctls see EINTR */
+};
+
+void drmtest_start_signal_helper(const struct drmtest_signal_opts *opts);
 void drmtest_fork_signal_helper(void);
 void drmtest_stop_signal_helper(void);
+uint32_t drmtest_random(void);
+uint64_t drmtest_srandom(uint64_t seed);
+uint32_t drmtest_random_range(uint32_t bound);
+void drmtest_shuffle(void *array, unsigned count, size_t size);
 void drmtest_exchange_int(void *array, unsigned i, unsigned j);
 void drmtest_permute_array(void *array, unsigned size,
 			   void (*exchange_func)(void *array,
@@ -86,11 +106,38 @@ void drmtest_permute_array(void *array, unsigned size,
 void drmtest_progress(const char *header, uint64_t i, uint64_t total);
 void drmtest_subtest_init(int argc, char **argv);
 bool drmtest_run_subtest(const char *subtest_name);
+bool drmtest_run_parallel_subtest(const char *subtest_name);
 bool drmtest_only_list_subtests(void);
 
 /* helpers based upon the libdrm buffer manager */
+enum drmtest_trash_pattern {
+	DRMTEST_TRASH_SEQUENTIAL,
+	DRMTEST_TRASH_RANDOM,
+	DRMTEST_TRASH_STRIDED,
+};
+
+struct drmtest_trash_opts {
+	unsigned object_size;	/* bytes, default 1MiB */
+	uint64_t working_set;	/* bytes, default the mappable aperture */
+	enum drmtest_trash_pattern pattern;
+	int stride;		/* in objects, for DRMTEST_TRASH_STRIDED */
+	int threads;
+	int rate;		/* target objects faulted per second, 0 for max */
+};
+
+struct drmtest_trash_stats {
+	uint64_t touches;
+	uint64_t evictions;	/* estimated */
+	uint64_t ns;
+	uint64_t fault_ns;
+	uint64_t max_fault_ns;
+};
+
 void drmtest_init_aperture_trashers(drm_intel_bufmgr *bufmgr);
+void drmtest_init_aperture_trashers_opts(drm_intel_bufmgr *bufmgr,
+					 const struct drmtest_trash_opts *opts);
 void drmtest_trash_aperture(void);
+void drmtest_aperture_trash_stats(struct drmtest_trash_stats *stats);
 void drmtest_cleanup_aperture_trashers(void);
 
 /* helpers to create nice-looking framebuffers */
@@ -122,4 +169,4 @@ inline static void _do_or_die(const char *function, int line, int ret)
 	abort();
 }
 #define do_or_die(x) _do_or_die(__FUNCTION__, __LINE__, x)
-#define do_ioctl(fd, ptr, sz) do_or_die(drmIoctl((fd), (ptr), (sz)))
+#define do_ioctl(fd, ptr, sz) do_or_die(drmtest_ioctl((fd), (ptr), (sz)))
@@ -0,0 +1,1155 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * A minimal software implementation of the i915 GEM uapi, good enough to
+ * run tests which only use pread/pwrite, mmaps, tiling and simple blitter
+ * or MI_STORE_DWORD_IMM batches without a GPU.
+ *
+ * Object backing storage lives in one sparse shared memory file, so that
+ * every mmap handed out is a separate mapping the caller may munmap()
+ * without pulling the storage from under us, and without burning a file
+ * descriptor per object.
+ *
+ * Tiled objects get a second, linear copy of their contents which backs
+ * GTT mmaps. There is no fence hardware to detile on access, so the copy
+ * is synchronised with the tiled backing store whenever an ioctl touches
+ * the object: changed 64 byte chunks are tiled back before the ioctl and
+ * the linear copy is refreshed afterwards. As with real hardware, CPU
+ * writes through a GTT mmap only become visible to "the GPU" once an
+ * ioctl for the object has been issued.
+ *
+ * Fake device and dma-buf fds are empty unlinked files, each with its own
+ * inode, so that an fd number the test closed and got back from an
+ * unrelated open() is not mistaken for the fake one.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "drm.h"
+#include "i915_drm.h"
+#include "intel_gpu_tools.h"
+#include "fake_i915.h"
+
+#define FAKE_DEFAULT_DEVID	PCI_CHIP_IVYBRIDGE_GT2
+#define FAKE_APERTURE_SIZE	(256ULL << 20)
+#define FAKE_GTT_START		(1 << 20)
+#define FAKE_MAX_FILES		64
+#define FAKE_MAX_PRIME_FDS	256
+
+#define PAGE_ALIGN(x)		(((x) + 4095) & ~4095ULL)
+
+/* Not every libdrm knows about these yet */
+#define LOCAL_I915_GEM_WAIT		0x2c
+#define LOCAL_I915_GEM_CONTEXT_CREATE	0x2d
+#define LOCAL_I915_GEM_CONTEXT_DESTROY	0x2e
+#define LOCAL_I915_GEM_SET_CACHEING	0x2f
+#define LOCAL_I915_GEM_GET_CACHEING	0x30
+
+struct local_i915_gem_cacheing {
+	uint32_t handle;
+	uint32_t cacheing;
+};
+
+struct local_i915_gem_context {
+	uint32_t ctx_id;
+	uint32_t pad;
+};
+
+struct fake_bo {
+	int refcount;
+	uint32_t name;
+	uint64_t size;
+	uint64_t offset;	/* in the fake GTT, assigned at execbuf */
+	uint32_t tiling;
+	uint32_t stride;
+	uint32_t cacheing;
+
+	off_t data_off;		/* tiled contents, in the arena */
+	uint8_t *data;
+
+	off_t gtt_off;		/* linear copy for GTT mmaps, or 0 */
+	uint8_t *gtt;
+	uint8_t *gtt_clean;	/* gtt as of the last synchronisation */
+
+	struct fake_bo *next;
+};
+
+struct fake_file {
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	struct fake_bo **handles;
+	uint32_t num_handles;
+	uint32_t next_context;
+};
+
+static struct fake_file *files[FAKE_MAX_FILES];
+static struct {
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	struct fake_bo *bo;
+} prime_fds[FAKE_MAX_PRIME_FDS];
+
+static struct fake_bo *all_bos;
+static uint32_t next_name = 1;
+static uint32_t fake_devid;
+static int swizzle_x = I915_BIT_6_SWIZZLE_NONE;
+static int swizzle_y = I915_BIT_6_SWIZZLE_NONE;
+
+static int arena_fd = -1;
+static off_t arena_end = 4096;	/* so that 0 means "none" */
+static const char *tmp_dir;
+
+static int fail(int err)
+{
+	errno = err;
+	return -1;
+}
+
+bool fake_i915_enabled(void)
+{
+	const char *env = getenv("DRMTEST_FAKE_I915");
+
+	return env && *env && strcmp(env, "0");
+}
+
+static int anon_file(int flags)
+{
+	char path[64];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/fake-i915-XXXXXX", tmp_dir);
+	fd = mkostemp(path, flags);
+	if (fd != -1)
+		unlink(path);
+
+	return fd;
+}
+
+static bool same_file(int fd, dev_t dev, ino_t ino)
+{
+	struct stat st;
+
+	return fstat(fd, &st) == 0 && st.st_dev == dev && st.st_ino == ino;
+}
+
+static void file_ident(int fd, dev_t *dev, ino_t *ino)
+{
+	struct stat st;
+
+	assert(fstat(fd, &st) == 0);
+	*dev = st.st_dev;
+	*ino = st.st_ino;
+}
+
+static void fake_init(void)
+{
+	const char *env = getenv("DRMTEST_FAKE_I915");
+	const char *dirs[] = { "/dev/shm", "/tmp" };
+	unsigned i;
+
+	if (arena_fd != -1)
+		return;
+
+	fake_devid = env ? strtoul(env, NULL, 0) : 0;
+	if (!IS_INTEL(fake_devid))
+		fake_devid = FAKE_DEFAULT_DEVID;
+
+	env = getenv("DRMTEST_FAKE_I915_SWIZZLE");
+	if (env && !strcmp(env, "9")) {
+		swizzle_x = I915_BIT_6_SWIZZLE_9;
+	} else if (env && !strcmp(env, "9_10")) {
+		swizzle_x = I915_BIT_6_SWIZZLE_9_10;
+		swizzle_y = I915_BIT_6_SWIZZLE_9;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(dirs) && arena_fd == -1; i++) {
+		tmp_dir = dirs[i];
+		arena_fd = anon_file(O_CLOEXEC);
+	}
+	assert(arena_fd != -1);
+}
+
+static off_t arena_alloc(uint64_t size)
+{
+	off_t off = arena_end;
+
+	arena_end += PAGE_ALIGN(size);
+	if (ftruncate(arena_fd, arena_end))
+		return 0;
+
+	return off;
+}
+
+static void arena_free(off_t off, uint64_t size)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+	fallocate(arena_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		  off, PAGE_ALIGN(size));
+#endif
+}
+
+static void *arena_map(off_t off, uint64_t size, int prot)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, size, prot, MAP_SHARED, arena_fd, off);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static void bo_unref(struct fake_bo *bo);
+
+/* drop everything a closed file still held, as the kernel would on close */
+static void file_release(struct fake_file *file)
+{
+	uint32_t i;
+
+	for (i = 0; i < file->num_handles; i++)
+		if (file->handles[i])
+			bo_unref(file->handles[i]);
+
+	free(file->handles);
+	free(file);
+}
+
+int fake_i915_open(void)
+{
+	struct fake_file *file;
+	int i, fd;
+
+	fake_init();
+
+	fd = anon_file(O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	/* reuse the slot of a file the test has closed in the meantime */
+	for (i = 0; i < FAKE_MAX_FILES; i++)
+		if (!files[i] || files[i]->fd == fd ||
+		    !same_file(files[i]->fd, files[i]->dev, files[i]->ino))
+			break;
+	assert(i < FAKE_MAX_FILES);
+
+	if (files[i])
+		file_release(files[i]);
+
+	file = calloc(1, sizeof(*file));
+	assert(file);
+	file->fd = fd;
+	file_ident(fd, &file->dev, &file->ino);
+	file->next_context = 1;
+	files[i] = file;
+
+	return fd;
+}
+
+static struct fake_file *fake_file(int fd)
+{
+	int i;
+
+	for (i = 0; i < FAKE_MAX_FILES && files[i]; i++) {
+		if (files[i]->fd != fd)
+			continue;
+
+		if (!same_file(fd, files[i]->dev, files[i]->ino))
+			return NULL;
+
+		return files[i];
+	}
+
+	return NULL;
+}
+
+bool fake_i915_is_fake(int fd)
+{
+	return fake_file(fd) != NULL;
+}
+
+uint64_t fake_i915_mappable_aperture_size(void)
+{
+	return FAKE_APERTURE_SIZE;
+}
+
+/* Tiling */
+
+static uint64_t swizzle(uint64_t off, int mode)
+{
+	switch (mode) {
+	case I915_BIT_6_SWIZZLE_9:
+		return off ^ ((off >> 3) & 64);
+	case I915_BIT_6_SWIZZLE_9_10:
+		return off ^ (((off >> 3) ^ (off >> 4)) & 64);
+	default:
+		return off;
+	}
+}
+
+/* Maps an offset in the linear view of a surface to the tiled layout. */
+static uint64_t tile_offset(uint32_t tiling, uint32_t stride, uint64_t linear)
+{
+	uint64_t x, y, tile;
+
+	if (tiling == I915_TILING_NONE)
+		return linear;
+
+	x = linear % stride;
+	y = linear / stride;
+
+	if (tiling == I915_TILING_X) {
+		tile = (y / 8) * (stride / 512) + x / 512;
+		return swizzle(tile * 4096 + (y % 8) * 512 + x % 512,
+			       swizzle_x);
+	} else {
+		tile = (y / 32) * (stride / 128) + x / 128;
+		return swizzle(tile * 4096 + (x % 128) / 16 * 512 +
+			       (y % 32) * 16 + x % 16, swizzle_y);
+	}
+}
+
+/* Largest run of bytes which is contiguous in both layouts */
+static uint32_t tile_chunk(uint32_t tiling)
+{
+	return tiling == I915_TILING_Y ? 16 : 64;
+}
+
+/* Only whole rows of tiles are visible through the linear view */
+static uint64_t bo_view_size(struct fake_bo *bo)
+{
+	uint64_t row;
+
+	if (bo->tiling == I915_TILING_NONE)
+		return bo->size;
+
+	row = (uint64_t)bo->stride * (bo->tiling == I915_TILING_X ? 8 : 32);
+	return bo->size / row * row;
+}
+
+/* Write CPU changes made through GTT mmaps back to the tiled storage */
+static void bo_flush_gtt(struct fake_bo *bo)
+{
+	uint64_t size = bo_view_size(bo), off;
+	uint32_t chunk = tile_chunk(bo->tiling);
+
+	if (!bo->gtt)
+		return;
+
+	for (off = 0; off < size; off += chunk) {
+		if (!memcmp(bo->gtt + off, bo->gtt_clean + off, chunk))
+			continue;
+
+		memcpy(bo->data + tile_offset(bo->tiling, bo->stride, off),
+		       bo->gtt + off, chunk);
+		memcpy(bo->gtt_clean + off, bo->gtt + off, chunk);
+	}
+}
+
+static void bo_refresh_gtt(struct fake_bo *bo)
+{
+	uint64_t size = bo_view_size(bo), off;
+	uint32_t chunk = tile_chunk(bo->tiling);
+
+	if (!bo->gtt)
+		return;
+
+	for (off = 0; off < size; off += chunk)
+		memcpy(bo->gtt + off,
+		       bo->data + tile_offset(bo->tiling, bo->stride, off),
+		       chunk);
+	memcpy(bo->gtt_clean, bo->gtt, size);
+}
+
+/* Objects */
+
+static struct fake_bo *bo_create(uint64_t size)
+{
+	struct fake_bo *bo;
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		return NULL;
+
+	bo->size = PAGE_ALIGN(size);
+	bo->refcount = 1;
+	bo->data_off = arena_alloc(bo->size);
+	if (bo->data_off)
+		bo->data = arena_map(bo->data_off, bo->size,
+				     PROT_READ | PROT_WRITE);
+	if (!bo->data) {
+		free(bo);
+		return NULL;
+	}
+
+	bo->next = all_bos;
+	all_bos = bo;
+
+	return bo;
+}
+
+static void bo_unref(struct fake_bo *bo)
+{
+	struct fake_bo **p;
+
+	if (--bo->refcount)
+		return;
+
+	for (p = &all_bos; *p != bo; p = &(*p)->next)
+		;
+	*p = bo->next;
+
+	munmap(bo->data, bo->size);
+	arena_free(bo->data_off, bo->size);
+	if (bo->gtt) {
+		munmap(bo->gtt, bo->size);
+		arena_free(bo->gtt_off, bo->size);
+		free(bo->gtt_clean);
+	}
+	free(bo);
+}
+
+static struct fake_bo *lookup(struct fake_file *file, uint32_t handle)
+{
+	if (handle == 0 || handle > file->num_handles)
+		return NULL;
+
+	return file->handles[handle - 1];
+}
+
+static uint32_t add_handle(struct fake_file *file, struct fake_bo *bo)
+{
+	uint32_t i;
+
+	for (i = 0; i < file->num_handles; i++)
+		if (!file->handles[i])
+			break;
+
+	if (i == file->num_handles) {
+		file->handles = realloc(file->handles,
+					(2 * file->num_handles + 16) *
+					sizeof(*file->handles));
+		assert(file->handles);
+		memset(file->handles + file->num_handles, 0,
+		       (file->num_handles + 16) * sizeof(*file->handles));
+		file->num_handles = 2 * file->num_handles + 16;
+	}
+
+	file->handles[i] = bo;
+	return i + 1;
+}
+
+void *fake_i915_mmap_gtt(int fd, uint32_t handle, int size, int prot)
+{
+	struct fake_file *file = fake_file(fd);
+	struct fake_bo *bo;
+
+	if (!file || !(bo = lookup(file, handle)) || size > bo->size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (bo->tiling == I915_TILING_NONE && !bo->gtt)
+		return arena_map(bo->data_off, size, prot);
+
+	if (!bo->gtt) {
+		bo->gtt_off = arena_alloc(bo->size);
+		if (bo->gtt_off)
+			bo->gtt = arena_map(bo->gtt_off, bo->size,
+					    PROT_READ | PROT_WRITE);
+		bo->gtt_clean = malloc(bo->size);
+		if (!bo->gtt || !bo->gtt_clean) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		bo_refresh_gtt(bo);
+	}
+
+	return arena_map(bo->gtt_off, size, prot);
+}
+
+/* The blitter and command streamer */
+
+struct exec_state {
+	struct fake_bo **bos;
+	int count;
+	int gen;
+};
+
+static uint8_t *resolve(struct exec_state *exec, uint32_t addr, uint64_t len,
+			struct fake_bo **bo_out)
+{
+	int i;
+
+	for (i = 0; i < exec->count; i++) {
+		struct fake_bo *bo = exec->bos[i];
+
+		if (addr >= bo->offset && addr - bo->offset + len <= bo->size) {
+			if (bo_out)
+				*bo_out = bo;
+			return bo->data + (addr - bo->offset);
+		}
+	}
+
+	return NULL;
+}
+
+struct surface {
+	struct fake_bo *bo;
+	uint64_t base;		/* offset of the surface in bo */
+	int32_t pitch;
+	bool tiled;
+	int cpp;
+};
+
+static int surface_init(struct exec_state *exec, struct surface *s,
+			uint32_t addr, uint32_t pitch, bool tiled, int cpp)
+{
+	s->pitch = (int16_t)(pitch & 0xffff);
+	s->tiled = tiled;
+	s->cpp = cpp;
+	if (tiled)
+		s->pitch *= 4;	/* in dwords for tiled surfaces */
+
+	if (!resolve(exec, addr, 1, &s->bo))
+		return -1;
+	s->base = addr - s->bo->offset;
+
+	return 0;
+}
+
+static uint8_t *surface_pixel(struct surface *s, int x, int y)
+{
+	int64_t linear = (int64_t)y * s->pitch + (int64_t)x * s->cpp;
+	uint64_t off;
+
+	if (s->tiled) {
+		if (linear < 0 || s->pitch <= 0)
+			return NULL;
+		off = s->base + tile_offset(I915_TILING_X, s->pitch, linear);
+	} else {
+		if ((int64_t)s->base + linear < 0)
+			return NULL;
+		off = s->base + linear;
+	}
+
+	if (off + s->cpp > s->bo->size)
+		return NULL;
+
+	return s->bo->data + off;
+}
+
+static const int blt_cpp[] = { 1, 2, 2, 4 };
+
+static int xy_src_copy_blt(struct exec_state *exec, const uint32_t *cs)
+{
+	struct surface dst, src;
+	int cpp = blt_cpp[(cs[1] >> 24) & 3];
+	int dx1 = cs[2] & 0xffff, dy1 = cs[2] >> 16;
+	int dx2 = cs[3] & 0xffff, dy2 = cs[3] >> 16;
+	int sx1 = cs[5] & 0xffff, sy1 = cs[5] >> 16;
+	int x, y;
+
+	if (((cs[1] >> 16) & 0xff) != 0xcc)
+		return -EINVAL;
+
+	if (surface_init(exec, &dst, cs[4], cs[1], cs[0] & (1 << 11), cpp) ||
+	    surface_init(exec, &src, cs[7], cs[6], cs[0] & (1 << 15), cpp))
+		return -EFAULT;
+
+	for (y = 0; y < dy2 - dy1; y++) {
+		if (!dst.tiled && !src.tiled) {
+			uint8_t *d = surface_pixel(&dst, dx1, dy1 + y);
+			uint8_t *s = surface_pixel(&src, sx1, sy1 + y);
+			uint64_t len = (uint64_t)(dx2 - dx1) * cpp;
+
+			if (dx2 <= dx1)
+				break;
+			if (!d || !s ||
+			    d - dst.bo->data + len > dst.bo->size ||
+			    s - src.bo->data + len > src.bo->size)
+				return -EFAULT;
+			memmove(d, s, len);
+			continue;
+		}
+
+		for (x = 0; x < dx2 - dx1; x++) {
+			uint8_t *d = surface_pixel(&dst, dx1 + x, dy1 + y);
+			uint8_t *s = surface_pixel(&src, sx1 + x, sy1 + y);
+
+			if (!d || !s)
+				return -EFAULT;
+			memcpy(d, s, cpp);
+		}
+	}
+
+	return 0;
+}
+
+static int xy_color_blt(struct exec_state *exec, const uint32_t *cs)
+{
+	struct surface dst;
+	int cpp = blt_cpp[(cs[1] >> 24) & 3];
+	int x1 = cs[2] & 0xffff, y1 = cs[2] >> 16;
+	int x2 = cs[3] & 0xffff, y2 = cs[3] >> 16;
+	int x, y;
+
+	if (((cs[1] >> 16) & 0xff) != 0xf0)
+		return -EINVAL;
+
+	if (surface_init(exec, &dst, cs[4], cs[1], cs[0] & (1 << 11), cpp))
+		return -EFAULT;
+
+	for (y = y1; y < y2; y++) {
+		for (x = x1; x < x2; x++) {
+			uint8_t *d = surface_pixel(&dst, x, y);
+
+			if (!d)
+				return -EFAULT;
+			memcpy(d, &cs[5], cpp);
+		}
+	}
+
+	return 0;
+}
+
+static int store_dword_imm(struct exec_state *exec, const uint32_t *cs,
+			   int len)
+{
+	/* gen4+ has an extra (ignored) dword before the address */
+	int addr_dw = exec->gen >= 4 ? 2 : 1;
+	int count = len - addr_dw - 1;
+	uint8_t *ptr;
+
+	if (count <= 0)
+		return -EINVAL;
+
+	ptr = resolve(exec, cs[addr_dw] & ~3, count * 4, NULL);
+	if (!ptr)
+		return -EFAULT;
+
+	memcpy(ptr, &cs[addr_dw + 1], count * 4);
+	return 0;
+}
+
+static void unsupported(uint32_t cmd)
+{
+	static uint32_t warned[8];
+
+	/* warn once per client and opcode */
+	if (warned[cmd >> 29] & (1 << ((cmd >> 22) & 31)))
+		return;
+	warned[cmd >> 29] |= 1 << ((cmd >> 22) & 31);
+
+	fprintf(stderr, "fake i915: unsupported command 0x%08x, "
+		"stopping batch\n", cmd);
+}
+
+static int run_batch(struct exec_state *exec, struct fake_bo *batch,
+		     uint32_t start, uint32_t len)
+{
+	const uint32_t *cs;
+	uint32_t i = 0, n;
+	int ret = 0;
+
+	if (start >= batch->size)
+		return -EINVAL;
+	if (!len || start + len > batch->size)
+		len = batch->size - start;
+
+	cs = (const uint32_t *)(batch->data + start);
+	n = len / 4;
+
+	while (i < n && ret == 0) {
+		uint32_t cmd = cs[i], op, dwords;
+
+		switch (cmd >> 29) {
+		case 0: /* MI */
+			op = (cmd >> 23) & 0x3f;
+			dwords = op < 0x10 ? 1 : (cmd & 0x3f) + 2;
+			if (i + dwords > n)
+				return -EINVAL;
+
+			if (op == 0x0a)		/* MI_BATCH_BUFFER_END */
+				return 0;
+			else if (op == 0x20)	/* MI_STORE_DWORD_IMM */
+				ret = store_dword_imm(exec, &cs[i], dwords);
+			else if (op == 0x31)	/* MI_BATCH_BUFFER_START */
+				ret = -ENOTSUP;
+			/* everything else (flushes, noops, ...) is a noop */
+			break;
+		case 2: /* 2D */
+			op = (cmd >> 22) & 0x7f;
+			dwords = (cmd & 0xff) + 2;
+			if (i + dwords > n)
+				return -EINVAL;
+
+			if (op == 0x53 && dwords >= 8)
+				ret = xy_src_copy_blt(exec, &cs[i]);
+			else if (op == 0x50 && dwords >= 6)
+				ret = xy_color_blt(exec, &cs[i]);
+			else
+				ret = -ENOTSUP;
+			break;
+		default:
+			ret = -ENOTSUP;
+			dwords = 1;
+			break;
+		}
+
+		if (ret == -ENOTSUP) {
+			unsupported(cmd);
+			return 0;
+		}
+
+		i += dwords;
+	}
+
+	return ret;
+}
+
+static int fake_execbuffer2(struct fake_file *file,
+			    struct drm_i915_gem_execbuffer2 *eb)
+{
+	struct drm_i915_gem_exec_object2 *objs =
+		(void *)(uintptr_t)eb->buffers_ptr;
+	struct exec_state exec;
+	uint64_t offset = FAKE_GTT_START;
+	uint32_t i, j;
+	int ret;
+
+	if (eb->buffer_count == 0)
+		return fail(EINVAL);
+
+	exec.count = eb->buffer_count;
+	exec.gen = intel_gen(fake_devid);
+	exec.bos = calloc(exec.count, sizeof(*exec.bos));
+	if (!exec.bos)
+		return fail(ENOMEM);
+
+	/* Lay the objects out back to back in the fake GTT */
+	for (i = 0; i < eb->buffer_count; i++) {
+		uint64_t align = objs[i].alignment > 4096 ?
+			objs[i].alignment : 4096;
+
+		exec.bos[i] = lookup(file, objs[i].handle);
+		if (!exec.bos[i]) {
+			free(exec.bos);
+			return fail(ENOENT);
+		}
+
+		offset = (offset + align - 1) & ~(align - 1);
+		exec.bos[i]->offset = offset;
+		objs[i].offset = offset;
+		offset += exec.bos[i]->size;
+
+		bo_flush_gtt(exec.bos[i]);
+	}
+
+	if (offset > FAKE_APERTURE_SIZE) {
+		free(exec.bos);
+		return fail(ENOSPC);
+	}
+
+	for (i = 0; i < eb->buffer_count; i++) {
+		struct drm_i915_gem_relocation_entry *relocs =
+			(void *)(uintptr_t)objs[i].relocs_ptr;
+
+		for (j = 0; j < objs[i].relocation_count; j++) {
+			struct fake_bo *target =
+				lookup(file, relocs[j].target_handle);
+			uint32_t value;
+
+			if (!target || relocs[j].offset + 4 > exec.bos[i]->size) {
+				free(exec.bos);
+				return fail(target ? EINVAL : ENOENT);
+			}
+
+			value = target->offset + relocs[j].delta;
+			memcpy(exec.bos[i]->data + relocs[j].offset,
+			       &value, sizeof(value));
+			relocs[j].presumed_offset = target->offset;
+		}
+	}
+
+	ret = run_batch(&exec, exec.bos[exec.count - 1],
+			eb->batch_start_offset, eb->batch_len);
+
+	for (i = 0; i < eb->buffer_count; i++)
+		bo_refresh_gtt(exec.bos[i]);
+	free(exec.bos);
+
+	return ret ? fail(-ret) : 0;
+}
+
+/* ioctls */
+
+static int fake_getparam(struct drm_i915_getparam *gp)
+{
+	int gen = intel_gen(fake_devid);
+	int val;
+
+	switch (gp->param) {
+	case I915_PARAM_CHIPSET_ID:
+		val = fake_devid;
+		break;
+	case 5: /* HAS_GEM */
+	case 9: /* HAS_EXECBUF2 */
+	case 12: /* HAS_RELAXED_FENCING */
+		val = 1;
+		break;
+	case I915_PARAM_NUM_FENCES_AVAIL:
+		val = gen >= 4 ? 16 : 8;
+		break;
+	case 10: /* HAS_BSD */
+		val = gen >= 5;
+		break;
+	case I915_PARAM_HAS_BLT:
+	case I915_PARAM_HAS_LLC:
+		val = gen >= 6;
+		break;
+	case I915_PARAM_HAS_ALIASING_PPGTT:
+		val = 0;
+		break;
+	default:
+		return fail(EINVAL);
+	}
+
+	*gp->value = val;
+	return 0;
+}
+
+static int fake_set_tiling(struct fake_bo *bo,
+			   struct drm_i915_gem_set_tiling *st)
+{
+	uint32_t width = st->tiling_mode == I915_TILING_Y ? 128 : 512;
+
+	if (st->tiling_mode > I915_TILING_Y)
+		return fail(EINVAL);
+	if (st->tiling_mode != I915_TILING_NONE &&
+	    (st->stride == 0 || st->stride % width ||
+	     st->stride > 128 * 1024))
+		return fail(EINVAL);
+
+	/* as on hardware, the bytes stay put and only the view changes */
+	bo_flush_gtt(bo);
+	bo->tiling = st->tiling_mode;
+	bo->stride = bo->tiling ? st->stride : 0;
+	bo_refresh_gtt(bo);
+
+	st->swizzle_mode = bo->tiling == I915_TILING_X ? swizzle_x :
+		bo->tiling == I915_TILING_Y ? swizzle_y :
+		I915_BIT_6_SWIZZLE_NONE;
+	return 0;
+}
+
+static int fake_prime_to_fd(struct fake_bo *bo, struct drm_prime_handle *args)
+{
+	int i, fd;
+
+	fd = anon_file(args->flags & DRM_CLOEXEC ? O_CLOEXEC : 0);
+	if (fd == -1)
+		return -1;
+
+	/*
+	 * Nothing tells us when the test closes a dma-buf fd, so drop the
+	 * entries whose fd is gone or now refers to something else, in
+	 * particular the one we were just handed again.
+	 */
+	for (i = 0; i < FAKE_MAX_PRIME_FDS; i++) {
+		if (!prime_fds[i].bo)
+			continue;
+
+		if (prime_fds[i].fd == fd ||
+		    !same_file(prime_fds[i].fd, prime_fds[i].dev,
+			       prime_fds[i].ino)) {
+			bo_unref(prime_fds[i].bo);
+			prime_fds[i].bo = NULL;
+		}
+	}
+
+	for (i = 0; i < FAKE_MAX_PRIME_FDS; i++)
+		if (!prime_fds[i].bo)
+			break;
+	if (i == FAKE_MAX_PRIME_FDS) {
+		close(fd);
+		return fail(EMFILE);
+	}
+
+	bo->refcount++;
+	prime_fds[i].fd = fd;
+	file_ident(fd, &prime_fds[i].dev, &prime_fds[i].ino);
+	prime_fds[i].bo = bo;
+	args->fd = fd;
+
+	return 0;
+}
+
+static int fake_prime_to_handle(struct fake_file *file,
+				struct drm_prime_handle *args)
+{
+	uint32_t h;
+	int i;
+
+	for (i = 0; i < FAKE_MAX_PRIME_FDS; i++)
+		if (prime_fds[i].bo && prime_fds[i].fd == args->fd &&
+		    same_file(args->fd, prime_fds[i].dev, prime_fds[i].ino))
+			break;
+	if (i == FAKE_MAX_PRIME_FDS)
+		return fail(EINVAL);
+
+	/* importing into the same file again yields the same handle */
+	for (h = 0; h < file->num_handles; h++) {
+		if (file->handles[h] == prime_fds[i].bo) {
+			args->handle = h + 1;
+			return 0;
+		}
+	}
+
+	prime_fds[i].bo->refcount++;
+	args->handle = add_handle(file, prime_fds[i].bo);
+	return 0;
+}
+
+int fake_i915_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct fake_file *file = fake_file(fd);
+	struct fake_bo *bo;
+
+	if (!file)
+		return fail(EBADF);
+
+	switch (DRM_IOCTL_NR(request)) {
+	case DRM_IOCTL_NR(DRM_IOCTL_GEM_CLOSE): {
+		struct drm_gem_close *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(EINVAL);
+		file->handles[args->handle - 1] = NULL;
+		bo_unref(bo);
+		return 0;
+	}
+	case DRM_IOCTL_NR(DRM_IOCTL_GEM_FLINK): {
+		struct drm_gem_flink *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		if (!bo->name)
+			bo->name = next_name++;
+		args->name = bo->name;
+		return 0;
+	}
+	case DRM_IOCTL_NR(DRM_IOCTL_GEM_OPEN): {
+		struct drm_gem_open *args = arg;
+
+		for (bo = all_bos; bo; bo = bo->next)
+			if (args->name && bo->name == args->name)
+				break;
+		if (!bo)
+			return fail(ENOENT);
+		bo->refcount++;
+		args->handle = add_handle(file, bo);
+		args->size = bo->size;
+		return 0;
+	}
+	case DRM_IOCTL_NR(DRM_IOCTL_PRIME_HANDLE_TO_FD): {
+		struct drm_prime_handle *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		return fake_prime_to_fd(bo, args);
+	}
+	case DRM_IOCTL_NR(DRM_IOCTL_PRIME_FD_TO_HANDLE):
+		return fake_prime_to_handle(file, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GETPARAM:
+		return fake_getparam(arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_EXECBUFFER2:
+		return fake_execbuffer2(file, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_CREATE: {
+		struct drm_i915_gem_create *args = arg;
+
+		if (args->size == 0)
+			return fail(EINVAL);
+		if (!(bo = bo_create(args->size)))
+			return fail(ENOMEM);
+		args->handle = add_handle(file, bo);
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_PREAD: {
+		struct drm_i915_gem_pread *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		if (args->offset > bo->size ||
+		    args->size > bo->size - args->offset)
+			return fail(EINVAL);
+		bo_flush_gtt(bo);
+		memcpy((void *)(uintptr_t)args->data_ptr,
+		       bo->data + args->offset, args->size);
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_PWRITE: {
+		struct drm_i915_gem_pwrite *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		if (args->offset > bo->size ||
+		    args->size > bo->size - args->offset)
+			return fail(EINVAL);
+		bo_flush_gtt(bo);
+		memcpy(bo->data + args->offset,
+		       (void *)(uintptr_t)args->data_ptr, args->size);
+		bo_refresh_gtt(bo);
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_MMAP: {
+		struct drm_i915_gem_mmap *args = arg;
+		void *ptr;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		if (args->offset > bo->size ||
+		    args->size > bo->size - args->offset)
+			return fail(EINVAL);
+		bo_flush_gtt(bo);
+		ptr = arena_map(bo->data_off + args->offset, args->size,
+				PROT_READ | PROT_WRITE);
+		if (!ptr)
+			return -1;
+		args->addr_ptr = (uintptr_t)ptr;
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_MMAP_GTT: {
+		struct drm_i915_gem_mmap_gtt *args = arg;
+
+		if (!lookup(file, args->handle))
+			return fail(ENOENT);
+		/* only usable through gem_mmap__gtt() */
+		args->offset = (uint64_t)args->handle << 32;
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_SET_DOMAIN: {
+		struct drm_i915_gem_set_domain *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		bo_flush_gtt(bo);
+		bo_refresh_gtt(bo);
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_SW_FINISH: {
+		struct drm_i915_gem_sw_finish *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		bo_flush_gtt(bo);
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_SET_TILING: {
+		struct drm_i915_gem_set_tiling *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		return fake_set_tiling(bo, args);
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_GET_TILING: {
+		struct drm_i915_gem_get_tiling *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		args->tiling_mode = bo->tiling;
+		args->swizzle_mode = bo->tiling == I915_TILING_X ? swizzle_x :
+			bo->tiling == I915_TILING_Y ? swizzle_y :
+			I915_BIT_6_SWIZZLE_NONE;
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_GET_APERTURE: {
+		struct drm_i915_gem_get_aperture *args = arg;
+
+		args->aper_size = FAKE_APERTURE_SIZE;
+		args->aper_available_size = FAKE_APERTURE_SIZE;
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_MADVISE: {
+		struct drm_i915_gem_madvise *args = arg;
+
+		if (!lookup(file, args->handle))
+			return fail(ENOENT);
+		/* nothing is ever purged */
+		args->retained = 1;
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_BUSY: {
+		struct drm_i915_gem_busy *args = arg;
+
+		if (!lookup(file, args->handle))
+			return fail(ENOENT);
+		/* execution is synchronous */
+		args->busy = 0;
+		return 0;
+	}
+	case DRM_COMMAND_BASE + DRM_I915_GEM_THROTTLE:
+	case DRM_COMMAND_BASE + LOCAL_I915_GEM_WAIT:
+		return 0;
+	case DRM_COMMAND_BASE + LOCAL_I915_GEM_SET_CACHEING: {
+		struct local_i915_gem_cacheing *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		bo->cacheing = args->cacheing;
+		return 0;
+	}
+	case DRM_COMMAND_BASE + LOCAL_I915_GEM_GET_CACHEING: {
+		struct local_i915_gem_cacheing *args = arg;
+
+		if (!(bo = lookup(file, args->handle)))
+			return fail(ENOENT);
+		args->cacheing = bo->cacheing;
+		return 0;
+	}
+	case DRM_COMMAND_BASE + LOCAL_I915_GEM_CONTEXT_CREATE: {
+		struct local_i915_gem_context *args = arg;
+
+		args->ctx_id = file->next_context++;
+		return 0;
+	}
+	case DRM_COMMAND_BASE + LOCAL_I915_GEM_CONTEXT_DESTROY: {
+		struct local_i915_gem_context *args = arg;
+
+		if (args->ctx_id == 0 || args->ctx_id >= file->next_context)
+			return fail(ENOENT);
+		return 0;
+	}
+	default:
+		return fail(EINVAL);
+	}
+}
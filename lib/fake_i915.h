@@ -0,0 +1,44 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef FAKE_I915_H
+#define FAKE_I915_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A software stand-in for the i915 GEM ioctls, enabled by setting
+ * DRMTEST_FAKE_I915 (optionally to the pci id to report, e.g. 0x0162).
+ * drm_open_any() then returns a fake device node and drmtest_ioctl()
+ * routes its ioctls here instead of to the kernel.
+ */
+bool fake_i915_enabled(void);
+int fake_i915_open(void);
+bool fake_i915_is_fake(int fd);
+int fake_i915_ioctl(int fd, unsigned long request, void *arg);
+void *fake_i915_mmap_gtt(int fd, uint32_t handle, int size, int prot);
+uint64_t fake_i915_mappable_aperture_size(void);
+
+#endif /* FAKE_I915_H */
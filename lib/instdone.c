@@ -26,6 +26,8 @@
  */
 
 #include <assert.h>
+#include <string.h>
+#include <strings.h>
 #include "instdone.h"
 
 #include "intel_chipset.h"
@@ -33,13 +35,43 @@
 
 struct instdone_bit instdone_bits[MAX_INSTDONE_BITS];
 int num_instdone_bits = 0;
+struct instdone_reg instdone_regs[MAX_INSTDONE_REGS];
+int num_instdone_regs = 0;
+
+int
+instdone_reg_index(uint32_t reg)
+{
+	int i;
+
+	for (i = 0; i < num_instdone_regs; i++)
+		if (instdone_regs[i].reg == reg)
+			return i;
+
+	return -1;
+}
 
 static void
 add_instdone_bit(uint32_t reg, uint32_t bit, const char *name)
 {
-	instdone_bits[num_instdone_bits].reg = reg;
-	instdone_bits[num_instdone_bits].bit = bit;
-	instdone_bits[num_instdone_bits].name = name;
+	struct instdone_bit *b = &instdone_bits[num_instdone_bits];
+	int index = instdone_reg_index(reg);
+
+	assert(num_instdone_bits < MAX_INSTDONE_BITS);
+	assert(bit && !(bit & (bit - 1)));
+
+	if (index < 0) {
+		assert(num_instdone_regs < MAX_INSTDONE_REGS);
+		index = num_instdone_regs++;
+		instdone_regs[index].reg = reg;
+		instdone_regs[index].mask = 0;
+	}
+	instdone_regs[index].mask |= bit;
+
+	b->reg = reg;
+	b->bit = bit;
+	b->name = name;
+	b->reg_index = index;
+	b->shift = ffs(bit) - 1;
 	num_instdone_bits++;
 }
 
@@ -157,9 +189,38 @@ init_gen7_instdone(void)
 	gen6_instdone1_bit(1 << 1, "VF");
 }
 
+void
+instdone_counters_reset(struct instdone_counters *counters)
+{
+	memset(counters, 0, sizeof(*counters));
+}
+
+void
+instdone_counters_flush(struct instdone_counters *counters)
+{
+	int r, i, b;
+
+	for (r = 0; r < num_instdone_regs; r++) {
+		for (i = 0; i < INSTDONE_COUNTER_SLICES; i++) {
+			uint32_t slice = counters->slice[r][i];
+
+			while (slice) {
+				b = ffs(slice) - 1;
+				counters->count[r][b] += 1 << i;
+				slice &= slice - 1;
+			}
+			counters->slice[r][i] = 0;
+		}
+	}
+	counters->pending = 0;
+}
+
 void
 init_instdone_definitions(uint32_t devid)
 {
+	num_instdone_bits = 0;
+	num_instdone_regs = 0;
+
 	if (IS_GEN7(devid)) {
 		init_gen7_instdone();
 	} else if (IS_GEN6(devid)) {
@@ -28,14 +28,80 @@
 #include <stdint.h>
 
 #define MAX_INSTDONE_BITS            100
+#define MAX_INSTDONE_REGS            2
 
 struct instdone_bit {
 	uint32_t reg;
 	uint32_t bit;
 	const char *name;
+	int reg_index;		/* into instdone_regs[] */
+	int shift;		/* bit == 1 << shift */
+};
+
+/* A register holding some of the bits above, and the mask of those bits. */
+struct instdone_reg {
+	uint32_t reg;
+	uint32_t mask;
 };
 
 extern struct instdone_bit instdone_bits[MAX_INSTDONE_BITS];
 extern int num_instdone_bits;
+extern struct instdone_reg instdone_regs[MAX_INSTDONE_REGS];
+extern int num_instdone_regs;
 
 void init_instdone_definitions(uint32_t devid);
+int instdone_reg_index(uint32_t reg);
+
+/*
+ * Busy counters for all the bits at once.  Each register keeps a bit-sliced
+ * binary counter: slice[i] holds bit i of the 32 per-bit counts, so adding
+ * a sample is a ripple-carry add of the busy mask that usually stops after
+ * a slice or two, whatever the number of busy units.  The slices are folded
+ * into count[][] by instdone_counters_flush(), automatically before they
+ * can overflow.
+ */
+#define INSTDONE_COUNTER_SLICES      16
+
+struct instdone_counters {
+	uint32_t slice[MAX_INSTDONE_REGS][INSTDONE_COUNTER_SLICES];
+	unsigned int pending;
+	unsigned int count[MAX_INSTDONE_REGS][32];
+};
+
+void instdone_counters_reset(struct instdone_counters *counters);
+void instdone_counters_flush(struct instdone_counters *counters);
+
+/* values[] holds one sample of each register in instdone_regs[] */
+static inline void
+instdone_counters_sample(struct instdone_counters *counters,
+			 const uint32_t *values)
+{
+	int r, i;
+
+	for (r = 0; r < num_instdone_regs; r++) {
+		uint32_t carry = ~values[r] & instdone_regs[r].mask;
+
+		for (i = 0; carry && i < INSTDONE_COUNTER_SLICES; i++) {
+			uint32_t next = counters->slice[r][i] & carry;
+
+			counters->slice[r][i] ^= carry;
+			carry = next;
+		}
+	}
+
+	if (++counters->pending == (1 << INSTDONE_COUNTER_SLICES) - 1)
+		instdone_counters_flush(counters);
+}
+
+static inline unsigned int
+instdone_count(const struct instdone_counters *counters,
+	       const struct instdone_bit *bit)
+{
+	return counters->count[bit->reg_index][bit->shift];
+}
+
+static inline int
+instdone_busy(const struct instdone_bit *bit, const uint32_t *values)
+{
+	return !(values[bit->reg_index] & bit->bit);
+}
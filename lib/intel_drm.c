@@ -47,6 +47,7 @@
 
 #include "intel_gpu_tools.h"
 #include "i915_drm.h"
+#include "fake_i915.h"
 
 uint32_t
 intel_get_drm_devid(int fd)
@@ -58,7 +59,10 @@ intel_get_drm_devid(int fd)
 	gp.param = I915_PARAM_CHIPSET_ID;
 	gp.value = (int *)&devid;
 
-	ret = ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp));
+	if (fake_i915_is_fake(fd))
+		ret = fake_i915_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	else
+		ret = ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp));
 	assert(ret == 0);
 
 	return devid;
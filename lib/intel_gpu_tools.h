@@ -42,9 +42,14 @@ void intel_get_mmio(struct pci_device *pci_dev);
 
 /* New style register access API */
 int intel_register_access_init(struct pci_device *pci_dev, int safe);
+int intel_register_access_init_file(char *file, uint32_t devid, int safe);
 void intel_register_access_fini(void);
+void intel_register_forcewake_put(void);
+int intel_register_forcewake_get(void);
+int intel_register_forcewake_held(void);
 uint32_t intel_register_read(uint32_t reg);
 void intel_register_write(uint32_t reg, uint32_t val);
+int intel_register_write_checked(uint32_t reg, uint32_t val);
 /* Following functions are relevant only for SoCs like Valleyview */
 uint32_t intel_dpio_reg_read(uint32_t reg);
 void intel_dpio_reg_write(uint32_t reg, uint32_t val);
@@ -91,6 +96,32 @@ uint64_t intel_get_total_swap_mb(void);
 
 void intel_map_file(char *);
 
+/*
+ * Sparse register dump as written by intel_reg_snapshot: this header, then
+ * num_ranges struct intel_dump_range, then the contents of each range in
+ * order. Registers outside of the ranges read back as 0.
+ */
+#define INTEL_DUMP_MAGIC "IRDUMP\0\0"
+#define INTEL_DUMP_VERSION 1
+
+struct intel_dump_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t devid;
+	uint32_t image_size;
+	uint32_t num_ranges;
+};
+
+struct intel_dump_range {
+	uint32_t base;
+	uint32_t size;
+};
+
+void *intel_load_dump(const char *file, size_t *size, uint32_t *devid);
+void *intel_load_dump_ranges(const char *file, size_t *size, uint32_t *devid,
+			     struct intel_dump_range **ranges,
+			     uint32_t *num_ranges);
+
 enum pch_type {
 	PCH_IBX,
 	PCH_CPT,
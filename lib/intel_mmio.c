@@ -53,28 +53,128 @@ static struct _mmio_data {
 	uint32_t i915_devid;
 	struct intel_register_map map;
 	int key;
+	size_t file_size;
 } mmio_data;
 
-void
-intel_map_file(char *file)
+static size_t mmio_file_size;
+
+/*
+ * Maps a register dump, either a plain image of the MMIO BAR or a sparse
+ * dump (see struct intel_dump_header) which is expanded into a flat image.
+ * The mapping is private and writable and can be released with munmap().
+ *
+ * @file: dump to load
+ * @size: if not NULL, returns the size of the image
+ * @devid: if not NULL, returns the device id recorded in the dump, or 0
+ */
+void *
+intel_load_dump(const char *file, size_t *size, uint32_t *devid)
 {
-	int fd;
+	return intel_load_dump_ranges(file, size, devid, NULL, NULL);
+}
+
+/*
+ * Like intel_load_dump(), and also returns a malloc()ed copy of the
+ * ranges that were captured, so callers can tell registers read back as 0
+ * from registers that are missing from a sparse dump. A raw dump is a
+ * single range covering the whole file.
+ */
+void *
+intel_load_dump_ranges(const char *file, size_t *size, uint32_t *devid,
+		       struct intel_dump_range **ranges, uint32_t *num_ranges)
+{
+	const struct intel_dump_header *header;
+	const struct intel_dump_range *range;
+	size_t image_size, pos;
 	struct stat st;
+	char *data, *image;
+	uint32_t i;
+	int fd;
 
-	fd = open(file, O_RDWR);
+	fd = open(file, O_RDONLY);
 	if (fd == -1) {
 		    fprintf(stderr, "Couldn't open %s: %s\n", file,
 			    strerror(errno));
 		    exit(1);
 	}
 	fstat(fd, &st);
-	mmio = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
-	if (mmio == MAP_FAILED) {
+	data = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
 		    fprintf(stderr, "Couldn't mmap %s: %s\n", file,
 			    strerror(errno));
 		    exit(1);
 	}
 	close(fd);
+
+	header = (const struct intel_dump_header *)data;
+	if (st.st_size < sizeof(*header) ||
+	    memcmp(header->magic, INTEL_DUMP_MAGIC, sizeof(header->magic))) {
+		if (size)
+			*size = st.st_size;
+		if (devid)
+			*devid = 0;
+		if (ranges) {
+			*ranges = malloc(sizeof(**ranges));
+			assert(*ranges);
+			(*ranges)->base = 0;
+			(*ranges)->size = st.st_size;
+			*num_ranges = 1;
+		}
+		return data;
+	}
+
+	if (header->version != INTEL_DUMP_VERSION) {
+		fprintf(stderr, "Unsupported dump version %d in %s\n",
+			header->version, file);
+		exit(1);
+	}
+
+	if (header->num_ranges >
+	    (st.st_size - sizeof(*header)) / sizeof(struct intel_dump_range)) {
+		fprintf(stderr, "Corrupt register dump %s\n", file);
+		exit(1);
+	}
+
+	image_size = header->image_size;
+	image = mmap(NULL, image_size, PROT_READ|PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (image == MAP_FAILED) {
+		fprintf(stderr, "Couldn't allocate register image: %s\n",
+			strerror(errno));
+		exit(1);
+	}
+
+	range = (const struct intel_dump_range *)(header + 1);
+	pos = sizeof(*header) + header->num_ranges * sizeof(*range);
+	for (i = 0; i < header->num_ranges; i++) {
+		if (pos + range[i].size > st.st_size ||
+		    (uint64_t)range[i].base + range[i].size > image_size) {
+			fprintf(stderr, "Corrupt register dump %s\n", file);
+			exit(1);
+		}
+		memcpy(image + range[i].base, data + pos, range[i].size);
+		pos += range[i].size;
+	}
+
+	if (size)
+		*size = image_size;
+	if (devid)
+		*devid = header->devid;
+	if (ranges) {
+		*ranges = malloc(header->num_ranges * sizeof(*range));
+		assert(*ranges || !header->num_ranges);
+		memcpy(*ranges, range, header->num_ranges * sizeof(*range));
+		*num_ranges = header->num_ranges;
+	}
+
+	munmap(data, st.st_size);
+	return image;
+}
+
+void
+intel_map_file(char *file)
+{
+	mmio = intel_load_dump(file, &mmio_file_size, NULL);
 }
 
 void
@@ -153,33 +253,22 @@ release_forcewake_lock(int fd)
 	close(fd);
 }
 
-/*
- * Initialize register access library.
- *
- * @pci_dev: pci device we're mucking with
- * @safe: use safe register access tables
- */
-int
-intel_register_access_init(struct pci_device *pci_dev, int safe)
+static int
+register_access_init(uint32_t devid, int safe, bool forcewake)
 {
 	int ret;
 
-	/* after old API is deprecated, remove this */
-	if (mmio == NULL)
-		intel_get_mmio(pci_dev);
-
 	assert(mmio != NULL);
 
 	if (mmio_data.inited)
 		return -1;
 
 	mmio_data.safe = safe != 0 ? true : false;
-	mmio_data.i915_devid = pci_dev->device_id;
+	mmio_data.i915_devid = devid;
 	if (mmio_data.safe)
 		mmio_data.map = intel_get_register_map(mmio_data.i915_devid);
 
-	if (!(IS_GEN6(pci_dev->device_id) ||
-	      IS_GEN7(pci_dev->device_id)))
+	if (!forcewake || !(IS_GEN6(devid) || IS_GEN7(devid)))
 		goto done;
 
 	/* Find where the forcewake lock is */
@@ -198,14 +287,93 @@ done:
 	return 0;
 }
 
+/*
+ * Initialize register access library.
+ *
+ * @pci_dev: pci device we're mucking with
+ * @safe: use safe register access tables
+ */
+int
+intel_register_access_init(struct pci_device *pci_dev, int safe)
+{
+	/* after old API is deprecated, remove this */
+	if (mmio == NULL)
+		intel_get_mmio(pci_dev);
+
+	return register_access_init(pci_dev->device_id, safe, true);
+}
+
+/*
+ * Initialize register access library on top of a register dump, as
+ * produced by intel_reg_snapshot, instead of the hardware. Writes only
+ * modify a private copy of the file.
+ *
+ * @file: register dump to map
+ * @devid: pci id of the device the dump was taken from
+ * @safe: use safe register access tables
+ */
+int
+intel_register_access_init_file(char *file, uint32_t devid, int safe)
+{
+	intel_map_file(file);
+	mmio_data.file_size = mmio_file_size;
+
+	return register_access_init(devid, safe, false);
+}
+
 void
 intel_register_access_fini(void)
 {
-	if (mmio_data.key)
+	if (mmio_data.key > 0)
 		release_forcewake_lock(mmio_data.key);
+	mmio_data.key = 0;
 	mmio_data.inited--;
 }
 
+/*
+ * Drop the user forcewake reference taken by intel_register_access_init()
+ * while keeping the register mapping. Registers inside the GT power well
+ * must not be accessed until intel_register_forcewake_get() is called.
+ */
+void
+intel_register_forcewake_put(void)
+{
+	if (mmio_data.key > 0)
+		release_forcewake_lock(mmio_data.key);
+	mmio_data.key = 0;
+}
+
+/*
+ * Re-take the user forcewake reference. This is a no-op on platforms
+ * without forcewake and when running on top of a register dump.
+ *
+ * Returns 0 on success or a negative errno.
+ */
+int
+intel_register_forcewake_get(void)
+{
+	if (!mmio_data.debugfs_forcewake_path[0] || mmio_data.key > 0)
+		return 0;
+
+	mmio_data.key = get_forcewake_lock();
+	if (mmio_data.key < 0) {
+		int ret = -errno;
+		mmio_data.key = 0;
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns non-zero if the user forcewake reference is currently held.
+ */
+int
+intel_register_forcewake_held(void)
+{
+	return mmio_data.key > 0;
+}
+
 uint32_t
 intel_register_read(uint32_t reg)
 {
@@ -217,6 +385,13 @@ intel_register_read(uint32_t reg)
 	if (intel_gen(mmio_data.i915_devid) >= 6)
 		assert(mmio_data.key != -1);
 
+	if (mmio_data.file_size && reg + 4 > mmio_data.file_size) {
+		fprintf(stderr, "Register read beyond end of dump "
+			"(*0x%08x)\n", reg);
+		ret = 0xffffffff;
+		goto out;
+	}
+
 	if (!mmio_data.safe)
 		goto read_out;
 
@@ -237,8 +412,8 @@ out:
 	return ret;
 }
 
-void
-intel_register_write(uint32_t reg, uint32_t val)
+static int
+register_write(uint32_t reg, uint32_t val, bool block)
 {
 	struct intel_register_range *range;
 
@@ -247,6 +422,12 @@ intel_register_write(uint32_t reg, uint32_t val)
 	if (intel_gen(mmio_data.i915_devid) >= 6)
 		assert(mmio_data.key != -1);
 
+	if (mmio_data.file_size && reg + 4 > mmio_data.file_size) {
+		fprintf(stderr, "Register write beyond end of dump "
+			"(*0x%08x = 0x%x)\n", reg, val);
+		return -1;
+	}
+
 	if (!mmio_data.safe)
 		goto write_out;
 
@@ -257,8 +438,30 @@ intel_register_write(uint32_t reg, uint32_t val)
 	if (!range) {
 		fprintf(stderr, "Register write blocked for safety "
 			"(*0x%08x = 0x%x)\n", reg, val);
+		if (block)
+			return -1;
 	}
 
 write_out:
 	*(volatile uint32_t *)((volatile char *)mmio + reg) = val;
+	return 0;
+}
+
+void
+intel_register_write(uint32_t reg, uint32_t val)
+{
+	register_write(reg, val, false);
+}
+
+/*
+ * Like intel_register_write(), but with safe register access a write
+ * outside the writable ranges of the map is refused instead of only
+ * warned about.
+ *
+ * Returns 0 on success or -1 if the write was refused.
+ */
+int
+intel_register_write_checked(uint32_t reg, uint32_t val)
+{
+	return register_write(reg, val, true);
 }
@@ -0,0 +1,234 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "intel_vbt.h"
+
+/* option ROMs are at most 128KiB, so this is normally read in one go */
+#define VBT_READ_CHUNK	(128 * 1024)
+
+/* who releases intel_vbt::image */
+enum {
+	VBT_BORROWED,
+	VBT_MAPPED,
+	VBT_ALLOCATED,
+};
+
+/*
+ * Walk the BDB once and remember where each block lives.  The first block
+ * with a given id wins, as it did for the old linear lookup.
+ */
+static void
+build_block_index(struct intel_vbt *vbt)
+{
+	uint8_t *base = (uint8_t *)vbt->bdb;
+	size_t total = vbt->bdb->bdb_size;
+	size_t idx = vbt->bdb->header_size;
+
+	if (total > vbt->size - (base - vbt->image))
+		total = vbt->size - (base - vbt->image);
+
+	memset(vbt->blocks, 0, sizeof(vbt->blocks));
+	vbt->num_blocks = 0;
+
+	while (idx + 3 <= total) {
+		uint8_t id = base[idx];
+		uint16_t size = base[idx + 1] | base[idx + 2] << 8;
+
+		if (idx + 3 + size > total)
+			break;
+
+		if (!vbt->blocks[id].data) {
+			vbt->blocks[id].id = id;
+			vbt->blocks[id].size = size;
+			vbt->blocks[id].data = base + idx + 3;
+			vbt->num_blocks++;
+		}
+
+		idx += size + 3;
+	}
+}
+
+/**
+ * intel_vbt_parse:
+ * @vbt: VBT to fill in
+ * @image: option ROM or bare VBT image
+ * @size: size of @image in bytes
+ *
+ * Locates the VBT and BDB headers in @image and indexes the BDB blocks.
+ * Nothing is copied out of @image.
+ *
+ * Returns: 0 on success, -ENODATA if there is no VBT signature, -EINVAL if
+ * the BDB header lies outside the image.
+ */
+int
+intel_vbt_parse(struct intel_vbt *vbt, void *image, size_t size)
+{
+	uint8_t *p;
+	size_t vbt_off, bdb_off;
+
+	vbt->image = image;
+	vbt->size = size;
+	vbt->vbt = NULL;
+	vbt->bdb = NULL;
+	vbt->owned = VBT_BORROWED;
+	vbt->num_blocks = 0;
+	memset(vbt->blocks, 0, sizeof(vbt->blocks));
+
+	p = memmem(image, size, "$VBT", 4);
+	if (!p || size - (p - vbt->image) < sizeof(struct vbt_header))
+		return -ENODATA;
+
+	vbt_off = p - vbt->image;
+	vbt->vbt = (struct vbt_header *)p;
+
+	bdb_off = vbt_off + vbt->vbt->bdb_offset;
+	if (bdb_off < vbt_off || bdb_off >= size ||
+	    size - bdb_off < sizeof(struct bdb_header))
+		return -EINVAL;
+
+	vbt->bdb = (struct bdb_header *)(vbt->image + bdb_off);
+	build_block_index(vbt);
+
+	return 0;
+}
+
+static void *
+read_whole_file(int fd, size_t *size)
+{
+	uint8_t *buf = NULL;
+	size_t len = 0, alloc = 0;
+	ssize_t ret;
+
+	do {
+		if (len == alloc) {
+			uint8_t *tmp;
+
+			alloc += VBT_READ_CHUNK;
+			tmp = realloc(buf, alloc);
+			if (!tmp) {
+				free(buf);
+				errno = ENOMEM;
+				return NULL;
+			}
+			buf = tmp;
+		}
+
+		ret = read(fd, buf + len, alloc - len);
+		if (ret > 0)
+			len += ret;
+	} while (ret > 0 || (ret < 0 && errno == EINTR));
+
+	if (ret < 0) {
+		free(buf);
+		return NULL;
+	}
+
+	*size = len;
+	return buf;
+}
+
+/**
+ * intel_vbt_open:
+ * @vbt: VBT to fill in
+ * @filename: ROM image, bare VBT or sysfs "rom" file
+ *
+ * Maps @filename (or reads it, for files such as sysfs attributes that
+ * report a zero size) and parses it with intel_vbt_parse().  The VBT must be
+ * released with intel_vbt_close().
+ *
+ * Returns: 0 on success, a negative errno value otherwise.  If parsing
+ * fails the image is already released.
+ */
+int
+intel_vbt_open(struct intel_vbt *vbt, const char *filename)
+{
+	struct stat st;
+	void *image;
+	size_t size;
+	int fd, ret, owned;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		owned = VBT_MAPPED;
+		size = st.st_size;
+		image = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (image == MAP_FAILED)
+			image = NULL;
+	} else {
+		owned = VBT_ALLOCATED;
+		image = read_whole_file(fd, &size);
+	}
+	if (!image) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+	close(fd);
+
+	ret = intel_vbt_parse(vbt, image, size);
+	vbt->owned = owned;
+	if (ret)
+		intel_vbt_close(vbt);
+
+	return ret;
+}
+
+/**
+ * intel_vbt_close:
+ * @vbt: VBT opened with intel_vbt_open()
+ *
+ * Releases the image backing @vbt.  VBTs set up with intel_vbt_parse() on
+ * caller-owned memory are left alone.
+ */
+void
+intel_vbt_close(struct intel_vbt *vbt)
+{
+	if (vbt->owned == VBT_MAPPED)
+		munmap(vbt->image, vbt->size);
+	else if (vbt->owned == VBT_ALLOCATED)
+		free(vbt->image);
+
+	vbt->owned = VBT_BORROWED;
+	vbt->image = NULL;
+	vbt->vbt = NULL;
+	vbt->bdb = NULL;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef INTEL_VBT_H
+#define INTEL_VBT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "intel_bios.h"
+
+struct bdb_block {
+	uint8_t id;
+	uint16_t size;
+	void *data;
+};
+
+/*
+ * A parsed VBT.  The image is never copied: the headers and every entry in
+ * the block index point straight into it, so the image must outlive the
+ * struct.  blocks[] is indexed by block id; absent blocks have data == NULL.
+ */
+struct intel_vbt {
+	uint8_t *image;
+	size_t size;
+	struct vbt_header *vbt;
+	struct bdb_header *bdb;
+	int num_blocks;
+	struct bdb_block blocks[256];
+	int owned;
+};
+
+int intel_vbt_parse(struct intel_vbt *vbt, void *image, size_t size);
+int intel_vbt_open(struct intel_vbt *vbt, const char *filename);
+void intel_vbt_close(struct intel_vbt *vbt);
+
+static inline const struct bdb_block *
+intel_vbt_find_block(const struct intel_vbt *vbt, int id)
+{
+	if (id < 0 || id > 255 || !vbt->blocks[id].data)
+		return NULL;
+
+	return &vbt->blocks[id];
+}
+
+#endif /* INTEL_VBT_H */
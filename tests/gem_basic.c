@@ -82,14 +82,21 @@ int main(int argc, char **argv)
 
 	drmtest_subtest_init(argc, argv);
 
-	fd = drm_open_any();
-
-	if (drmtest_run_subtest("bad-close"))
+	/* each subtest uses its own fd, so they can all run in parallel */
+	if (drmtest_run_parallel_subtest("bad-close")) {
+		fd = drm_open_any();
 		test_bad_close(fd);
-	if (drmtest_run_subtest("create-close"))
+		close(fd);
+	}
+	if (drmtest_run_parallel_subtest("create-close")) {
+		fd = drm_open_any();
 		test_create_close(fd);
-	if (drmtest_run_subtest("create-fd-close"))
+		close(fd);
+	}
+	if (drmtest_run_parallel_subtest("create-fd-close")) {
+		fd = drm_open_any();
 		test_create_fd_close(fd);
+	}
 
 	return 0;
 }
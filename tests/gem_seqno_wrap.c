@@ -167,16 +167,6 @@ static void render_copyfunc(struct scratch_buf *src,
 	}
 }
 
-static void exchange_uint(void *array, unsigned i, unsigned j)
-{
-	unsigned *i_arr = array;
-	unsigned i_tmp;
-
-	i_tmp = i_arr[i];
-	i_arr[i] = i_arr[j];
-	i_arr[j] = i_tmp;
-}
-
 static int run_sync_test(int num_buffers, bool verify)
 {
 	drm_intel_bufmgr *bufmgr;
@@ -243,8 +233,8 @@ static int run_sync_test(int num_buffers, bool verify)
 		init_buffer(bufmgr, &s_dst[i], dst1[i], width, height);
 	}
 
-	drmtest_permute_array(p_dst1, num_buffers, exchange_uint);
-	drmtest_permute_array(p_dst2, num_buffers, exchange_uint);
+	drmtest_shuffle(p_dst1, num_buffers, sizeof(*p_dst1));
+	drmtest_shuffle(p_dst2, num_buffers, sizeof(*p_dst2));
 
 	for (i = 0; i < num_buffers; i++)
 		render_copyfunc(&s_src[i], &s_dst[p_dst1[i]], width, height);
@@ -642,7 +632,7 @@ int main(int argc, char **argv)
 	card_index = drm_get_card(0);
 	assert(card_index != -1);
 
-	srandom(time(NULL));
+	srandom(drmtest_srandom(time(NULL)));
 
 	while(options.rounds == 0 || wcount < options.rounds) {
 		if (options.background) {
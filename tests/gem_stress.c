@@ -482,23 +482,12 @@ static void init_buffer(struct scratch_buf *buf, unsigned size)
 	buf->num_tiles = options.tiles_per_buf;
 }
 
-static void exchange_buf(void *array, unsigned i, unsigned j)
-{
-	struct scratch_buf *buf_arr, tmp;
-	buf_arr = array;
-
-	memcpy(&tmp, &buf_arr[i], sizeof(struct scratch_buf));
-	memcpy(&buf_arr[i], &buf_arr[j], sizeof(struct scratch_buf));
-	memcpy(&buf_arr[j], &tmp, sizeof(struct scratch_buf));
-}
-
-
 static void init_set(unsigned set)
 {
 	long int r;
 	int i;
 
-	drmtest_permute_array(buffers[set], num_buffers, exchange_buf);
+	drmtest_shuffle(buffers[set], num_buffers, sizeof(struct scratch_buf));
 
 	if (current_set == 1 && options.gpu_busy_load == 0) {
 		gpu_busy_load++;
@@ -547,16 +536,6 @@ static void init_set(unsigned set)
 	}
 }
 
-static void exchange_uint(void *array, unsigned i, unsigned j)
-{
-	unsigned *i_arr = array;
-	unsigned i_tmp;
-
-	i_tmp = i_arr[i];
-	i_arr[i] = i_arr[j];
-	i_arr[j] = i_tmp;
-}
-
 static void copy_tiles(unsigned *permutation)
 {
 	unsigned src_tile, src_buf_idx, src_x, src_y;
@@ -815,7 +794,7 @@ static void init(void)
 	current_set = 0;
 
 	/* just in case it helps reproducability */
-	srandom(0xdeadbeef);
+	srandom(drmtest_srandom(0xdeadbeef));
 }
 
 static void check_render_copyfunc(void)
@@ -902,7 +881,7 @@ int main(int argc, char **argv)
 
 		for (j = 0; j < num_total_tiles; j++)
 			current_permutation[j] = j;
-		drmtest_permute_array(current_permutation, num_total_tiles, exchange_uint);
+		drmtest_shuffle(current_permutation, num_total_tiles, sizeof(unsigned));
 
 		copy_tiles(current_permutation);
 
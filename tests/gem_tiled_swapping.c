@@ -131,8 +131,7 @@ main(int argc, char **argv)
 	for (i = 0; i < count; i++)
 		idx_arr[i] = i;
 
-	drmtest_permute_array(idx_arr, count,
-			      drmtest_exchange_int);
+	drmtest_shuffle(idx_arr, count, sizeof(*idx_arr));
 
 	for (i = 0; i < count/2; i++) {
 		/* Check the target bo's contents. */
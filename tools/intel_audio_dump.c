@@ -33,6 +33,7 @@
 #include <string.h>
 #include <err.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include "intel_gpu_tools.h"
 
 static uint32_t devid;
@@ -57,6 +58,45 @@ static uint32_t devid;
 	    printf("%-21s 0x%08x  %s\n", # reg, dword, desc);	\
     } while (0)
 
+/*
+ * The decoders never touch the hardware directly: each platform's register
+ * set is copied into a shadow image in one pass (from the device or from a
+ * snapshot file) and INREG then reads from that copy.  Only the index/data
+ * port pairs used to walk the ELD, infoframe and channel map buffers need
+ * live hardware; offline they return the value the snapshot holds.
+ */
+#define SHADOW_SIZE		(2 * 1024 * 1024)
+
+static void *src_mmio;
+static size_t src_size;
+static int live;
+
+static void capture_registers(const uint32_t *regs, int count)
+{
+    uint32_t *shadow = mmio;
+    int i;
+
+    for (i = 0; i < count; i++) {
+	    if (regs[i] + 4 > src_size)
+		    continue;
+	    shadow[regs[i] / 4] =
+		    *(volatile uint32_t *)((volatile char *)src_mmio + regs[i]);
+    }
+}
+
+static uint32_t port_read(uint32_t reg)
+{
+    if (live)
+	    return *(volatile uint32_t *)((volatile char *)src_mmio + reg);
+    return INREG(reg);
+}
+
+static void port_write(uint32_t reg, uint32_t val)
+{
+    if (live)
+	    *(volatile uint32_t *)((volatile char *)src_mmio + reg) = val;
+}
+
 
 static const char *pixel_clock[] = {
 	[0] = "25.2 / 1.001 MHz",
@@ -248,6 +288,17 @@ static void do_self_tests(void)
 #define AUDIO_HOTPLUG_EN	(1<<24)
 
 
+static const uint32_t eaglelake_regs[] = {
+	VIDEO_DIP_CTL, SDVOB, SDVOC, PORT_HOTPLUG_EN, AUD_CONFIG, AUD_DEBUG,
+	AUD_VID_DID, AUD_RID, AUD_SUBN_CNT, AUD_FUNC_GRP, AUD_SUBN_CNT2,
+	AUD_GRP_CAP, AUD_PWRST, AUD_SUPPWR, AUD_SID, AUD_OUT_CWCAP,
+	AUD_OUT_PCMSIZE, AUD_OUT_STR, AUD_OUT_DIG_CNVT, AUD_OUT_CH_STR,
+	AUD_OUT_STR_DESC, AUD_PINW_CAP, AUD_PIN_CAP, AUD_PINW_CONNLNG,
+	AUD_PINW_CONNLST, AUD_PINW_CNTR, AUD_PINW_UNSOLRESP, AUD_CNTL_ST,
+	AUD_PINW_CONFIG, AUD_HDMIW_STATUS, AUD_HDMIW_HDMIEDID,
+	AUD_HDMIW_INFOFR, AUD_CONV_CHCNT, AUD_CTS_ENABLE,
+};
+
 static void dump_eaglelake(void)
 {
     uint32_t dword;
@@ -482,26 +533,26 @@ static void dump_eaglelake(void)
 
     printf("AUD_CONV_CHCNT HDMI channel mapping:\n");
     for (i = 0; i < 8; i++) {
-	    OUTREG(AUD_CONV_CHCNT, i);
-	    dword = INREG(AUD_CONV_CHCNT);
+	    port_write(AUD_CONV_CHCNT, i);
+	    dword = port_read(AUD_CONV_CHCNT);
 	    printf("\t\t\t\t\t[0x%x] %u => %lu \n", dword, i, BITS(dword, 7, 4));
     }
 
     printf("AUD_HDMIW_HDMIEDID HDMI ELD:\n\t");
     dword = INREG(AUD_CNTL_ST);
     dword &= ~BITMASK(8, 5);
-    OUTREG(AUD_CNTL_ST, dword);
+    port_write(AUD_CNTL_ST, dword);
     for (i = 0; i < BITS(dword, 14, 10) / 4; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_HDMIEDID)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_HDMIEDID)));
     printf("\n");
 
     printf("AUD_HDMIW_INFOFR HDMI audio Infoframe:\n\t");
     dword = INREG(AUD_CNTL_ST);
     dword &= ~BITMASK(20, 18);
     dword &= ~BITMASK(3, 0);
-    OUTREG(AUD_CNTL_ST, dword);
+    port_write(AUD_CNTL_ST, dword);
     for (i = 0; i < 8; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_INFOFR)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_INFOFR)));
     printf("\n");
 }
 
@@ -540,6 +591,17 @@ static void dump_eaglelake(void)
 #define AUD_HDMIW_INFOFR_A	0xE2054
 #define AUD_HDMIW_INFOFR_B	0xE2154
 
+static const uint32_t ironlake_regs[] = {
+	HDMIB, HDMIC, HDMID, PCH_DP_B, PCH_DP_C, PCH_DP_D, AUD_CONFIG_A,
+	AUD_CONFIG_B, AUD_CTS_ENABLE_A, AUD_CTS_ENABLE_B, AUD_MISC_CTRL_A,
+	AUD_MISC_CTRL_B, AUD_VID_DID, AUD_RID, AUD_PWRST, AUD_PORT_EN_HD_CFG,
+	AUD_OUT_DIG_CNVT_A, AUD_OUT_DIG_CNVT_B, AUD_OUT_CH_STR,
+	AUD_OUT_STR_DESC_A, AUD_OUT_STR_DESC_B, AUD_PINW_CONNLNG_LIST,
+	AUD_PINW_CONNLNG_SEL, AUD_CNTL_ST_A, AUD_CNTL_ST_B, AUD_CNTL_ST2,
+	AUD_HDMIW_STATUS, AUD_HDMIW_HDMIEDID_A, AUD_HDMIW_HDMIEDID_B,
+	AUD_HDMIW_INFOFR_A, AUD_HDMIW_INFOFR_B,
+};
+
 static void dump_ironlake(void)
 {
     uint32_t dword;
@@ -738,8 +800,8 @@ static void dump_ironlake(void)
 
     printf("AUD_OUT_CH_STR  Converter_Channel_MAP	PORTB	PORTC	PORTD\n");
     for (i = 0; i < 8; i++) {
-	    OUTREG(AUD_OUT_CH_STR, i | (i << 8) | (i << 16));
-	    dword = INREG(AUD_OUT_CH_STR);
+	    port_write(AUD_OUT_CH_STR, i | (i << 8) | (i << 16));
+	    dword = port_read(AUD_OUT_CH_STR);
 	    printf("\t\t\t\t%lu\t%lu\t%lu\t%lu\n",
 		   1 + BITS(dword,  3,  0),
 		   1 + BITS(dword,  7,  4),
@@ -809,35 +871,35 @@ static void dump_ironlake(void)
     printf("AUD_HDMIW_HDMIEDID_A HDMI ELD:\n\t");
     dword = INREG(AUD_CNTL_ST_A);
     dword &= ~BITMASK(9, 5);
-    OUTREG(AUD_CNTL_ST_A, dword);
+    port_write(AUD_CNTL_ST_A, dword);
     for (i = 0; i < BITS(dword, 14, 10) / 4; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_HDMIEDID_A)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_HDMIEDID_A)));
     printf("\n");
 
     printf("AUD_HDMIW_HDMIEDID_B HDMI ELD:\n\t");
     dword = INREG(AUD_CNTL_ST_B);
     dword &= ~BITMASK(9, 5);
-    OUTREG(AUD_CNTL_ST_B, dword);
+    port_write(AUD_CNTL_ST_B, dword);
     for (i = 0; i < BITS(dword, 14, 10) / 4; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_HDMIEDID_B)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_HDMIEDID_B)));
     printf("\n");
 
     printf("AUD_HDMIW_INFOFR_A HDMI audio Infoframe:\n\t");
     dword = INREG(AUD_CNTL_ST_A);
     dword &= ~BITMASK(20, 18);
     dword &= ~BITMASK(3, 0);
-    OUTREG(AUD_CNTL_ST_A, dword);
+    port_write(AUD_CNTL_ST_A, dword);
     for (i = 0; i < 8; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_INFOFR_A)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_INFOFR_A)));
     printf("\n");
 
     printf("AUD_HDMIW_INFOFR_B HDMI audio Infoframe:\n\t");
     dword = INREG(AUD_CNTL_ST_B);
     dword &= ~BITMASK(20, 18);
     dword &= ~BITMASK(3, 0);
-    OUTREG(AUD_CNTL_ST_B, dword);
+    port_write(AUD_CNTL_ST_B, dword);
     for (i = 0; i < 8; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_INFOFR_B)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_INFOFR_B)));
     printf("\n");
 
 }
@@ -929,6 +991,22 @@ static void dump_ironlake(void)
 #define VIDEO_DIP_CTL_D		0xE3200
 
 
+static const uint32_t cpt_regs[] = {
+	HDMIB, HDMIC, HDMID, DP_CTL_B, DP_CTL_C, DP_CTL_D, TRANS_DP_CTL_A,
+	TRANS_DP_CTL_B, TRANS_DP_CTL_C, AUD_CONFIG_A, AUD_CONFIG_B,
+	AUD_CONFIG_C, AUD_CTS_ENABLE_A, AUD_CTS_ENABLE_B, AUD_CTS_ENABLE_C,
+	AUD_MISC_CTRL_A, AUD_MISC_CTRL_B, AUD_MISC_CTRL_C, AUD_VID_DID,
+	AUD_RID, AUD_PWRST, AUD_PORT_EN_HD_CFG, AUD_OUT_DIG_CNVT_A,
+	AUD_OUT_DIG_CNVT_B, AUD_OUT_DIG_CNVT_C, AUD_OUT_CH_STR,
+	AUD_OUT_STR_DESC_A, AUD_OUT_STR_DESC_B, AUD_OUT_STR_DESC_C,
+	AUD_PINW_CONNLNG_LIST, AUD_PINW_CONNLNG_SEL, AUD_CNTL_ST_A,
+	AUD_CNTL_ST_B, AUD_CNTL_ST_C, AUD_CNTRL_ST2, AUD_CNTRL_ST3,
+	AUD_HDMIW_STATUS, AUD_HDMIW_HDMIEDID_A, AUD_HDMIW_HDMIEDID_B,
+	AUD_HDMIW_HDMIEDID_C, AUD_HDMIW_INFOFR_A, AUD_HDMIW_INFOFR_B,
+	AUD_HDMIW_INFOFR_C, VIDEO_DIP_CTL_A, VIDEO_DIP_CTL_B,
+	VIDEO_DIP_CTL_C,
+};
+
 static void dump_cpt(void)
 {
     uint32_t dword;
@@ -1220,8 +1298,8 @@ static void dump_cpt(void)
 
     printf("AUD_OUT_CH_STR  Converter_Channel_MAP	PORTB	PORTC	PORTD\n");
     for (i = 0; i < 8; i++) {
-	    OUTREG(AUD_OUT_CH_STR, i | (i << 8) | (i << 16));
-	    dword = INREG(AUD_OUT_CH_STR);
+	    port_write(AUD_OUT_CH_STR, i | (i << 8) | (i << 16));
+	    dword = port_read(AUD_OUT_CH_STR);
 	    printf("\t\t\t\t%lu\t%lu\t%lu\t%lu\n",
 		   1 + BITS(dword,  3,  0),
 		   1 + BITS(dword,  7,  4),
@@ -1320,52 +1398,52 @@ static void dump_cpt(void)
     printf("AUD_HDMIW_HDMIEDID_A HDMI ELD:\n\t");
     dword = INREG(AUD_CNTL_ST_A);
     dword &= ~BITMASK(9, 5);
-    OUTREG(AUD_CNTL_ST_A, dword);
+    port_write(AUD_CNTL_ST_A, dword);
     for (i = 0; i < BITS(dword, 14, 10) / 4; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_HDMIEDID_A)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_HDMIEDID_A)));
     printf("\n");
 
     printf("AUD_HDMIW_HDMIEDID_B HDMI ELD:\n\t");
     dword = INREG(AUD_CNTL_ST_B);
     dword &= ~BITMASK(9, 5);
-    OUTREG(AUD_CNTL_ST_B, dword);
+    port_write(AUD_CNTL_ST_B, dword);
     for (i = 0; i < BITS(dword, 14, 10) / 4; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_HDMIEDID_B)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_HDMIEDID_B)));
     printf("\n");
 
     printf("AUD_HDMIW_HDMIEDID_C HDMI ELD:\n\t");
     dword = INREG(AUD_CNTL_ST_C);
     dword &= ~BITMASK(9, 5);
-    OUTREG(AUD_CNTL_ST_C, dword);
+    port_write(AUD_CNTL_ST_C, dword);
     for (i = 0; i < BITS(dword, 14, 10) / 4; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_HDMIEDID_C)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_HDMIEDID_C)));
     printf("\n");
 
     printf("AUD_HDMIW_INFOFR_A HDMI audio Infoframe:\n\t");
     dword = INREG(AUD_CNTL_ST_A);
     dword &= ~BITMASK(20, 18);
     dword &= ~BITMASK(3, 0);
-    OUTREG(AUD_CNTL_ST_A, dword);
+    port_write(AUD_CNTL_ST_A, dword);
     for (i = 0; i < 8; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_INFOFR_A)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_INFOFR_A)));
     printf("\n");
 
     printf("AUD_HDMIW_INFOFR_B HDMI audio Infoframe:\n\t");
     dword = INREG(AUD_CNTL_ST_B);
     dword &= ~BITMASK(20, 18);
     dword &= ~BITMASK(3, 0);
-    OUTREG(AUD_CNTL_ST_B, dword);
+    port_write(AUD_CNTL_ST_B, dword);
     for (i = 0; i < 8; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_INFOFR_B)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_INFOFR_B)));
     printf("\n");
 
     printf("AUD_HDMIW_INFOFR_C HDMI audio Infoframe:\n\t");
     dword = INREG(AUD_CNTL_ST_C);
     dword &= ~BITMASK(20, 18);
     dword &= ~BITMASK(3, 0);
-    OUTREG(AUD_CNTL_ST_C, dword);
+    port_write(AUD_CNTL_ST_C, dword);
     for (i = 0; i < 8; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_INFOFR_C)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_INFOFR_C)));
     printf("\n");
 
 }
@@ -1517,6 +1595,27 @@ static void dump_cpt(void)
 #define AUD_DP_DIP_STATUS	0x65f20
 
 
+static const uint32_t hsw_regs[] = {
+	DDI_BUF_CTL_A, DDI_BUF_CTL_B, DDI_BUF_CTL_C, DDI_BUF_CTL_D,
+	DDI_BUF_CTL_E, PIPE_CONF_A, PIPE_CONF_B, PIPE_CONF_C, PIPE_CONF_EDP,
+	PIPE_DDI_FUNC_CTL_A, PIPE_DDI_FUNC_CTL_B, PIPE_DDI_FUNC_CTL_C,
+	PIPE_DDI_FUNC_CTL_EDP, DP_TP_CTL_A, DP_TP_CTL_B, DP_TP_CTL_C,
+	DP_TP_CTL_D, DP_TP_CTL_E, DP_TP_ST_A, DP_TP_ST_B, DP_TP_ST_C,
+	DP_TP_ST_D, DP_TP_ST_E, TRANS_CONF_A, TRANS_CONF_B, TRANS_CONF_C,
+	AUD_CONFIG_A, AUD_CONFIG_B, AUD_CONFIG_C, AUD_MISC_CTRL_A,
+	AUD_MISC_CTRL_B, AUD_MISC_CTRL_C, AUD_VID_DID, AUD_RID,
+	AUD_CTS_ENABLE_A, AUD_CTS_ENABLE_B, AUD_CTS_ENABLE_C, AUD_PWRST,
+	AUD_HDMIW_HDMIEDID_A, AUD_HDMIW_HDMIEDID_B, AUD_HDMIW_HDMIEDID_C,
+	AUD_HDMIW_INFOFR_A, AUD_HDMIW_INFOFR_B, AUD_HDMIW_INFOFR_C,
+	AUD_PORT_EN_HD_CFG, AUD_OUT_DIG_CNVT_A, AUD_OUT_DIG_CNVT_B,
+	AUD_OUT_DIG_CNVT_C, AUD_OUT_CHAN_MAP, AUD_OUT_STR_DESC_A,
+	AUD_OUT_STR_DESC_B, AUD_OUT_STR_DESC_C, AUD_PINW_CONNLNG_LIST_A,
+	AUD_PINW_CONNLNG_LIST_B, AUD_PINW_CONNLNG_LIST_C,
+	AUD_PIPE_CONN_SEL_CTRL, AUD_DIP_ELD_CTRL_ST_A, AUD_DIP_ELD_CTRL_ST_B,
+	AUD_DIP_ELD_CTRL_ST_C, AUD_PIN_ELD_CP_VLD, AUD_HDMIW_STATUS,
+	AUD_PINW_CONNLNG_SEL,
+};
+
 static void dump_hsw(void)
 {
     uint32_t dword;
@@ -1828,8 +1927,8 @@ static void dump_hsw(void)
 
     printf("AUD_OUT_CHAN_MAP  Converter_Channel_MAP	PORTB	PORTC	PORTD\n");
     for (i = 0; i < 8; i++) {
-	    OUTREG(AUD_OUT_CHAN_MAP, i | (i << 8) | (i << 16));
-	    dword = INREG(AUD_OUT_CHAN_MAP);
+	    port_write(AUD_OUT_CHAN_MAP, i | (i << 8) | (i << 16));
+	    dword = port_read(AUD_OUT_CHAN_MAP);
 	    printf("\t\t\t\t%lu\t%lu\t%lu\t%lu\n",
 		   1 + BITS(dword,  3,  0),
 		   1 + BITS(dword,  7,  4),
@@ -1884,84 +1983,126 @@ static void dump_hsw(void)
     printf("AUD_HDMIW_HDMIEDID_A HDMI ELD:\n\t");
     dword = INREG(AUD_DIP_ELD_CTRL_ST_A);
     dword &= ~BITMASK(9, 5);
-    OUTREG(AUD_DIP_ELD_CTRL_ST_A, dword);
+    port_write(AUD_DIP_ELD_CTRL_ST_A, dword);
     for (i = 0; i < BITS(dword, 14, 10) / 4; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_HDMIEDID_A)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_HDMIEDID_A)));
     printf("\n");
 
     printf("AUD_HDMIW_HDMIEDID_B HDMI ELD:\n\t");
     dword = INREG(AUD_DIP_ELD_CTRL_ST_B);
     dword &= ~BITMASK(9, 5);
-    OUTREG(AUD_DIP_ELD_CTRL_ST_B, dword);
+    port_write(AUD_DIP_ELD_CTRL_ST_B, dword);
     for (i = 0; i < BITS(dword, 14, 10) / 4; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_HDMIEDID_B)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_HDMIEDID_B)));
     printf("\n");
 
     printf("AUD_HDMIW_HDMIEDID_C HDMI ELD:\n\t");
     dword = INREG(AUD_DIP_ELD_CTRL_ST_C);
     dword &= ~BITMASK(9, 5);
-    OUTREG(AUD_DIP_ELD_CTRL_ST_C, dword);
+    port_write(AUD_DIP_ELD_CTRL_ST_C, dword);
     for (i = 0; i < BITS(dword, 14, 10) / 4; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_HDMIEDID_C)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_HDMIEDID_C)));
     printf("\n");
 
     printf("AUD_HDMIW_INFOFR_A HDMI audio Infoframe:\n\t");
     dword = INREG(AUD_DIP_ELD_CTRL_ST_A);
     dword &= ~BITMASK(20, 18);
     dword &= ~BITMASK(3, 0);
-    OUTREG(AUD_DIP_ELD_CTRL_ST_A, dword);
+    port_write(AUD_DIP_ELD_CTRL_ST_A, dword);
     for (i = 0; i < 8; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_INFOFR_A)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_INFOFR_A)));
     printf("\n");
 
     printf("AUD_HDMIW_INFOFR_B HDMI audio Infoframe:\n\t");
     dword = INREG(AUD_DIP_ELD_CTRL_ST_B);
     dword &= ~BITMASK(20, 18);
     dword &= ~BITMASK(3, 0);
-    OUTREG(AUD_DIP_ELD_CTRL_ST_B, dword);
+    port_write(AUD_DIP_ELD_CTRL_ST_B, dword);
     for (i = 0; i < 8; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_INFOFR_B)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_INFOFR_B)));
     printf("\n");
 
     printf("AUD_HDMIW_INFOFR_C HDMI audio Infoframe:\n\t");
     dword = INREG(AUD_DIP_ELD_CTRL_ST_C);
     dword &= ~BITMASK(20, 18);
     dword &= ~BITMASK(3, 0);
-    OUTREG(AUD_DIP_ELD_CTRL_ST_C, dword);
+    port_write(AUD_DIP_ELD_CTRL_ST_C, dword);
     for (i = 0; i < 8; i++)
-	    printf("%08x ", htonl(INREG(AUD_HDMIW_INFOFR_C)));
+	    printf("%08x ", htonl(port_read(AUD_HDMIW_INFOFR_C)));
     printf("\n");
 }
 
-int main(int argc, char **argv)
+static void usage(const char *name)
 {
-	struct pci_device *pci_dev;
+	fprintf(stderr, "usage: %s [-d devid] [snapshot]\n", name);
+	exit(1);
+}
 
-	pci_dev = intel_get_pci_device();
-	devid = pci_dev->device_id; /* XXX not true when mapping! */
+int main(int argc, char **argv)
+{
+	struct pci_device *pci_dev = NULL;
+	uint32_t dump_devid = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			devid = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind > 1)
+		usage(argv[0]);
 
 	do_self_tests();
 
-	if (argc == 2)
-		intel_map_file(argv[1]);
-	else
+	if (optind < argc) {
+		src_mmio = intel_load_dump(argv[optind], &src_size, &dump_devid);
+		if (!devid)
+			devid = dump_devid;
+	}
+
+	/* live registers always need the device, -d only overrides the id */
+	if (!src_mmio || !devid) {
+		pci_dev = intel_get_pci_device();
+		if (!devid)
+			devid = pci_dev->device_id;
+	}
+
+	if (!src_mmio) {
 		intel_get_mmio(pci_dev);
+		src_mmio = mmio;
+		src_size = intel_gen(devid) < 5 ? 512 * 1024 : SHADOW_SIZE;
+		live = 1;
+	}
+
+	mmio = mmap(NULL, SHADOW_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mmio == MAP_FAILED)
+		err(1, "failed to allocate register shadow");
 
 	if (IS_GEN6(devid) || IS_GEN7(devid) || getenv("HAS_PCH_SPLIT")) {
 		if (IS_HASWELL(devid)) {
 			printf("Haswell audio registers:\n\n");
+			capture_registers(hsw_regs, ARRAY_SIZE(hsw_regs));
 			dump_hsw();
 			return 0;
 		}
 		printf("%s audio registers:\n\n",
 		       IS_GEN6(devid) ? "SandyBridge" : "IvyBridge");
-		intel_check_pch();
+		if (pci_dev)
+			intel_check_pch();
+		capture_registers(cpt_regs, ARRAY_SIZE(cpt_regs));
 		dump_cpt();
 	} else if (IS_GEN5(devid)) {
 		printf("Ironlake audio registers:\n\n");
+		capture_registers(ironlake_regs, ARRAY_SIZE(ironlake_regs));
 		dump_ironlake();
 	} else if (IS_G4X(devid)) {
 		printf("G45 audio registers:\n\n");
+		capture_registers(eaglelake_regs, ARRAY_SIZE(eaglelake_regs));
 		dump_eaglelake();
 	}
 
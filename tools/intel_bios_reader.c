@@ -25,8 +25,11 @@
  *
  */
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,7 +38,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#include "intel_bios.h"
+#include "intel_vbt.h"
 #include "intel_gpu_tools.h"
 
 static uint32_t devid = -1;
@@ -63,64 +66,24 @@ uint8_t *VBIOS;
 
 #define YESNO(val) ((val) ? "yes" : "no")
 
-struct bdb_block {
-	uint8_t id;
-	uint16_t size;
-	void *data;
-};
-
 struct bdb_header *bdb;
 static int tv_present;
 static int lvds_present;
 static int panel_type;
 
-static struct bdb_block *find_section(int section_id, int length)
-{
-	struct bdb_block *block;
-	unsigned char *base = (unsigned char *)bdb;
-	int idx = 0;
-	uint16_t total, current_size;
-	unsigned char current_id;
-
-	/* skip to first section */
-	idx += bdb->header_size;
-	total = bdb->bdb_size;
-	if (total > length)
-		total = length;
-
-	block = malloc(sizeof(*block));
-	if (!block) {
-		fprintf(stderr, "out of memory\n");
-		exit(-1);
-	}
+static struct intel_vbt vbt_info;
 
-	/* walk the sections looking for section_id */
-	while (idx + 3 < total) {
-		current_id = *(base + idx);
-		current_size = *(uint16_t *)(base + idx + 1);
-		if (idx + current_size > total)
-			return NULL;
-
-		if (current_id == section_id) {
-			block->id = current_id;
-			block->size = current_size;
-			block->data = base + idx + 3;
-			return block;
-		}
-
-		idx += current_size + 3;
-	}
-
-	free(block);
-	return NULL;
+static const struct bdb_block *find_section(int section_id)
+{
+	return intel_vbt_find_block(&vbt_info, section_id);
 }
 
-static void dump_general_features(int length)
+static void dump_general_features(void)
 {
 	struct bdb_general_features *features;
-	struct bdb_block *block;
+	const struct bdb_block *block;
 
-	block = find_section(BDB_GENERAL_FEATURES, length);
+	block = find_section(BDB_GENERAL_FEATURES);
 
 	if (!block)
 		return;
@@ -172,17 +135,15 @@ static void dump_general_features(int length)
 
 	tv_present = 1;		/* should be based on whether TV DAC exists */
 	lvds_present = 1;	/* should be based on IS_MOBILE() */
-
-	free(block);
 }
 
-static void dump_backlight_info(int length)
+static void dump_backlight_info(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct bdb_lvds_backlight *backlight;
 	struct blc_struct *blc;
 
-	block = find_section(BDB_LVDS_BACKLIGHT, length);
+	block = find_section(BDB_LVDS_BACKLIGHT);
 
 	if (!block)
 		return;
@@ -345,15 +306,15 @@ static void dump_child_device(struct child_device_config *child)
 	}
 }
 
-static void dump_general_definitions(int length)
+static void dump_general_definitions(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct bdb_general_definitions *defs;
 	struct child_device_config *child;
 	int i;
 	int child_device_num;
 
-	block = find_section(BDB_GENERAL_DEFINITIONS, length);
+	block = find_section(BDB_GENERAL_DEFINITIONS);
 
 	if (!block)
 		return;
@@ -374,17 +335,16 @@ static void dump_general_definitions(int length)
 	child_device_num = (block->size - sizeof(*defs)) / sizeof(*child);
 	for (i = 0; i < child_device_num; i++)
 		dump_child_device(&defs->devices[i]);
-	free(block);
 }
 
-static void dump_child_devices(int length)
+static void dump_child_devices(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct bdb_child_devices *child_devs;
 	struct child_device_config *child;
 	int i;
 
-	block = find_section(BDB_CHILD_DEVICE_TABLE, length);
+	block = find_section(BDB_CHILD_DEVICE_TABLE);
 	if (!block) {
 		printf("No child device table found\n");
 		return;
@@ -408,16 +368,14 @@ static void dump_child_devices(int length)
 		printf("\t\tDVO config: 0x%02x\n", child->dvo_cfg);
 		printf("\t\tDVO wiring: 0x%02x\n", child->dvo_wiring);
 	}
-
-	free(block);
 }
 
-static void dump_lvds_options(int length)
+static void dump_lvds_options(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct bdb_lvds_options *options;
 
-	block = find_section(BDB_LVDS_OPTIONS, length);
+	block = find_section(BDB_LVDS_OPTIONS);
 	if (!block) {
 		printf("No LVDS options block\n");
 		return;
@@ -437,27 +395,25 @@ static void dump_lvds_options(int length)
 	printf("\tPFIT enhanced text mode: %s\n",
 	       YESNO(options->pfit_text_mode_enhanced));
 	printf("\tPFIT mode: %d\n", options->pfit_mode);
-
-	free(block);
 }
 
-static void dump_lvds_ptr_data(int length)
+static void dump_lvds_ptr_data(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct bdb_lvds_lfp_data *lvds_data;
 	struct bdb_lvds_lfp_data_ptrs *ptrs;
 	struct lvds_fp_timing *fp_timing;
 	struct bdb_lvds_lfp_data_entry *entry;
 	int lfp_data_size;
 
-	block = find_section(BDB_LVDS_LFP_DATA_PTRS, length);
+	block = find_section(BDB_LVDS_LFP_DATA_PTRS);
 	if (!block) {
 		printf("No LFP data pointers block\n");
 		return;
 	}
 	ptrs = block->data;
 
-	block = find_section(BDB_LVDS_LFP_DATA, length);
+	block = find_section(BDB_LVDS_LFP_DATA);
 	if (!block) {
 		printf("No LVDS data block\n");
 		return;
@@ -476,13 +432,11 @@ static void dump_lvds_ptr_data(int length)
 
 	printf("\tpanel type %02i: %dx%d\n", panel_type, fp_timing->x_res,
 	       fp_timing->y_res);
-
-	free(block);
 }
 
-static void dump_lvds_data(int length)
+static void dump_lvds_data(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct bdb_lvds_lfp_data *lvds_data;
 	struct bdb_lvds_lfp_data_ptrs *ptrs;
 	int num_entries;
@@ -492,7 +446,7 @@ static void dump_lvds_data(int length)
 	float clock;
 	int lfp_data_size, dvo_offset;
 
-	block = find_section(BDB_LVDS_LFP_DATA_PTRS, length);
+	block = find_section(BDB_LVDS_LFP_DATA_PTRS);
 	if (!block) {
 		printf("No LVDS ptr block\n");
 		return;
@@ -502,9 +456,8 @@ static void dump_lvds_data(int length)
 	    ptrs->ptr[1].fp_timing_offset - ptrs->ptr[0].fp_timing_offset;
 	dvo_offset =
 	    ptrs->ptr[0].dvo_timing_offset - ptrs->ptr[0].fp_timing_offset;
-	free(block);
 
-	block = find_section(BDB_LVDS_LFP_DATA, length);
+	block = find_section(BDB_LVDS_LFP_DATA);
 	if (!block) {
 		printf("No LVDS data block\n");
 		return;
@@ -560,15 +513,14 @@ static void dump_lvds_data(int length)
 		       (hsyncend > htotal || vsyncend > vtotal) ?
 		       "BAD!" : "good");
 	}
-	free(block);
 }
 
-static void dump_driver_feature(int length)
+static void dump_driver_feature(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct bdb_driver_feature *feature;
 
-	block = find_section(BDB_DRIVER_FEATURES, length);
+	block = find_section(BDB_DRIVER_FEATURES);
 	if (!block) {
 		printf("No Driver feature data block\n");
 		return;
@@ -636,16 +588,15 @@ static void dump_driver_feature(int length)
 	printf("\tLegacy CRT max Y: %d\n", feature->legacy_crt_max_y);
 	printf("\tLegacy CRT max refresh: %d\n",
 	       feature->legacy_crt_max_refresh);
-	free(block);
 }
 
-static void dump_edp(int length)
+static void dump_edp(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct bdb_edp *edp;
 	int bpp;
 
-	block = find_section(BDB_EDP, length);
+	block = find_section(BDB_EDP);
 	if (!block) {
 		printf("No EDP data block\n");
 		return;
@@ -723,7 +674,6 @@ static void dump_edp(int length)
 		printf("1.2V\n");
 		break;
 	}
-	free(block);
 }
 
 static void
@@ -755,13 +705,13 @@ print_detail_timing_data(struct lvds_dvo_timing2 *dvo_timing)
 	printf("\tclock: %d\n", dvo_timing->clock * 10);
 }
 
-static void dump_sdvo_panel_dtds(int length)
+static void dump_sdvo_panel_dtds(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct lvds_dvo_timing2 *dvo_timing;
 	int n, count;
 
-	block = find_section(BDB_SDVO_PANEL_DTDS, length);
+	block = find_section(BDB_SDVO_PANEL_DTDS);
 	if (!block) {
 		printf("No SDVO panel dtds block\n");
 		return;
@@ -774,16 +724,14 @@ static void dump_sdvo_panel_dtds(int length)
 		printf("%d:\n", n);
 		print_detail_timing_data(dvo_timing++);
 	}
-
-	free(block);
 }
 
-static void dump_sdvo_lvds_options(int length)
+static void dump_sdvo_lvds_options(void)
 {
-	struct bdb_block *block;
+	const struct bdb_block *block;
 	struct bdb_sdvo_lvds_options *options;
 
-	block = find_section(BDB_SDVO_LVDS_OPTIONS, length);
+	block = find_section(BDB_SDVO_LVDS_OPTIONS);
 	if (!block) {
 		printf("No SDVO LVDS options block\n");
 		return;
@@ -807,15 +755,20 @@ static void dump_sdvo_lvds_options(int length)
 	printf("\tmisc[1]: %x\n", options->panel_misc_bits_2);
 	printf("\tmisc[2]: %x\n", options->panel_misc_bits_3);
 	printf("\tmisc[3]: %x\n", options->panel_misc_bits_4);
-
-	free(block);
 }
 
 static int
-get_device_id(unsigned char *bios)
+get_device_id(unsigned char *bios, size_t size)
 {
     int device;
-    int offset = (bios[0x19] << 8) + bios[0x18];
+    size_t offset;
+
+    if (size < 0x1a)
+	return -1;
+
+    offset = (bios[0x19] << 8) + bios[0x18];
+    if (offset + 8 > size)
+	return -1;
 
     if (bios[offset] != 'P' ||
 	bios[offset+1] != 'C' ||
@@ -828,87 +781,617 @@ get_device_id(unsigned char *bios)
     return device;
 }
 
-int main(int argc, char **argv)
+/*
+ * Batch mode: any number of ROM files and directories of ROM files are
+ * loaded and hashed by a pool of worker threads, identical VBTs are folded
+ * together and every unique image is then rendered as one JSON record.
+ * Output is in command line order regardless of the thread count.
+ */
+struct batch_entry {
+	char *path;
+	struct intel_vbt vbt;
+	int err;
+	uint64_t hash;
+	int dup_of;
+	char *record;
+	size_t record_len;
+};
+
+static struct batch_entry *batch;
+static int batch_count, batch_size;
+static int batch_next;
+
+static void batch_add(const char *path)
 {
-	int fd;
-	struct vbt_header *vbt = NULL;
-	int vbt_off, bdb_off, i;
-	const char *filename = "bios";
-	struct stat finfo;
-	struct bdb_block *block;
-	char signature[17];
-	char *devid_string;
+	if (batch_count == batch_size) {
+		batch_size = batch_size ? batch_size * 2 : 64;
+		batch = realloc(batch, batch_size * sizeof(*batch));
+		if (!batch) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
 
-	if (argc != 2) {
-		printf("usage: %s <rom file>\n", argv[0]);
-		return 1;
+	memset(&batch[batch_count], 0, sizeof(batch[batch_count]));
+	batch[batch_count].path = strdup(path);
+	batch[batch_count].dup_of = -1;
+	batch_count++;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void batch_add_dir(const char *dir)
+{
+	struct dirent *ent;
+	char **names = NULL;
+	int count = 0, size = 0, i;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d) {
+		fprintf(stderr, "Couldn't open \"%s\": %s\n", dir,
+			strerror(errno));
+		exit(1);
 	}
 
-	if ((devid_string = getenv("DEVICE")))
-	    devid = strtoul(devid_string, NULL, 0);
+	while ((ent = readdir(d))) {
+		char path[PATH_MAX];
+		struct stat st;
 
-	filename = argv[1];
+		if (ent->d_name[0] == '.')
+			continue;
 
-	fd = open(filename, O_RDONLY);
-	if (fd == -1) {
-		printf("Couldn't open \"%s\": %s\n", filename, strerror(errno));
-		return 1;
+		snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+		if (stat(path, &st) || !S_ISREG(st.st_mode))
+			continue;
+
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			names = realloc(names, size * sizeof(*names));
+			if (!names) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+		names[count++] = strdup(path);
 	}
+	closedir(d);
 
-	if (stat(filename, &finfo)) {
-		printf("failed to stat \"%s\": %s\n", filename,
-		       strerror(errno));
-		return 1;
+	qsort(names, count, sizeof(*names), compare_names);
+	for (i = 0; i < count; i++) {
+		batch_add(names[i]);
+		free(names[i]);
 	}
+	free(names);
+}
 
-	if (finfo.st_size == 0) {
-		int len = 0, ret;
-		finfo.st_size = 8192;
-		VBIOS = malloc (finfo.st_size);
-		while ((ret = read(fd, VBIOS + len, finfo.st_size - len))) {
-			if (ret < 0) {
-				printf("failed to read \"%s\": %s\n", filename,
-				       strerror(errno));
-				return 1;
-			}
+/* the VBT proper, so that identical tables in different ROMs match */
+static void vbt_extent(const struct intel_vbt *vbt, const uint8_t **start,
+		       size_t *len)
+{
+	size_t off = (uint8_t *)vbt->vbt - vbt->image;
+	size_t end = (uint8_t *)vbt->bdb - vbt->image + vbt->bdb->bdb_size;
+
+	if (vbt->vbt->vbt_size && off + vbt->vbt->vbt_size > end)
+		end = off + vbt->vbt->vbt_size;
+	if (end > vbt->size)
+		end = vbt->size;
 
-			len += ret;
-			if (len == finfo.st_size) {
-				finfo.st_size *= 2;
-				VBIOS = realloc(VBIOS, finfo.st_size);
+	*start = vbt->image + off;
+	*len = end - off;
+}
+
+static uint64_t hash_vbt(const struct intel_vbt *vbt)
+{
+	const uint8_t *p;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t len, i;
+
+	vbt_extent(vbt, &p, &len);
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static int same_vbt(const struct intel_vbt *a, const struct intel_vbt *b)
+{
+	const uint8_t *pa, *pb;
+	size_t la, lb;
+
+	vbt_extent(a, &pa, &la);
+	vbt_extent(b, &pb, &lb);
+
+	return la == lb && !memcmp(pa, pb, la);
+}
+
+static void json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void json_bool(FILE *out, const char *name, int val)
+{
+	fprintf(out, ",\"%s\":%s", name, val ? "true" : "false");
+}
+
+static int vbt_panel_type(const struct intel_vbt *vbt)
+{
+	const struct bdb_block *block;
+	const struct bdb_lvds_options *options;
+
+	block = intel_vbt_find_block(vbt, BDB_LVDS_OPTIONS);
+	if (!block || block->size < sizeof(*options))
+		return -1;
+
+	options = block->data;
+	return options->panel_type < 16 ? options->panel_type : -1;
+}
+
+static void json_general_features(FILE *out, const struct intel_vbt *vbt)
+{
+	const struct bdb_block *block;
+	const struct bdb_general_features *features;
+
+	block = intel_vbt_find_block(vbt, BDB_GENERAL_FEATURES);
+	if (!block || block->size < sizeof(*features))
+		return;
+
+	features = block->data;
+	fprintf(out, ",\"general_features\":{\"panel_fitting\":%d",
+		features->panel_fitting);
+	json_bool(out, "enable_ssc", features->enable_ssc);
+	fprintf(out, ",\"ssc_freq\":%d", features->ssc_freq);
+	json_bool(out, "lfp_on_override", features->enable_lfp_on_override);
+	json_bool(out, "disable_ssc_on_clone", features->disable_ssc_ddt);
+	json_bool(out, "legacy_monitor_detect",
+		  features->legacy_monitor_detect);
+	json_bool(out, "int_crt", features->int_crt_support);
+	json_bool(out, "int_tv", features->int_tv_support);
+	fputc('}', out);
+}
+
+static void json_child_devices(FILE *out, const struct intel_vbt *vbt)
+{
+	const struct bdb_block *block;
+	const struct bdb_general_definitions *defs;
+	int i, num, first = 1;
+
+	block = intel_vbt_find_block(vbt, BDB_GENERAL_DEFINITIONS);
+	if (!block || block->size < sizeof(*defs))
+		return;
+
+	defs = block->data;
+	num = (block->size - sizeof(*defs)) / sizeof(defs->devices[0]);
+
+	fprintf(out, ",\"child_devices\":[");
+	for (i = 0; i < num; i++) {
+		const struct child_device_config *child = &defs->devices[i];
+
+		if (!child->device_type)
+			continue;
+
+		fprintf(out, "%s{\"index\":%d,\"type\":%d,\"name\":",
+			first ? "" : ",", i, child->device_type);
+		json_string(out, child_device_type(child->device_type));
+		if (vbt->bdb->version < 152) {
+			fprintf(out, ",\"dvo_port\":%d,\"i2c_pin\":%d,"
+				"\"ddc_pin\":%d,\"slave_addr\":%d}",
+				child->dvo_port, child->i2c_pin,
+				child->ddc_pin, child->slave_addr);
+		} else {
+			const struct efp_child_device_config *efp =
+				(const struct efp_child_device_config *)child;
+
+			fprintf(out, ",\"port\":");
+			json_string(out, efp_port(efp->port));
+			fprintf(out, ",\"ddc_pin\":%d,\"aux_chan\":%d",
+				efp->ddc_pin, efp->aux_chan);
+			json_bool(out, "hdmi_compat", efp->hdmi_compat);
+			fputc('}', out);
+		}
+		first = 0;
+	}
+	fputc(']', out);
+}
+
+static void json_lvds_panels(FILE *out, const struct intel_vbt *vbt)
+{
+	const struct bdb_block *ptr_block, *block;
+	const struct bdb_lvds_lfp_data_ptrs *ptrs;
+	const uint8_t *data;
+	int lfp_data_size, dvo_offset, num, i;
+
+	ptr_block = intel_vbt_find_block(vbt, BDB_LVDS_LFP_DATA_PTRS);
+	block = intel_vbt_find_block(vbt, BDB_LVDS_LFP_DATA);
+	if (!ptr_block || !block || ptr_block->size < sizeof(*ptrs))
+		return;
+
+	ptrs = ptr_block->data;
+	lfp_data_size =
+	    ptrs->ptr[1].fp_timing_offset - ptrs->ptr[0].fp_timing_offset;
+	dvo_offset =
+	    ptrs->ptr[0].dvo_timing_offset - ptrs->ptr[0].fp_timing_offset;
+	if (lfp_data_size < (int)sizeof(struct lvds_fp_timing) ||
+	    dvo_offset < 0 || dvo_offset + 18 > lfp_data_size)
+		return;
+
+	data = block->data;
+	num = block->size / lfp_data_size;
+
+	fprintf(out, ",\"lvds_panels\":[");
+	for (i = 0; i < num; i++) {
+		const struct lvds_fp_timing *fp =
+			(const struct lvds_fp_timing *)(data + lfp_data_size * i);
+		const uint8_t *timing_data = data + lfp_data_size * i + dvo_offset;
+		int hdisplay = _H_ACTIVE(timing_data);
+		int vdisplay = _V_ACTIVE(timing_data);
+
+		fprintf(out, "%s{\"index\":%d,\"x_res\":%d,\"y_res\":%d,"
+			"\"clock\":%d,\"hdisplay\":%d,\"hsync_start\":%d,"
+			"\"hsync_end\":%d,\"htotal\":%d,\"vdisplay\":%d,"
+			"\"vsync_start\":%d,\"vsync_end\":%d,\"vtotal\":%d}",
+			i ? "," : "", i, fp->x_res, fp->y_res,
+			_PIXEL_CLOCK(timing_data),
+			hdisplay,
+			hdisplay + _H_SYNC_OFF(timing_data),
+			hdisplay + _H_SYNC_OFF(timing_data) +
+			_H_SYNC_WIDTH(timing_data),
+			hdisplay + _H_BLANK(timing_data),
+			vdisplay,
+			vdisplay + _V_SYNC_OFF(timing_data),
+			vdisplay + _V_SYNC_OFF(timing_data) +
+			_V_SYNC_WIDTH(timing_data),
+			vdisplay + _V_BLANK(timing_data));
+	}
+	fputc(']', out);
+}
+
+static void json_edp(FILE *out, const struct intel_vbt *vbt, int type)
+{
+	const struct bdb_block *block;
+	const struct bdb_edp *edp;
+	static const int bpp[] = { 18, 24, 30, 0 };
+	static const int lanes[] = { 1, 2, 0, 4 };
+
+	block = intel_vbt_find_block(vbt, BDB_EDP);
+	if (!block || block->size < sizeof(*edp) || type < 0)
+		return;
+
+	edp = block->data;
+	fprintf(out, ",\"edp\":{\"t3\":%d,\"t7\":%d,\"t9\":%d,\"t10\":%d,"
+		"\"t12\":%d,\"bpp\":%d,\"rate\":\"%s\",\"lanes\":%d,"
+		"\"preemphasis\":%d,\"vswing\":%d}",
+		edp->power_seqs[type].t3, edp->power_seqs[type].t7,
+		edp->power_seqs[type].t9, edp->power_seqs[type].t10,
+		edp->power_seqs[type].t12,
+		bpp[(edp->color_depth >> (type * 2)) & 3],
+		edp->link_params[type].rate == EDP_RATE_2_7 ? "2.7G" : "1.62G",
+		lanes[edp->link_params[type].lanes & 3],
+		edp->link_params[type].preemphasis,
+		edp->link_params[type].vswing);
+}
+
+static void json_driver_features(FILE *out, const struct intel_vbt *vbt)
+{
+	const struct bdb_block *block;
+	const struct bdb_driver_feature *feature;
+	static const char *lvds_config[] = {
+		[BDB_DRIVER_NO_LVDS] = "none",
+		[BDB_DRIVER_INT_LVDS] = "integrated",
+		[BDB_DRIVER_SDVO_LVDS] = "sdvo",
+		[BDB_DRIVER_EDP] = "edp",
+	};
+
+	block = intel_vbt_find_block(vbt, BDB_DRIVER_FEATURES);
+	if (!block || block->size < sizeof(*feature))
+		return;
+
+	feature = block->data;
+	fprintf(out, ",\"driver_features\":{\"lvds_config\":\"%s\","
+		"\"boot_mode\":[%u,%u,%u,%u]",
+		lvds_config[feature->lvds_config & 3],
+		feature->boot_mode_x, feature->boot_mode_y,
+		feature->boot_mode_bpp, feature->boot_mode_refresh);
+	json_bool(out, "crt_hotplug", feature->crt_hotplug);
+	json_bool(out, "hotplug_dvo", feature->hotplug_dvo);
+	json_bool(out, "enable_lfp_primary", feature->enable_lfp_primary);
+	json_bool(out, "dual_frequency", feature->dual_frequency);
+	json_bool(out, "static_display", feature->static_display);
+	fputc('}', out);
+}
+
+static void batch_render(struct batch_entry *e)
+{
+	const struct intel_vbt *vbt = &e->vbt;
+	int type = vbt_panel_type(vbt);
+	int id = devid;
+	FILE *out;
+	int i, first = 1;
+
+	out = open_memstream(&e->record, &e->record_len);
+	if (!out)
+		return;
+
+	if (id == -1)
+		id = get_device_id(vbt->image, vbt->size);
+
+	fprintf(out, ",\"hash\":\"%016llx\",\"vbt_version\":%d,"
+		"\"bdb_version\":%d,\"devid\":",
+		(unsigned long long)e->hash, vbt->vbt->version,
+		vbt->bdb->version);
+	if (id == -1)
+		fprintf(out, "null");
+	else
+		fprintf(out, "\"0x%04x\"", id);
+
+	fprintf(out, ",\"sections\":[");
+	for (i = 0; i < 256; i++) {
+		if (!intel_vbt_find_block(vbt, i))
+			continue;
+		fprintf(out, "%s%d", first ? "" : ",", i);
+		first = 0;
+	}
+	fputc(']', out);
+
+	json_general_features(out, vbt);
+	json_child_devices(out, vbt);
+	fprintf(out, ",\"panel_type\":%d", type);
+	json_lvds_panels(out, vbt);
+	json_edp(out, vbt, type);
+	json_driver_features(out, vbt);
+
+	fclose(out);
+}
+
+static void *batch_load_worker(void *arg)
+{
+	int i;
+
+	while ((i = __atomic_fetch_add(&batch_next, 1, __ATOMIC_RELAXED)) <
+	       batch_count) {
+		struct batch_entry *e = &batch[i];
+
+		e->err = intel_vbt_open(&e->vbt, e->path);
+		if (!e->err)
+			e->hash = hash_vbt(&e->vbt);
+	}
+
+	return NULL;
+}
+
+static void *batch_render_worker(void *arg)
+{
+	int i;
+
+	while ((i = __atomic_fetch_add(&batch_next, 1, __ATOMIC_RELAXED)) <
+	       batch_count) {
+		struct batch_entry *e = &batch[i];
+
+		if (e->err || e->dup_of >= 0)
+			continue;
+
+		batch_render(e);
+		intel_vbt_close(&e->vbt);
+	}
+
+	return NULL;
+}
+
+static void run_pool(int nthreads, void *(*fn)(void *))
+{
+	pthread_t *threads;
+	int i;
+
+	batch_next = 0;
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, fn, NULL)) {
+			fprintf(stderr, "failed to create worker thread\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+}
+
+/*
+ * Fold identical VBTs onto the first file carrying them.  This runs in
+ * command line order so the choice of original does not depend on thread
+ * scheduling.
+ */
+static int batch_dedupe(void)
+{
+	int *table, mask, i, unique = 0;
+
+	for (mask = 1; mask < batch_count * 2; mask <<= 1)
+		;
+	table = malloc(mask * sizeof(*table));
+	if (!table) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memset(table, -1, mask * sizeof(*table));
+	mask--;
+
+	for (i = 0; i < batch_count; i++) {
+		struct batch_entry *e = &batch[i];
+		int slot;
+
+		if (e->err)
+			continue;
+
+		for (slot = e->hash & mask; table[slot] >= 0;
+		     slot = (slot + 1) & mask) {
+			struct batch_entry *o = &batch[table[slot]];
+
+			if (o->hash == e->hash && same_vbt(&o->vbt, &e->vbt)) {
+				e->dup_of = table[slot];
+				break;
 			}
 		}
-	} else {
-		VBIOS = mmap(NULL, finfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
-		if (VBIOS == MAP_FAILED) {
-			printf("failed to map \"%s\": %s\n", filename, strerror(errno));
-			return 1;
+
+		if (e->dup_of < 0) {
+			table[slot] = i;
+			unique++;
+		}
+	}
+
+	for (i = 0; i < batch_count; i++)
+		if (batch[i].dup_of >= 0)
+			intel_vbt_close(&batch[i].vbt);
+
+	free(table);
+	return unique;
+}
+
+static int batch_main(int nthreads)
+{
+	int i, unique, failed = 0;
+
+	if (nthreads > batch_count)
+		nthreads = batch_count;
+
+	run_pool(nthreads, batch_load_worker);
+	unique = batch_dedupe();
+	run_pool(nthreads, batch_render_worker);
+
+	for (i = 0; i < batch_count; i++) {
+		struct batch_entry *e = &batch[i];
+
+		printf("{\"file\":");
+		json_string(stdout, e->path);
+		if (e->err) {
+			printf(",\"error\":");
+			json_string(stdout, e->err == -ENODATA ?
+				    "VBT signature missing" :
+				    e->err == -EINVAL ?
+				    "BDB points beyond end of data block" :
+				    strerror(-e->err));
+			failed++;
+		} else if (e->dup_of >= 0) {
+			printf(",\"hash\":\"%016llx\",\"duplicate_of\":",
+			       (unsigned long long)e->hash);
+			json_string(stdout, batch[e->dup_of].path);
+		} else if (e->record) {
+			fwrite(e->record, 1, e->record_len, stdout);
 		}
+		printf("}\n");
+	}
+
+	for (i = 0; i < batch_count; i++) {
+		free(batch[i].record);
+		free(batch[i].path);
 	}
 
-	/* Scour memory looking for the VBT signature */
-	for (i = 0; i + 4 < finfo.st_size; i++) {
-		if (!memcmp(VBIOS + i, "$VBT", 4)) {
-			vbt_off = i;
-			vbt = (struct vbt_header *)(VBIOS + i);
+	fprintf(stderr, "%d images, %d unique VBTs, %d failed\n",
+		batch_count, unique, failed);
+
+	free(batch);
+	return failed ? 1 : 0;
+}
+
+static void usage(const char *cmdname)
+{
+	printf("usage: %s [-j] [-t threads] <rom file|directory>...\n",
+	       cmdname);
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = "bios";
+	char signature[17];
+	char *devid_string;
+	int i, ret, opt, json = 0;
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	struct stat st;
+
+	while ((opt = getopt(argc, argv, "jt:")) != -1) {
+		switch (opt) {
+		case 'j':
+			json = 1;
+			break;
+		case 't':
+			nthreads = atoi(optarg);
 			break;
+		default:
+			usage(argv[0]);
+			return 1;
 		}
 	}
 
-	if (!vbt) {
-		printf("VBT signature missing\n");
+	if (optind >= argc) {
+		usage(argv[0]);
 		return 1;
 	}
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if ((devid_string = getenv("DEVICE")))
+	    devid = strtoul(devid_string, NULL, 0);
 
-	printf("VBT vers: %d.%d\n", vbt->version / 100, vbt->version % 100);
+	filename = argv[optind];
 
-	bdb_off = vbt_off + vbt->bdb_offset;
-	if (bdb_off >= finfo.st_size - sizeof(struct bdb_header)) {
+	if (json || argc - optind > 1 ||
+	    (!stat(filename, &st) && S_ISDIR(st.st_mode))) {
+		for (i = optind; i < argc; i++) {
+			if (!stat(argv[i], &st) && S_ISDIR(st.st_mode))
+				batch_add_dir(argv[i]);
+			else
+				batch_add(argv[i]);
+		}
+		if (!batch_count) {
+			fprintf(stderr, "no ROM files found\n");
+			return 1;
+		}
+		return batch_main(nthreads);
+	}
+
+	ret = intel_vbt_open(&vbt_info, filename);
+	switch (ret) {
+	case 0:
+		break;
+	case -ENODATA:
+		printf("VBT signature missing\n");
+		return 1;
+	case -EINVAL:
 		printf("Invalid VBT found, BDB points beyond end of data block\n");
 		return 1;
+	default:
+		printf("Couldn't open \"%s\": %s\n", filename, strerror(-ret));
+		return 1;
 	}
 
-	bdb = (struct bdb_header *)(VBIOS + bdb_off);
+	VBIOS = vbt_info.image;
+	bdb = vbt_info.bdb;
+
+	printf("VBT vers: %d.%d\n", vbt_info.vbt->version / 100,
+	       vbt_info.vbt->version % 100);
+
 	strncpy(signature, (char *)bdb->signature, 16);
 	signature[16] = 0;
 	printf("BDB sig: %s\n", signature);
@@ -916,32 +1399,31 @@ int main(int argc, char **argv)
 
 	printf("Available sections: ");
 	for (i = 0; i < 256; i++) {
-		block = find_section(i, finfo.st_size);
-		if (!block)
-			continue;
-		printf("%d ", i);
-		free(block);
+		if (find_section(i))
+			printf("%d ", i);
 	}
 	printf("\n");
 
 	if (devid == -1)
-	    devid = get_device_id(VBIOS);
+	    devid = get_device_id(VBIOS, vbt_info.size);
 	if (devid == -1)
 	    printf("Warning: could not find PCI device ID!\n");
 
-	dump_general_features(finfo.st_size);
-	dump_general_definitions(finfo.st_size);
-	dump_child_devices(finfo.st_size);
-	dump_lvds_options(finfo.st_size);
-	dump_lvds_data(finfo.st_size);
-	dump_lvds_ptr_data(finfo.st_size);
-	dump_backlight_info(finfo.st_size);
+	dump_general_features();
+	dump_general_definitions();
+	dump_child_devices();
+	dump_lvds_options();
+	dump_lvds_data();
+	dump_lvds_ptr_data();
+	dump_backlight_info();
+
+	dump_sdvo_lvds_options();
+	dump_sdvo_panel_dtds();
 
-	dump_sdvo_lvds_options(finfo.st_size);
-	dump_sdvo_panel_dtds(finfo.st_size);
+	dump_driver_feature();
+	dump_edp();
 
-	dump_driver_feature(finfo.st_size);
-	dump_edp(finfo.st_size);
+	intel_vbt_close(&vbt_info);
 
 	return 0;
 }
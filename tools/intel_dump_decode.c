@@ -34,16 +34,443 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 
 #include <intel_bufmgr.h>
 
+#include "intel_gpu_tools.h"
+
+/* Size of the streaming window used for pipes and --stream, in dwords. */
+#define RING_DWORDS (256 * 1024)
+
 struct drm_intel_decode *ctx;
+static int stream;
+static int timing;
+static uint64_t bytes_decoded;
+
+/*
+ * Returns the length in dwords of the command starting with header @cmd.
+ *
+ * This only needs to be good enough to avoid splitting a packet when the
+ * input is decoded in several pieces, the decoder proper still does the
+ * real work.
+ */
+static unsigned int
+cmd_length(uint32_t cmd)
+{
+	switch (cmd >> 29) {
+	case 0x0: /* MI */
+		if (((cmd >> 23) & 0x3f) < 0x10)
+			return 1;
+		return (cmd & 0xff) + 2;
+	case 0x2: /* 2D */
+		return (cmd & 0xff) + 2;
+	case 0x3: /* 3D */
+		/* PIPELINE_SELECT and friends are single dword */
+		if (((cmd >> 27) & 0x3) == 1 && ((cmd >> 24) & 0x7) == 1)
+			return 1;
+		return (cmd & 0xff) + 2;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Statistics mode: instead of disassembling, walk the packets once and
+ * account for them per opcode.
+ */
+
+/*
+ * One slot per possible opcode_key(): 64 MI, 128 2D and 8192 3D opcodes,
+ * plus one per remaining command type.
+ */
+#define STATS_MI_BASE		0
+#define STATS_2D_BASE		(STATS_MI_BASE + 64)
+#define STATS_3D_BASE		(STATS_2D_BASE + 128)
+#define STATS_OTHER_BASE	(STATS_3D_BASE + 8192)
+#define STATS_TABLE_SIZE	(STATS_OTHER_BASE + 8)
+
+struct opcode_stats {
+	uint32_t key;
+	int used;
+	uint64_t count;
+	uint64_t dwords;
+	uint64_t redundant;
+	uint64_t last_hash;
+	unsigned int last_len;
+};
+
+static struct {
+	struct opcode_stats table[STATS_TABLE_SIZE];
+	unsigned int nopcodes;
+	uint64_t packets;
+	uint64_t dwords;
+	uint64_t state_packets;
+	uint64_t redundant;
+	uint64_t primitives;
+	uint64_t blits;
+	uint64_t relocs;
+} stats;
+
+static int stats_mode;
+
+static const struct {
+	uint32_t key;
+	const char *name;
+} opcode_names[] = {
+	{ 0x00000000, "MI_NOOP" },
+	{ 0x01000000, "MI_USER_INTERRUPT" },
+	{ 0x01800000, "MI_WAIT_FOR_EVENT" },
+	{ 0x02000000, "MI_FLUSH" },
+	{ 0x02800000, "MI_ARB_CHECK" },
+	{ 0x05000000, "MI_BATCH_BUFFER_END" },
+	{ 0x0b000000, "MI_SEMAPHORE_MBOX" },
+	{ 0x0c000000, "MI_SET_CONTEXT" },
+	{ 0x10000000, "MI_STORE_DWORD_IMM" },
+	{ 0x11000000, "MI_LOAD_REGISTER_IMM" },
+	{ 0x12000000, "MI_STORE_REGISTER_MEM" },
+	{ 0x13000000, "MI_FLUSH_DW" },
+	{ 0x18800000, "MI_BATCH_BUFFER_START" },
+	{ 0x50000000, "COLOR_BLT" },
+	{ 0x50c00000, "SRC_COPY_BLT" },
+	{ 0x40400000, "XY_SETUP_BLT" },
+	{ 0x54000000, "XY_COLOR_BLT" },
+	{ 0x54c00000, "XY_SRC_COPY_BLT" },
+	{ 0x61010000, "STATE_BASE_ADDRESS" },
+	{ 0x61020000, "STATE_SIP" },
+	{ 0x69040000, "PIPELINE_SELECT" },
+	{ 0x78000000, "3DSTATE_PIPELINED_POINTERS" },
+	{ 0x78010000, "3DSTATE_BINDING_TABLE_POINTERS" },
+	{ 0x78020000, "3DSTATE_SAMPLER_STATE_POINTERS" },
+	{ 0x78050000, "3DSTATE_URB" },
+	{ 0x78080000, "3DSTATE_VERTEX_BUFFERS" },
+	{ 0x78090000, "3DSTATE_VERTEX_ELEMENTS" },
+	{ 0x780a0000, "3DSTATE_INDEX_BUFFER" },
+	{ 0x780b0000, "3DSTATE_VF_STATISTICS" },
+	{ 0x780d0000, "3DSTATE_VIEWPORT_STATE_POINTERS" },
+	{ 0x780e0000, "3DSTATE_CC_STATE_POINTERS" },
+	{ 0x780f0000, "3DSTATE_SCISSOR_STATE_POINTERS" },
+	{ 0x78100000, "3DSTATE_VS" },
+	{ 0x78110000, "3DSTATE_GS" },
+	{ 0x78120000, "3DSTATE_CLIP" },
+	{ 0x78130000, "3DSTATE_SF" },
+	{ 0x78140000, "3DSTATE_WM" },
+	{ 0x78150000, "3DSTATE_CONSTANT_VS" },
+	{ 0x78160000, "3DSTATE_CONSTANT_GS" },
+	{ 0x78170000, "3DSTATE_CONSTANT_PS" },
+	{ 0x78180000, "3DSTATE_SAMPLE_MASK" },
+	{ 0x79000000, "3DSTATE_DRAWING_RECTANGLE" },
+	{ 0x79010000, "3DSTATE_CONSTANT_COLOR" },
+	{ 0x79050000, "3DSTATE_DEPTH_BUFFER" },
+	{ 0x79060000, "3DSTATE_POLY_STIPPLE_OFFSET" },
+	{ 0x79070000, "3DSTATE_POLY_STIPPLE_PATTERN" },
+	{ 0x79080000, "3DSTATE_LINE_STIPPLE" },
+	{ 0x790a0000, "3DSTATE_AA_LINE_PARAMETERS" },
+	{ 0x790d0000, "3DSTATE_MULTISAMPLE" },
+	{ 0x790e0000, "3DSTATE_STENCIL_BUFFER" },
+	{ 0x790f0000, "3DSTATE_HIER_DEPTH_BUFFER" },
+	{ 0x79100000, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7a000000, "PIPE_CONTROL" },
+	{ 0x7b000000, "3DPRIMITIVE" },
+};
+
+static uint32_t
+opcode_key(uint32_t cmd)
+{
+	switch (cmd >> 29) {
+	case 0x0: return cmd & 0xff800000;
+	case 0x2: return cmd & 0xffc00000;
+	case 0x3: return cmd & 0xffff0000;
+	default: return cmd & 0xe0000000;
+	}
+}
+
+static const char *
+opcode_name(uint32_t key)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(opcode_names); i++)
+		if (opcode_names[i].key == key)
+			return opcode_names[i].name;
+
+	return NULL;
+}
+
+/* Number of presumed relocations carried by a packet. */
+static unsigned int
+opcode_relocs(uint32_t key, const uint32_t *cmd, unsigned int len)
+{
+	switch (key) {
+	case 0x10000000: /* MI_STORE_DWORD_IMM */
+	case 0x12000000: /* MI_STORE_REGISTER_MEM */
+	case 0x18800000: /* MI_BATCH_BUFFER_START */
+	case 0x50000000: /* COLOR_BLT */
+	case 0x54000000: /* XY_COLOR_BLT */
+	case 0x79050000: /* 3DSTATE_DEPTH_BUFFER */
+	case 0x790e0000: /* 3DSTATE_STENCIL_BUFFER */
+	case 0x790f0000: /* 3DSTATE_HIER_DEPTH_BUFFER */
+		return 1;
+	case 0x50c00000: /* SRC_COPY_BLT */
+	case 0x54c00000: /* XY_SRC_COPY_BLT */
+	case 0x780a0000: /* 3DSTATE_INDEX_BUFFER */
+		return 2;
+	case 0x61010000: /* STATE_BASE_ADDRESS */
+		return len > 1 ? (len - 1) / 2 : 0;
+	case 0x78080000: /* 3DSTATE_VERTEX_BUFFERS */
+		return (len - 1) / 4 * 2;
+	case 0x7a000000: /* PIPE_CONTROL with a post-sync write */
+		return len > 2 && (cmd[1] & (3 << 14)) ? 1 : 0;
+	default:
+		return 0;
+	}
+}
+
+static int
+opcode_is_state(uint32_t key)
+{
+	/* 3D state: the non-pipelined 0x61xx and pipelined 0x78/0x79xx */
+	return key == 0x61010000 ||
+		(key >> 24) == 0x78 || (key >> 24) == 0x79;
+}
+
+static struct opcode_stats *
+stats_lookup(uint32_t key)
+{
+	unsigned int h;
+
+	switch (key >> 29) {
+	case 0x0: h = STATS_MI_BASE + (key >> 23 & 0x3f); break;
+	case 0x2: h = STATS_2D_BASE + (key >> 22 & 0x7f); break;
+	case 0x3: h = STATS_3D_BASE + (key >> 16 & 0x1fff); break;
+	default: h = STATS_OTHER_BASE + (key >> 29); break;
+	}
+
+	if (!stats.table[h].used) {
+		stats.table[h].used = 1;
+		stats.table[h].key = key;
+		stats.nopcodes++;
+	}
+
+	return &stats.table[h];
+}
+
+static uint64_t
+hash_dwords(const uint32_t *data, unsigned int len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		h ^= *data++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static void
+stats_accumulate(const uint32_t *data, unsigned int count)
+{
+	unsigned int pos = 0;
+
+	while (pos < count) {
+		struct opcode_stats *op;
+		unsigned int len;
+		uint32_t key;
+
+		key = opcode_key(data[pos]);
+		len = cmd_length(data[pos]);
+		if (pos + len > count)
+			len = count - pos;
+
+		op = stats_lookup(key);
+		op->count++;
+		op->dwords += len;
+
+		stats.packets++;
+		stats.dwords += len;
+		stats.relocs += opcode_relocs(key, data + pos, len);
+
+		if (opcode_is_state(key)) {
+			/* Hardware state is sticky, so re-emitting the very
+			 * same packet as last time is wasted work.
+			 */
+			uint64_t h = hash_dwords(data + pos, len);
+
+			stats.state_packets++;
+			if (op->count > 1 && op->last_len == len &&
+			    op->last_hash == h) {
+				op->redundant++;
+				stats.redundant++;
+			}
+			op->last_hash = h;
+			op->last_len = len;
+		} else if (key == 0x7b000000) {
+			stats.primitives++;
+		} else if (data[pos] >> 29 == 0x2) {
+			stats.blits++;
+		}
+
+		pos += len;
+	}
+}
+
+static int
+stats_compare(const void *a, const void *b)
+{
+	const struct opcode_stats *x = *(const struct opcode_stats **)a;
+	const struct opcode_stats *y = *(const struct opcode_stats **)b;
+
+	if (x->dwords != y->dwords)
+		return x->dwords < y->dwords ? 1 : -1;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static void
+stats_print(const char *filename)
+{
+	struct opcode_stats **sorted;
+	unsigned int i, n = 0;
+
+	sorted = malloc(stats.nopcodes * sizeof(*sorted));
+	if (sorted == NULL && stats.nopcodes) {
+		fprintf (stderr, "Out of memory.\n");
+		exit (1);
+	}
+
+	for (i = 0; i < STATS_TABLE_SIZE; i++)
+		if (stats.table[i].used)
+			sorted[n++] = &stats.table[i];
+	qsort(sorted, n, sizeof(*sorted), stats_compare);
+
+	printf("%s:\n", filename);
+	printf("%-34s %10s %12s %6s %10s\n",
+	       "opcode", "count", "dwords", "%", "redundant");
+	for (i = 0; i < n; i++) {
+		const char *name = opcode_name(sorted[i]->key);
+		char buf[16];
+
+		if (name == NULL) {
+			snprintf(buf, sizeof(buf), "0x%08x", sorted[i]->key);
+			name = buf;
+		}
+
+		printf("%-34s %10llu %12llu %6.2f %10llu\n", name,
+		       (unsigned long long)sorted[i]->count,
+		       (unsigned long long)sorted[i]->dwords,
+		       100. * sorted[i]->dwords / stats.dwords,
+		       (unsigned long long)sorted[i]->redundant);
+	}
+
+	printf("\n");
+	printf("packets:            %llu (%llu dwords)\n",
+	       (unsigned long long)stats.packets,
+	       (unsigned long long)stats.dwords);
+	printf("primitives:         %llu\n",
+	       (unsigned long long)stats.primitives);
+	printf("blits:              %llu\n",
+	       (unsigned long long)stats.blits);
+	printf("state packets:      %llu (%.1f per primitive)\n",
+	       (unsigned long long)stats.state_packets,
+	       stats.primitives ?
+	       (double)stats.state_packets / stats.primitives : 0.);
+	printf("redundant state:    %llu (%.1f%%)\n",
+	       (unsigned long long)stats.redundant,
+	       stats.state_packets ?
+	       100. * stats.redundant / stats.state_packets : 0.);
+	printf("relocations:        %llu (%.2f per 1k dwords)\n",
+	       (unsigned long long)stats.relocs,
+	       stats.dwords ? 1000. * stats.relocs / stats.dwords : 0.);
+
+	free(sorted);
+	memset(&stats, 0, sizeof(stats));
+}
+
+static void
+decode(uint32_t *data, uint32_t offset, int count)
+{
+	if (stats_mode) {
+		stats_accumulate(data, count);
+	} else {
+		drm_intel_decode_set_batch_pointer(ctx, data, offset, count);
+		drm_intel_decode(ctx);
+	}
+	bytes_decoded += count * 4;
+}
+
+/* @head holds bytes already consumed from @fd, at most a window's worth */
+static void
+read_bin_stream(int fd, const void *head, size_t head_len)
+{
+	uint32_t *buf;
+	uint32_t offset = 0;
+	size_t fill = head_len;
+	ssize_t ret;
+	int eof = 0;
+
+	buf = malloc(RING_DWORDS * 4);
+	if (buf == NULL) {
+		fprintf (stderr, "Out of memory.\n");
+		exit (1);
+	}
+	memcpy(buf, head, head_len);
+
+	while (!eof) {
+		unsigned int count, pos, len;
+
+		ret = read (fd, (char *)buf + fill, RING_DWORDS * 4 - fill);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf (stderr, "Read failed: %s\n", strerror (errno));
+			break;
+		}
+		if (ret == 0)
+			eof = 1;
+		fill += ret;
+
+		if (!eof && fill < RING_DWORDS * 4)
+			continue;
+
+		/* Only hand complete packets to the decoder, the tail of a
+		 * packet crossing the window is carried over to the next
+		 * round.
+		 */
+		count = fill / 4;
+		pos = 0;
+		if (eof) {
+			pos = count;
+		} else {
+			while (pos < count) {
+				len = cmd_length(buf[pos]);
+				if (pos + len > count)
+					break;
+				pos += len;
+			}
+			/* a single packet larger than the window */
+			if (pos == 0)
+				pos = count;
+		}
+
+		if (pos)
+			decode(buf, offset, pos);
+
+		offset += pos * 4;
+		memmove(buf, buf + pos, fill - pos * 4);
+		fill -= pos * 4;
+	}
+
+	free(buf);
+}
 
 static void
 read_bin_file(const char * filename)
 {
-	uint32_t buf[16384];
-	int fd, offset, ret;
+	struct stat st;
+	void *map;
+	int fd;
 
 	if (!strcmp(filename, "-"))
 		fd = fileno(stdin);
@@ -57,19 +484,69 @@ read_bin_file(const char * filename)
 
 	drm_intel_decode_set_dump_past_end(ctx, 1);
 
-	offset = 0;
-	while ((ret = read (fd, buf, sizeof(buf))) > 0) {
-		drm_intel_decode_set_batch_pointer(ctx, buf, offset, ret/4);
-		drm_intel_decode(ctx);
-		offset += ret;
+	/* Regular files are decoded in one go straight from the page cache */
+	if (!stream && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size >= 4) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			decode(map, 0, st.st_size / 4);
+			munmap(map, st.st_size);
+			close (fd);
+			return;
+		}
 	}
+
+	read_bin_stream(fd, NULL, 0);
 	close (fd);
 }
 
+static int
+parse_hex(const char **p, uint32_t *out)
+{
+	const char *s = *p;
+	uint32_t v = 0;
+	int n;
+
+	for (n = 0; n < 8; n++, s++) {
+		if (*s >= '0' && *s <= '9')
+			v = v << 4 | (*s - '0');
+		else if (*s >= 'a' && *s <= 'f')
+			v = v << 4 | (*s - 'a' + 10);
+		else if (*s >= 'A' && *s <= 'F')
+			v = v << 4 | (*s - 'A' + 10);
+		else
+			break;
+	}
+
+	*p = s;
+	*out = v;
+	return n != 0;
+}
+
+/* Equivalent to sscanf(line, "%08x : %08x", ...) without its overhead */
+static int
+parse_line(const char *line, uint32_t *offset, uint32_t *value)
+{
+	while (*line == ' ' || *line == '\t')
+		line++;
+	if (!parse_hex(&line, offset))
+		return 0;
+	while (*line == ' ' || *line == '\t')
+		line++;
+	if (*line++ != ':')
+		return 1;
+	while (*line == ' ' || *line == '\t')
+		line++;
+	if (!parse_hex(&line, value))
+		return 1;
+
+	return 2;
+}
+
 static void
-read_data_file(const char * filename)
+read_data_stream(FILE *file)
 {
-    FILE *file;
     uint32_t *data = NULL;
     int data_size = 0, count = 0, line_number = 0, matched;
     char *line = NULL;
@@ -77,21 +554,10 @@ read_data_file(const char * filename)
     uint32_t offset, value;
     uint32_t gtt_offset = 0;
 
-	if (!strcmp(filename, "-"))
-		file = stdin;
-	else
-		file = fopen (filename, "r");
-
-    if (file == NULL) {
-	fprintf (stderr, "Failed to open %s: %s\n",
-		 filename, strerror (errno));
-	exit (1);
-    }
-
     while (getline (&line, &line_size, file) > 0) {
 	line_number++;
 
-	matched = sscanf (line, "%08x : %08x", &offset, &value);
+	matched = parse_line (line, &offset, &value);
 	if (matched != 2) {
 	    printf("ignoring line %s", line);
 
@@ -112,39 +578,128 @@ read_data_file(const char * filename)
 	data[count-1] = value;
     }
 
-    if (count) {
-	drm_intel_decode_set_batch_pointer(ctx, data, gtt_offset, count);
-	drm_intel_decode(ctx);
-    }
+    if (count)
+	decode(data, gtt_offset, count);
 
     free (data);
     free (line);
-
-    fclose (file);
 }
 
 static void
-read_autodetect_file(const char * filename)
+read_data_file(const char * filename)
 {
-	int binary = 0, c;
 	FILE *file;
 
-	file = fopen (filename, "r");
+	if (!strcmp(filename, "-"))
+		file = stdin;
+	else
+		file = fopen (filename, "r");
+
 	if (file == NULL) {
 		fprintf (stderr, "Failed to open %s: %s\n",
 			 filename, strerror (errno));
 		exit (1);
 	}
 
-	while ((c = fgetc(file)) != EOF) {
-		/* totally lazy binary detector */
-		if (c < 10) {
-			binary = 1;
+	read_data_stream(file);
+	fclose (file);
+}
+
+/* totally lazy binary detector, the head of the file is enough */
+static int
+looks_binary(const unsigned char *buf, ssize_t len)
+{
+	ssize_t i;
+
+	for (i = 0; i < len; i++)
+		if (buf[i] < 10)
+			return 1;
+
+	return 0;
+}
+
+/* Replays the bytes sniffed off stdin before reading on from it */
+struct stdin_cookie {
+	const unsigned char *head;
+	size_t len, pos;
+};
+
+static ssize_t
+stdin_cookie_read(void *data, char *buf, size_t size)
+{
+	struct stdin_cookie *cookie = data;
+	size_t n;
+
+	if (cookie->pos == cookie->len)
+		return read (fileno(stdin), buf, size);
+
+	n = cookie->len - cookie->pos;
+	if (n > size)
+		n = size;
+	memcpy(buf, cookie->head + cookie->pos, n);
+	cookie->pos += n;
+
+	return n;
+}
+
+/*
+ * stdin can't be rewound after sniffing its head, so hand the head to
+ * whichever reader it picks. Binary input is streamed.
+ */
+static void
+read_autodetect_stdin(void)
+{
+	cookie_io_functions_t io = { .read = stdin_cookie_read };
+	struct stdin_cookie cookie = { 0 };
+	unsigned char buf[4096];
+	ssize_t len = 0, ret;
+	FILE *file;
+
+	while (len < (ssize_t)sizeof(buf)) {
+		ret = read (fileno(stdin), buf + len, sizeof(buf) - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
 			break;
-		}
+		len += ret;
+	}
+
+	if (looks_binary(buf, len)) {
+		drm_intel_decode_set_dump_past_end(ctx, 1);
+		read_bin_stream(fileno(stdin), buf, len);
+		return;
+	}
+
+	cookie.head = buf;
+	cookie.len = len;
+	file = fopencookie(&cookie, "r", io);
+	if (file == NULL) {
+		fprintf (stderr, "Failed to read stdin: %s\n",
+			 strerror (errno));
+		exit (1);
+	}
+	read_data_stream(file);
+	fclose (file);
+}
+
+static void
+read_autodetect_file(const char * filename)
+{
+	unsigned char buf[4096];
+	int binary, fd;
+	ssize_t len;
+
+	fd = open (filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf (stderr, "Failed to open %s: %s\n",
+			 filename, strerror (errno));
+		exit (1);
 	}
 
-	fclose(file);
+	len = read (fd, buf, sizeof(buf));
+	binary = looks_binary(buf, len);
+
+	close (fd);
 
 	if (binary == 1)
 		read_bin_file(filename);
@@ -153,6 +708,35 @@ read_autodetect_file(const char * filename)
 
 }
 
+static void
+report_timing(const char *filename, struct timeval *start)
+{
+	struct timeval end;
+	double elapsed;
+
+	gettimeofday(&end, NULL);
+	elapsed = (end.tv_sec - start->tv_sec) +
+		(end.tv_usec - start->tv_usec) / 1e6;
+
+	fprintf(stderr, "%s: %.1f MiB in %.3fs, %.1f MiB/s\n",
+		filename, bytes_decoded / (1024. * 1024.), elapsed,
+		elapsed > 0 ? bytes_decoded / elapsed / (1024. * 1024.) : 0);
+}
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage: %s [options] <file|->...\n"
+		"  -d, --devid=ID   decode for the given PCI device id\n"
+		"  -a, --ascii      input is an ASCII hex dump\n"
+		"  -b, --binary     input is a binary dump\n"
+		"  -s, --stream     read files in windows instead of mmapping them\n"
+		"  -t, --timing     print the size and decode rate of each input\n"
+		"  -S, --stats      print per opcode statistics instead of decoding\n",
+		progname);
+}
+
 
 int
 main (int argc, char *argv[])
@@ -165,10 +749,14 @@ main (int argc, char *argv[])
 	static struct option long_options[] = {
 		{"devid", 1, 0, 'd'},
 		{"ascii", 0, 0, 'a'},
-		{"binary", 0, 0, 'b'}
+		{"binary", 0, 0, 'b'},
+		{"stream", 0, 0, 's'},
+		{"timing", 0, 0, 't'},
+		{"stats", 0, 0, 'S'},
+		{0, 0, 0, 0}
 	};
 
-	while((c = getopt_long(argc, argv, "ab",
+	while((c = getopt_long(argc, argv, "d:abstS",
 			       long_options, &option_index)) != -1) {
 		switch(c) {
 		case 'd':
@@ -180,9 +768,18 @@ main (int argc, char *argv[])
 		case 'a':
 			binary = 0;
 			break;
-		default:
-			printf("unkown command options\n");
+		case 's':
+			stream = 1;
+			break;
+		case 't':
+			timing = 1;
 			break;
+		case 'S':
+			stats_mode = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
 		}
 	}
 
@@ -190,21 +787,29 @@ main (int argc, char *argv[])
 
 	if (optind == argc) {
 		fprintf(stderr, "no input file given\n");
+		usage(argv[0]);
 		exit(-1);
 	}
 
 	for (i = optind; i < argc; i++) {
-		/* For stdin input, let's read as data file */
-		if (!strcmp(argv[i], "-")) {
-			read_data_file(argv[i]);
-			continue;
-		}
-		if (binary == 1)
+		struct timeval start;
+
+		bytes_decoded = 0;
+		gettimeofday(&start, NULL);
+
+		if (!strcmp(argv[i], "-") && binary == -1)
+			read_autodetect_stdin();
+		else if (binary == 1)
 			read_bin_file(argv[i]);
 		else if (binary == 0)
 			read_data_file(argv[i]);
 		else
 			read_autodetect_file(argv[i]);
+
+		if (stats_mode)
+			stats_print(argv[i]);
+		if (timing)
+			report_timing(argv[i], &start);
 	}
 
 	return 0;
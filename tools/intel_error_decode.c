@@ -56,10 +56,15 @@
 #include "intel_gpu_tools.h"
 #include "instdone.h"
 
+/*
+ * The error state prints INSTDONE (the first INSTDONE register of the
+ * generation) and, from gen4 on, INSTDONE1 (INST_DONE_1) on separate lines.
+ */
 static void
-print_instdone (uint32_t devid, unsigned int instdone, unsigned int instdone1)
+print_instdone (uint32_t devid, int instdone1, unsigned int value)
 {
-    int i;
+    uint32_t values[MAX_INSTDONE_REGS];
+    int i, index;
     static int once;
 
     if (!once) {
@@ -67,18 +72,16 @@ print_instdone (uint32_t devid, unsigned int instdone, unsigned int instdone1)
 	once = 1;
     }
 
-    for (i = 0; i < num_instdone_bits; i++) {
-	int busy = 0;
+    index = instdone1 ? instdone_reg_index(INST_DONE_1) : 0;
+    if (index < 0 || index >= num_instdone_regs)
+	return;
 
-	if (instdone_bits[i].reg == INST_DONE_1) {
-	    if (!(instdone1 & instdone_bits[i].bit))
-		busy = 1;
-	} else {
-	    if (!(instdone & instdone_bits[i].bit))
-		busy = 1;
-	}
+    memset(values, 0xff, sizeof(values));
+    values[index] = value;
 
-	if (busy)
+    for (i = 0; i < num_instdone_bits; i++) {
+	if (instdone_bits[i].reg_index == index &&
+	    instdone_busy(&instdone_bits[i], values))
 	    printf("    busy: %s\n", instdone_bits[i].name);
     }
 }
@@ -383,11 +386,11 @@ read_data_file (FILE *file)
 
 	    matched = sscanf (line, "  INSTDONE: 0x%08x\n", &reg);
 	    if (matched == 1)
-		print_instdone (devid, reg, -1);
+		print_instdone (devid, 0, reg);
 
 	    matched = sscanf (line, "  INSTDONE1: 0x%08x\n", &reg);
 	    if (matched == 1)
-		print_instdone (devid, -1, reg);
+		print_instdone (devid, 1, reg);
 
 	    matched = sscanf (line, "  fence[%i] = %Lx\n", &reg, &fence); 
 	    if (matched == 2)
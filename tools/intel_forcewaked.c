@@ -23,21 +23,49 @@
  * Authors:
  *    Ben Widawsky <ben@bwidawsk.net>
  *
+ * Without -s the daemon holds the user forcewake reference for as long as it
+ * runs. With -s it listens on a unix socket instead and only keeps the GT
+ * awake while at least one client holds a reference, dropping forcewake
+ * once the last reference has been idle for the configured timeout.
+ *
+ * Clients speak a line based protocol:
+ *	get	take a forcewake reference, answered with "ok"
+ *	put	drop a reference, answered with "ok"
+ *	stats	answered with a single line of residency accounting
+ * References still held when a client disconnects are dropped.
  */
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "intel_gpu_tools.h"
 
+#define MAX_CLIENTS		64
+#define DEFAULT_IDLE_MS		100
+#define TICK_MS			1000
+
+/* The RC6 residency counters tick in units of 1.28us */
+#define RC6_TICK_NS		1280
+
 bool daemonized;
 
+static volatile sig_atomic_t quit;
+
 #define INFO_PRINT(...) \
 	do { \
 		if (daemonized) \
@@ -46,12 +74,57 @@ bool daemonized;
 			fprintf(stdout, ##__VA_ARGS__); \
 	} while(0)
 
+static const uint32_t rc6_regs[] = {
+	RC6_RESIDENCY_TIME,
+	RC6p_RESIDENCY_TIME,
+	RC6pp_RESIDENCY_TIME,
+};
+
+static const char *rc6_names[] = { "rc6", "rc6p", "rc6pp" };
+
+static struct {
+	bool has_rc6;
+	bool mock;
+	uint64_t start;
+	uint64_t awake;		/* ns spent with forcewake held */
+	uint64_t awake_since;	/* 0 while forcewake is dropped */
+	uint64_t mock_last;
+	unsigned grants;
+	uint32_t last[ARRAY_SIZE(rc6_regs)];
+	uint64_t ticks[ARRAY_SIZE(rc6_regs)];
+} res;
+
+struct client {
+	int fd;
+	unsigned refs;
+	size_t len;
+	char buf[64];
+};
+
+static struct client clients[MAX_CLIENTS];
+static int num_clients;
+static unsigned total_refs;
+
 static void
 help(char *prog) {
 	printf("%s Prevents the GT from sleeping.\n\n", prog);
 	printf("usage: %s [options] \n\n", prog);
 	printf("Options: \n");
 	printf("    -b        Run in background/daemon mode\n");
+	printf("    -s path   Grant forcewake on demand to clients of a unix socket\n");
+	printf("    -t ms     Idle timeout before forcewake is dropped (default %d)\n",
+	       DEFAULT_IDLE_MS);
+	printf("    -f file   Mock mode: run on top of a register dump\n");
+	printf("    -d devid  Device id to assume in mock mode\n");
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 static int
@@ -60,44 +133,427 @@ is_alive(void) {
 	return (intel_register_read(0x2358) != 0);
 }
 
-int main(int argc, char *argv[])
+/*
+ * A register dump does not count by itself, so in mock mode pretend the GT
+ * drops into RC6 as soon as forcewake is released.
+ */
+static void
+mock_advance(uint64_t now)
 {
-	int ret;
+	uint64_t ticks;
 
-	if (argc > 2 || (argc == 2 && !strncmp(argv[1], "-h", 2))) {
-		help(argv[1]);
-		exit(0);
+	if (!res.awake_since) {
+		ticks = (now - res.mock_last) / RC6_TICK_NS;
+		intel_register_write(RC6_RESIDENCY_TIME,
+				     intel_register_read(RC6_RESIDENCY_TIME) + ticks);
 	}
+	res.mock_last = now - (now - res.mock_last) % RC6_TICK_NS;
+}
 
-	if (argc == 2 && (!strncmp(argv[1], "-b", 2)))
-		daemonized = true;
+/* Accumulate the 32 bit residency counters, which wrap every ~90 minutes */
+static void
+sample_residency(void)
+{
+	unsigned i;
+	uint32_t val;
 
-	if (daemonized) {
-		assert(daemon(0, 0) == 0);
-		openlog(argv[0], LOG_CONS | LOG_PID, LOG_USER);
-		INFO_PRINT("started daemon");
+	if (!res.has_rc6)
+		return;
+
+	if (res.mock)
+		mock_advance(now_ns());
+
+	for (i = 0; i < ARRAY_SIZE(rc6_regs); i++) {
+		val = intel_register_read(rc6_regs[i]);
+		res.ticks[i] += (uint32_t)(val - res.last[i]);
+		res.last[i] = val;
 	}
+}
 
-	ret = intel_register_access_init(intel_get_pci_device(), 1);
-	if (ret) {
-		INFO_PRINT("Couldn't init register access\n");
-		exit(1);
+static void
+residency_init(uint32_t devid)
+{
+	unsigned i;
+
+	res.has_rc6 = IS_GEN6(devid) || IS_GEN7(devid);
+	res.start = res.mock_last = now_ns();
+	if (!res.has_rc6)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(rc6_regs); i++)
+		res.last[i] = intel_register_read(rc6_regs[i]);
+}
+
+static uint64_t
+awake_ns(uint64_t now)
+{
+	return res.awake + (res.awake_since ? now - res.awake_since : 0);
+}
+
+static int
+format_stats(char *buf, size_t size)
+{
+	uint64_t now = now_ns();
+	uint64_t total = 0;
+	int len;
+	unsigned i;
+
+	sample_residency();
+
+	len = snprintf(buf, size, "elapsed_ms=%llu awake_ms=%llu grants=%u",
+		       (unsigned long long)(now - res.start) / 1000000,
+		       (unsigned long long)awake_ns(now) / 1000000,
+		       res.grants);
+	for (i = 0; i < ARRAY_SIZE(rc6_regs) && res.has_rc6; i++) {
+		uint64_t ms = res.ticks[i] * RC6_TICK_NS / 1000000;
+
+		total += ms;
+		len += snprintf(buf + len, size - len, " %s_ms=%llu",
+				rc6_names[i], (unsigned long long)ms);
+	}
+	if (res.has_rc6)
+		len += snprintf(buf + len, size - len, " rc6_total_ms=%llu",
+				(unsigned long long)total);
+
+	return len;
+}
+
+static void
+print_stats(void)
+{
+	char buf[256];
+
+	format_stats(buf, sizeof(buf));
+	INFO_PRINT("%s\n", buf);
+}
+
+static int
+forcewake_get(void)
+{
+	int ret;
+
+	if (res.awake_since)
+		return 0;
+
+	sample_residency();
+	ret = intel_register_forcewake_get();
+	if (ret)
+		return ret;
+
+	res.awake_since = now_ns();
+	res.grants++;
+	return 0;
+}
+
+static void
+forcewake_put(void)
+{
+	uint64_t now;
+
+	if (!res.awake_since)
+		return;
+
+	sample_residency();
+	intel_register_forcewake_put();
+	now = now_ns();
+	res.awake += now - res.awake_since;
+	res.awake_since = 0;
+}
+
+static void
+sig_handler(int sig)
+{
+	quit = 1;
+}
+
+static int
+open_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		errx(1, "socket path too long: %s", path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		err(1, "socket");
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, 8))
+		err(1, "couldn't listen on %s", path);
+
+	return fd;
+}
+
+static void
+client_reply(struct client *c, const char *msg)
+{
+	send(c->fd, msg, strlen(msg), MSG_NOSIGNAL);
+}
+
+static void
+client_drop(int idx)
+{
+	struct client *c = &clients[idx];
+
+	total_refs -= c->refs;
+	close(c->fd);
+	clients[idx] = clients[--num_clients];
+}
+
+static void
+client_command(struct client *c, char *cmd)
+{
+	char buf[256];
+	int len;
+
+	if (!strcmp(cmd, "get")) {
+		if (forcewake_get()) {
+			client_reply(c, "error\n");
+			return;
+		}
+		c->refs++;
+		total_refs++;
+		client_reply(c, "ok\n");
+	} else if (!strcmp(cmd, "put")) {
+		if (!c->refs) {
+			client_reply(c, "error\n");
+			return;
+		}
+		c->refs--;
+		total_refs--;
+		client_reply(c, "ok\n");
+	} else if (!strcmp(cmd, "stats")) {
+		len = format_stats(buf, sizeof(buf) - 1);
+		if (len > (int)sizeof(buf) - 2)
+			len = sizeof(buf) - 2;
+		buf[len++] = '\n';
+		buf[len] = 0;
+		client_reply(c, buf);
 	} else {
-		INFO_PRINT("Forcewake locked\n");
+		client_reply(c, "error\n");
+	}
+}
+
+/* Returns false once the client went away or misbehaved */
+static bool
+client_read(struct client *c)
+{
+	ssize_t n;
+	char *nl;
+
+	n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+	if (n <= 0)
+		return false;
+	c->len += n;
+	c->buf[c->len] = 0;
+
+	while ((nl = strchr(c->buf, '\n'))) {
+		*nl = 0;
+		if (nl > c->buf && nl[-1] == '\r')
+			nl[-1] = 0;
+		client_command(c, c->buf);
+		c->len -= nl + 1 - c->buf;
+		memmove(c->buf, nl + 1, c->len + 1);
 	}
-	while(1) {
-		if (!is_alive()) {
+
+	/* A line that doesn't fit the buffer can't be a valid command */
+	return c->len < sizeof(c->buf) - 1;
+}
+
+static void
+serve(int listen_fd, int idle_ms)
+{
+	struct pollfd pfd[MAX_CLIENTS + 1];
+	uint64_t idle_deadline = 0, next_tick, now;
+	int i, n, timeout;
+
+	next_tick = now_ns() + TICK_MS * 1000000ULL;
+
+	while (!quit) {
+		now = now_ns();
+		if (res.awake_since && !total_refs && !idle_deadline)
+			idle_deadline = now + idle_ms * 1000000ULL;
+		else if (total_refs)
+			idle_deadline = 0;
+
+		if (idle_deadline && now >= idle_deadline) {
+			forcewake_put();
+			idle_deadline = 0;
+		}
+		if (now >= next_tick) {
+			if (res.awake_since && !res.mock && !is_alive())
+				INFO_PRINT("gpu reset?\n");
+			sample_residency();
+			next_tick = now + TICK_MS * 1000000ULL;
+		}
+
+		timeout = (next_tick - now) / 1000000 + 1;
+		if (idle_deadline && (int)((idle_deadline - now) / 1000000 + 1) < timeout)
+			timeout = (idle_deadline - now) / 1000000 + 1;
+
+		pfd[0].fd = listen_fd;
+		pfd[0].events = num_clients < MAX_CLIENTS ? POLLIN : 0;
+		for (i = 0; i < num_clients; i++) {
+			pfd[i + 1].fd = clients[i].fd;
+			pfd[i + 1].events = POLLIN;
+		}
+
+		n = poll(pfd, num_clients + 1, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+
+		/* Walk backwards so that dropping a client doesn't skip one */
+		for (i = num_clients - 1; i >= 0; i--) {
+			if (!pfd[i + 1].revents)
+				continue;
+			if (!client_read(&clients[i]))
+				client_drop(i);
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+			if (fd >= 0) {
+				memset(&clients[num_clients], 0, sizeof(clients[0]));
+				clients[num_clients++].fd = fd;
+			}
+		}
+	}
+
+	while (num_clients)
+		client_drop(num_clients - 1);
+}
+
+static void
+hold(void)
+{
+	int ret;
+
+	while (!quit) {
+		if (!res.mock && !is_alive()) {
 			INFO_PRINT("gpu reset? restarting daemon\n");
+			forcewake_put();
 			intel_register_access_fini();
-			ret = intel_register_access_init(intel_get_pci_device(), 1);
+			ret = intel_register_access_init(intel_get_pci_device(), 0);
 			if (ret)
 				INFO_PRINT("Reg access init fail\n");
+			else
+				forcewake_get();
 		}
 		sleep(1);
+		sample_residency();
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char *socket_path = NULL, *mock_file = NULL;
+	int idle_ms = DEFAULT_IDLE_MS;
+	int listen_fd = -1;
+	uint32_t devid = 0;
+	int ret, opt;
+
+	while ((opt = getopt(argc, argv, "bs:t:f:d:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			daemonized = true;
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		case 't':
+			idle_ms = atoi(optarg);
+			if (idle_ms < 0)
+				errx(1, "invalid idle timeout: %s", optarg);
+			break;
+		case 'f':
+			mock_file = optarg;
+			break;
+		case 'd':
+			devid = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			help(argv[0]);
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (devid && !mock_file)
+		errx(1, "-d only applies to a register dump given with -f");
+
+	/* without a device id there are no residency counters to mock */
+	if (mock_file && !devid) {
+		size_t size;
+		void *image = intel_load_dump(mock_file, &size, &devid);
+
+		munmap(image, size);
+		if (!devid)
+			errx(1, "%s doesn't record a device id, use -d",
+			     mock_file);
+	}
+
+	/* Bind before daemon() changes the working directory */
+	if (socket_path)
+		listen_fd = open_socket(socket_path);
+
+	if (daemonized) {
+		assert(daemon(0, 0) == 0);
+		openlog(argv[0], LOG_CONS | LOG_PID, LOG_USER);
+		INFO_PRINT("started daemon");
+	}
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	/*
+	 * The residency counters live outside the safe register map, and
+	 * the timestamp and those counters are all that is ever touched.
+	 */
+	if (mock_file) {
+		res.mock = true;
+		ret = intel_register_access_init_file(mock_file, devid, 0);
+	} else {
+		devid = intel_get_pci_device()->device_id;
+		ret = intel_register_access_init(intel_get_pci_device(), 0);
 	}
+	if (ret) {
+		INFO_PRINT("Couldn't init register access\n");
+		exit(1);
+	}
+
+	residency_init(devid);
+
+	/* register access init already took the forcewake reference */
+	res.awake_since = now_ns();
+	res.grants++;
+	INFO_PRINT("Forcewake locked\n");
+
+	if (socket_path)
+		serve(listen_fd, idle_ms);
+	else
+		hold();
+
+	forcewake_put();
+	print_stats();
 	intel_register_access_fini();
 	INFO_PRINT("Forcewake unlock\n");
 
+	if (socket_path) {
+		close(listen_fd);
+		unlink(socket_path);
+	}
+
 	if (daemonized) {
 		INFO_PRINT("finished\n");
 		closelog();
@@ -59,7 +59,7 @@ struct top_bit {
 } top_bits[MAX_NUM_TOP_BITS];
 struct top_bit *top_bits_sorted[MAX_NUM_TOP_BITS];
 
-static uint32_t instdone, instdone1;
+static struct instdone_counters instdone_counters;
 
 static const char *bars[] = {
 	" ",
@@ -137,20 +137,6 @@ top_bits_sort(const void *a, const void *b)
 		return -1;
 }
 
-static void
-update_idle_bit(struct top_bit *top_bit)
-{
-	uint32_t reg_val;
-
-	if (top_bit->bit->reg == INST_DONE_1)
-		reg_val = instdone1;
-	else
-		reg_val = instdone;
-
-	if ((reg_val & top_bit->bit->bit) == 0)
-		top_bit->count++;
-}
-
 static void
 print_clock(const char *name, int clock) {
 	if (clock == -1)
@@ -553,17 +539,15 @@ int main(int argc, char **argv)
 		ring_reset(&bsd6_ring);
 		ring_reset(&blt_ring);
 
+		instdone_counters_reset(&instdone_counters);
+
 		for (i = 0; i < samples_per_sec; i++) {
+			uint32_t instdone[MAX_INSTDONE_REGS];
 			long long interval;
 			ti = gettime();
-			if (IS_965(devid)) {
-				instdone = INREG(INST_DONE_I965);
-				instdone1 = INREG(INST_DONE_1);
-			} else
-				instdone = INREG(INST_DONE);
-
-			for (j = 0; j < num_instdone_bits; j++)
-				update_idle_bit(&top_bits[j]);
+			for (j = 0; j < num_instdone_regs; j++)
+				instdone[j] = INREG(instdone_regs[j].reg);
+			instdone_counters_sample(&instdone_counters, instdone);
 
 			ring_sample(&render_ring);
 			ring_sample(&bsd_ring);
@@ -596,6 +580,11 @@ int main(int argc, char **argv)
 			}
 		}
 
+		instdone_counters_flush(&instdone_counters);
+		for (i = 0; i < num_instdone_bits; i++)
+			top_bits[i].count = instdone_count(&instdone_counters,
+							   top_bits[i].bit);
+
 		qsort(top_bits_sorted, num_instdone_bits,
 		      sizeof(struct top_bit *), top_bits_sort);
 
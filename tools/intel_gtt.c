@@ -31,20 +31,280 @@
 #include <stdarg.h>
 #include <pciaccess.h>
 #include <unistd.h>
+#include <err.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "intel_gpu_tools.h"
 
-#define INGTT(offset) (*(volatile uint32_t *)(gtt + (offset) / (KB(4) / 4)))
-
 #define KB(x) ((x) * 1024)
 #define MB(x) ((x) * 1024 * 1024)
 
-int main(int argc, char **argv)
+enum run_kind {
+	RUN_SINGLE,
+	RUN_LINEAR,
+	RUN_CONSTANT,
+};
+
+static const char *run_kind_name[] = {
+	[RUN_SINGLE] = "single",
+	[RUN_LINEAR] = "linear",
+	[RUN_CONSTANT] = "constant",
+};
+
+/* A run of PTEs [start, end), in units of 4KiB pages */
+struct run {
+	uint32_t start;
+	uint32_t end;
+	enum run_kind kind;
+	uint32_t base_pte;
+};
+
+static int machine_readable;
+
+static void print_run(const struct run *run)
+{
+	uint32_t start = run->start * KB(4);
+	uint32_t last = (run->end - 1) * KB(4);
+
+	if (machine_readable) {
+		printf("0x%08x 0x%08x %s 0x%08x\n",
+		       start, run->end * KB(4),
+		       run_kind_name[run->kind], run->base_pte);
+		return;
+	}
+
+	switch (run->kind) {
+	case RUN_LINEAR:
+		printf("0x%08x - 0x%08x: linear from "
+		       "0x%08x to 0x%08x\n",
+		       start, last,
+		       run->base_pte, run->base_pte + (last - start));
+		break;
+	case RUN_CONSTANT:
+		printf("0x%08x - 0x%08x: constant 0x%08x\n",
+		       start, last, run->base_pte);
+		break;
+	default:
+		printf("0x%08x: 0x%08x\n", start, run->base_pte);
+		break;
+	}
+}
+
+/*
+ * Splits the PTEs into maximal linear (each PTE one page after the
+ * previous) and constant runs in a single pass, preferring a linear run
+ * when the first two PTEs allow both like the original scanner did.
+ */
+static void encode_runs(const uint32_t *pte, uint32_t count,
+			void (*emit)(const struct run *run))
+{
+	struct run run;
+	uint32_t i;
+
+	if (count == 0)
+		return;
+
+	run.start = 0;
+	run.end = 1;
+	run.kind = RUN_SINGLE;
+	run.base_pte = pte[0];
+
+	for (i = 1; i < count; i++) {
+		uint32_t expected;
+
+		switch (run.kind) {
+		case RUN_SINGLE:
+			if (pte[i] == run.base_pte + KB(4)) {
+				run.kind = RUN_LINEAR;
+				run.end++;
+				continue;
+			}
+			if (pte[i] == run.base_pte) {
+				run.kind = RUN_CONSTANT;
+				run.end++;
+				continue;
+			}
+			break;
+		case RUN_LINEAR:
+			expected = run.base_pte + (i - run.start) * KB(4);
+			if (pte[i] == expected) {
+				run.end++;
+				continue;
+			}
+			break;
+		case RUN_CONSTANT:
+			if (pte[i] == run.base_pte) {
+				run.end++;
+				continue;
+			}
+			break;
+		}
+
+		emit(&run);
+		run.start = i;
+		run.end = i + 1;
+		run.kind = RUN_SINGLE;
+		run.base_pte = pte[i];
+	}
+
+	emit(&run);
+}
+
+/*
+ * Aperture statistics. Unused PTEs all point at the scratch page, which is
+ * taken to be the PTE covering the most pages in constant runs. PTEs
+ * without the valid bit are counted as free too.
+ */
+static struct run *runs;
+static uint32_t num_runs, max_runs;
+
+static void collect_run(const struct run *run)
+{
+	if (num_runs == max_runs) {
+		max_runs = max_runs ? max_runs * 2 : 1024;
+		runs = realloc(runs, max_runs * sizeof(*runs));
+		if (runs == NULL)
+			err(1, "failed to allocate runs");
+	}
+
+	runs[num_runs++] = *run;
+}
+
+static int cmp_base_pte(const void *a, const void *b)
+{
+	const struct run *x = a, *y = b;
+
+	return x->base_pte < y->base_pte ? -1 : x->base_pte > y->base_pte;
+}
+
+static uint32_t find_scratch_pte(void)
+{
+	struct run *constant;
+	uint32_t i, n = 0, scratch = 0;
+	uint64_t best = 0, pages = 0;
+
+	constant = malloc((num_runs + 1) * sizeof(*constant));
+	if (constant == NULL)
+		err(1, "failed to allocate runs");
+
+	for (i = 0; i < num_runs; i++)
+		if (runs[i].kind == RUN_CONSTANT)
+			constant[n++] = runs[i];
+	qsort(constant, n, sizeof(*constant), cmp_base_pte);
+
+	for (i = 0; i < n; i++) {
+		if (i && constant[i].base_pte != constant[i - 1].base_pte)
+			pages = 0;
+		pages += constant[i].end - constant[i].start;
+		if (pages > best) {
+			best = pages;
+			scratch = constant[i].base_pte;
+		}
+	}
+
+	free(constant);
+	return scratch;
+}
+
+static int run_is_free(const struct run *run, uint32_t scratch)
+{
+	if (run->kind == RUN_LINEAR)
+		return 0;
+
+	return run->base_pte == scratch || !(run->base_pte & 1);
+}
+
+#define MAX_BUCKETS 64
+
+static void print_stats(const uint32_t *pte, uint32_t count)
+{
+	uint64_t used_runs[MAX_BUCKETS] = {}, free_runs[MAX_BUCKETS] = {};
+	uint32_t scratch, i, region_start = 0;
+	uint64_t free_pages = 0, largest_free = 0, largest_linear = 0;
+	uint32_t free_regions = 0, used_regions = 0;
+	int in_free = 0, b;
+
+	encode_runs(pte, count, collect_run);
+	scratch = find_scratch_pte();
+
+	/* Adjacent free runs (e.g. scratch followed by invalid PTEs) form
+	 * a single free region.
+	 */
+	for (i = 0; i <= num_runs; i++) {
+		int is_free = i < num_runs && run_is_free(&runs[i], scratch);
+		uint32_t len;
+
+		if (in_free && !is_free) {
+			len = runs[i - 1].end - region_start;
+			if (len > largest_free)
+				largest_free = len;
+			b = (uint64_t)len * KB(4) / MB(1);
+			free_runs[b < MAX_BUCKETS ? b : MAX_BUCKETS - 1]++;
+			free_regions++;
+		}
+		if (i == num_runs)
+			break;
+
+		len = runs[i].end - runs[i].start;
+		if (is_free) {
+			if (!in_free)
+				region_start = runs[i].start;
+			free_pages += len;
+		} else {
+			b = (uint64_t)len * KB(4) / MB(1);
+			used_runs[b < MAX_BUCKETS ? b : MAX_BUCKETS - 1]++;
+			used_regions++;
+			if (runs[i].kind == RUN_LINEAR && len > largest_linear)
+				largest_linear = len;
+		}
+		in_free = is_free;
+	}
+
+	printf("aperture:               %u MiB, %u PTEs\n",
+	       (unsigned)((uint64_t)count * KB(4) / MB(1)), count);
+	printf("scratch PTE:            0x%08x\n", scratch);
+	printf("used:                   %llu PTEs (%.1f%%)\n",
+	       (unsigned long long)(count - free_pages),
+	       count ? 100. * (count - free_pages) / count : 0.);
+	printf("free:                   %llu PTEs (%.1f%%) in %u regions\n",
+	       (unsigned long long)free_pages,
+	       count ? 100. * free_pages / count : 0., free_regions);
+	printf("largest free region:    %llu KiB\n",
+	       (unsigned long long)largest_free * 4);
+	printf("largest linear run:     %llu KiB\n",
+	       (unsigned long long)largest_linear * 4);
+	/* 0 when all free space is contiguous, towards 1 as it splinters */
+	printf("fragmentation index:    %.3f\n",
+	       free_pages ? 1. - (double)largest_free / free_pages : 0.);
+	printf("used runs:              %u\n", used_regions);
+
+	printf("\nrun length distribution (1 MiB buckets):\n");
+	printf("%12s %10s %10s\n", "length", "used", "free");
+	for (b = 0; b < MAX_BUCKETS; b++) {
+		if (!used_runs[b] && !free_runs[b])
+			continue;
+		if (b == MAX_BUCKETS - 1)
+			printf("  >= %4d MiB", b);
+		else
+			printf("%4d-%4d MiB", b, b + 1);
+		printf(" %10llu %10llu\n",
+		       (unsigned long long)used_runs[b],
+		       (unsigned long long)free_runs[b]);
+	}
+
+	free(runs);
+}
+
+/* Copies the live GTT into memory, a PTE array per 4KiB of aperture. */
+static uint32_t *read_live_gtt(uint32_t *count)
 {
 	struct pci_device *pci_dev;
-	int start, aper_size;
+	const volatile uint64_t *src;
+	uint64_t *dst;
 	unsigned char *gtt;
-	uint32_t devid;
+	uint32_t devid, i;
 	int flag[] = {
 		PCI_DEV_MAP_FLAG_WRITE_COMBINE,
 		PCI_DEV_MAP_FLAG_WRITABLE,
@@ -87,48 +347,107 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	aper_size = pci_dev->regions[2].size;
+	*count = pci_dev->regions[2].size / KB(4);
 
-	for (start = 0; start < aper_size; start += KB(4)) {
-		uint32_t start_pte = INGTT(start);
-		uint32_t end;
-		int constant_length = 0;
-		int linear_length = 0;
+	/* Reads from the (uncached) mapping are slow, so fetch two PTEs
+	 * per access and work on the copy from there on.
+	 */
+	dst = malloc((*count + 1) / 2 * sizeof(*dst));
+	if (dst == NULL)
+		err(1, "failed to allocate gtt copy");
 
-		/* Check if it's a linear sequence */
-		for (end = start + KB(4); end < aper_size; end += KB(4)) {
-			uint32_t end_pte = INGTT(end);
-			if (end_pte == start_pte + (end - start))
-				linear_length++;
-			else
-				break;
-		}
-		if (linear_length > 0) {
-			printf("0x%08x - 0x%08x: linear from "
-			       "0x%08x to 0x%08x\n",
-			       start, end - KB(4),
-			       start_pte, start_pte + (end - start) - KB(4));
-			start = end - KB(4);
-			continue;
-		}
+	src = (const volatile uint64_t *)gtt;
+	for (i = 0; i < (*count + 1) / 2; i++)
+		dst[i] = src[i];
 
-		/* Check if it's a constant sequence */
-		for (end = start + KB(4); end < aper_size; end += KB(4)) {
-			uint32_t end_pte = INGTT(end);
-			if (end_pte == start_pte)
-				constant_length++;
-			else
-				break;
-		}
-		if (constant_length > 0) {
-			printf("0x%08x - 0x%08x: constant 0x%08x\n",
-			       start, end - KB(4), start_pte);
-			start = end - KB(4);
-			continue;
+	return (uint32_t *)dst;
+}
+
+/* Loads a GTT image as saved with -s, or any array of 32 bit PTEs. */
+static uint32_t *read_gtt_file(const char *filename, uint32_t *count)
+{
+	struct stat st;
+	void *ptr;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		err(1, "couldn't open %s", filename);
+	if (fstat(fd, &st))
+		err(1, "couldn't stat %s", filename);
+	if (st.st_size < 4)
+		errx(1, "%s is not a GTT image", filename);
+
+	ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (ptr == MAP_FAILED)
+		err(1, "couldn't mmap %s", filename);
+	close(fd);
+
+	*count = st.st_size / 4;
+	return ptr;
+}
+
+static void save_gtt(const char *filename, const uint32_t *pte, uint32_t count)
+{
+	FILE *file;
+
+	file = fopen(filename, "w");
+	if (file == NULL)
+		err(1, "couldn't open %s", filename);
+	if (fwrite(pte, 4, count, file) != count)
+		err(1, "failed to write %s", filename);
+	fclose(file);
+}
+
+static void usage(const char *cmdname)
+{
+	printf("Usage: %s [-m|-S] [-f file] [-s file]\n", cmdname);
+	printf("  -m : machine readable output, one 'start end kind base_pte' per line\n");
+	printf("  -S : print aperture occupancy and fragmentation statistics\n");
+	printf("  -f file : read the GTT from a saved image instead of the hardware\n");
+	printf("  -s file : save the GTT image to file\n");
+}
+
+int main(int argc, char **argv)
+{
+	char *input = NULL, *output = NULL;
+	uint32_t *pte, count;
+	int opt, stats = 0;
+
+	while ((opt = getopt(argc, argv, "mSf:s:h")) != -1) {
+		switch (opt) {
+		case 'S':
+			stats = 1;
+			break;
+		case 'm':
+			machine_readable = 1;
+			break;
+		case 'f':
+			input = optarg;
+			break;
+		case 's':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
 		}
+	}
+
+	if (input)
+		pte = read_gtt_file(input, &count);
+	else
+		pte = read_live_gtt(&count);
 
-		printf("0x%08x: 0x%08x\n", start, start_pte);
+	if (output) {
+		save_gtt(output, pte, count);
+		return 0;
 	}
 
+	if (stats)
+		print_stats(pte, count);
+	else
+		encode_runs(pte, count, print_run);
+
 	return 0;
 }
@@ -26,10 +26,14 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <getopt.h>
+#include <sys/time.h>
 #include "intel_gpu_tools.h"
 
 typedef enum {
@@ -347,10 +351,8 @@ static void infoframe_fix_checksum(DipInfoFrame *frame)
 	frame->generic.body[0] = 0x100 - csum;
 }
 
-static void dump_port_info(int hdmi_port_index)
+static void dump_port_state(int hdmi_port_index, uint32_t val)
 {
-	Register port = get_hdmi_port(hdmi_port_index);
-	uint32_t val = INREG(port);
 	Transcoder transcoder;
 
 	printf("\nPort %s:\n", hdmi_port_names[hdmi_port_index]);
@@ -383,6 +385,12 @@ static void dump_port_info(int hdmi_port_index)
 	printf("- audio: %s\n", val & HDMI_PORT_AUDIO ? "enabled" : "disabled");
 }
 
+static void dump_port_info(int hdmi_port_index)
+{
+	dump_port_state(hdmi_port_index,
+			INREG(get_hdmi_port(hdmi_port_index)));
+}
+
 static void dump_raw_infoframe(DipInfoFrame *frame)
 {
 	unsigned int i;
@@ -395,15 +403,9 @@ static void dump_raw_infoframe(DipInfoFrame *frame)
 	printf("\n");
 }
 
-static void dump_avi_info(Transcoder transcoder)
+static void dump_avi_frame(DipInfoFrame *frame, uint32_t val)
 {
-	Register reg = get_dip_ctl_reg(transcoder);
-	uint32_t val;
 	DipFrequency freq;
-	DipInfoFrame frame;
-
-	load_infoframe(transcoder, &frame, DIP_AVI);
-	val = INREG(reg);
 
 	printf("AVI InfoFrame:\n");
 
@@ -415,32 +417,40 @@ static void dump_avi_info(Transcoder transcoder)
 	freq = (val & DIP_CTL_FREQUENCY) >> 16;
 	printf("- frequency: %s\n", dip_frequency_names[freq]);
 
-	dump_raw_infoframe(&frame);
+	dump_raw_infoframe(frame);
 
 	printf("- type: %x, version: %x, length: %x, ecc: %x, checksum: %x\n",
-	       frame.avi.header.type, frame.avi.header.version,
-	       frame.avi.header.length, frame.avi.header.ecc,
-	       frame.avi.checksum);
+	       frame->avi.header.type, frame->avi.header.version,
+	       frame->avi.header.length, frame->avi.header.ecc,
+	       frame->avi.checksum);
 	printf("- S: %x, B: %x, A: %x, Y: %x, Rsvd0: %x\n",
-	       frame.avi.S, frame.avi.B, frame.avi.A, frame.avi.Y,
-	       frame.avi.Rsvd0);
+	       frame->avi.S, frame->avi.B, frame->avi.A, frame->avi.Y,
+	       frame->avi.Rsvd0);
 	printf("- R: %x, M: %x, C: %x\n",
-	       frame.avi.R, frame.avi.M, frame.avi.C);
+	       frame->avi.R, frame->avi.M, frame->avi.C);
 	printf("- SC: %x, Q: %x, EC: %x, ITC: %x\n",
-	       frame.avi.SC, frame.avi.Q, frame.avi.EC, frame.avi.ITC);
-	printf("- VIC: %x, Rsvd1: %x\n", frame.avi.VIC, frame.avi.Rsvd1);
-	printf("- PR: %x, Rsvd2: %x\n", frame.avi.PR, frame.avi.Rsvd2);
+	       frame->avi.SC, frame->avi.Q, frame->avi.EC, frame->avi.ITC);
+	printf("- VIC: %x, Rsvd1: %x\n", frame->avi.VIC, frame->avi.Rsvd1);
+	printf("- PR: %x, Rsvd2: %x\n", frame->avi.PR, frame->avi.Rsvd2);
 	printf("- top: %x, bottom: %x, left: %x, right: %x\n",
-	       frame.avi.top, frame.avi.bottom, frame.avi.left,
-	       frame.avi.right);
+	       frame->avi.top, frame->avi.bottom, frame->avi.left,
+	       frame->avi.right);
 	printf("- Rsvd3: %x, Rsvd4[0]: %x, Rsvd4[1]: %x, Rsvd4[2]: %x\n",
-	       frame.avi.Rsvd3, frame.avi.Rsvd4[0], frame.avi.Rsvd4[1],
-	       frame.avi.Rsvd4[2]);
+	       frame->avi.Rsvd3, frame->avi.Rsvd4[0], frame->avi.Rsvd4[1],
+	       frame->avi.Rsvd4[2]);
 
-	if (!infoframe_valid_checksum(&frame))
+	if (!infoframe_valid_checksum(frame))
 		printf("Invalid InfoFrame checksum!\n");
 }
 
+static void dump_avi_info(Transcoder transcoder)
+{
+	DipInfoFrame frame;
+
+	load_infoframe(transcoder, &frame, DIP_AVI);
+	dump_avi_frame(&frame, INREG(get_dip_ctl_reg(transcoder)));
+}
+
 static const char *vendor_id_to_string(uint32_t id)
 {
 	switch (id) {
@@ -476,15 +486,10 @@ static void dump_vendor_hdmi(DipInfoFrame *frame)
 		       s3d_structure_to_string(frame->vendor.s3d_structure));
 }
 
-static void dump_vendor_info(Transcoder transcoder)
+static void dump_vendor_frame(DipInfoFrame *frame, uint32_t val)
 {
-	Register reg = get_dip_ctl_reg(transcoder);
-	uint32_t val, vendor_id;
+	uint32_t vendor_id;
 	DipFrequency freq;
-	DipInfoFrame frame;
-
-	load_infoframe(transcoder, &frame, DIP_VENDOR);
-	val = INREG(reg);
 
 	printf("Vendor InfoFrame:\n");
 
@@ -496,30 +501,32 @@ static void dump_vendor_info(Transcoder transcoder)
 	freq = (val & DIP_CTL_FREQUENCY) >> 16;
 	printf("- frequency: %s\n", dip_frequency_names[freq]);
 
-	dump_raw_infoframe(&frame);
+	dump_raw_infoframe(frame);
 
-	vendor_id = frame.vendor.id[2] << 16 | frame.vendor.id[1] << 8 |
-		    frame.vendor.id[0];
+	vendor_id = frame->vendor.id[2] << 16 | frame->vendor.id[1] << 8 |
+		    frame->vendor.id[0];
 
 	printf("- vendor Id: 0x%06x (%s)\n", vendor_id,
 	       vendor_id_to_string(vendor_id));
 
 	if (vendor_id == VENDOR_ID_HDMI)
-		dump_vendor_hdmi(&frame);
+		dump_vendor_hdmi(frame);
 
-	if (!infoframe_valid_checksum(&frame))
+	if (!infoframe_valid_checksum(frame))
 		printf("Invalid InfoFrame checksum!\n");
 }
 
-static void dump_gamut_info(Transcoder transcoder)
+static void dump_vendor_info(Transcoder transcoder)
 {
-	Register reg = get_dip_ctl_reg(transcoder);
-	uint32_t val;
-	DipFrequency freq;
 	DipInfoFrame frame;
 
-	load_infoframe(transcoder, &frame, DIP_GAMUT);
-	val = INREG(reg);
+	load_infoframe(transcoder, &frame, DIP_VENDOR);
+	dump_vendor_frame(&frame, INREG(get_dip_ctl_reg(transcoder)));
+}
+
+static void dump_gamut_frame(DipInfoFrame *frame, uint32_t val)
+{
+	DipFrequency freq;
 
 	printf("Gamut InfoFrame:\n");
 
@@ -531,23 +538,26 @@ static void dump_gamut_info(Transcoder transcoder)
 	freq = (val & DIP_CTL_FREQUENCY) >> 16;
 	printf("- frequency: %s\n", dip_frequency_names[freq]);
 
-	dump_raw_infoframe(&frame);
+	dump_raw_infoframe(frame);
 
-	if (!infoframe_valid_checksum(&frame))
+	if (!infoframe_valid_checksum(frame))
 		printf("Invalid InfoFrame checksum!\n");
 }
 
-static void dump_spd_info(Transcoder transcoder)
+static void dump_gamut_info(Transcoder transcoder)
 {
-	Register reg = get_dip_ctl_reg(transcoder);
-	uint32_t val;
-	DipFrequency freq;
 	DipInfoFrame frame;
+
+	load_infoframe(transcoder, &frame, DIP_GAMUT);
+	dump_gamut_frame(&frame, INREG(get_dip_ctl_reg(transcoder)));
+}
+
+static void dump_spd_frame(DipInfoFrame *frame, uint32_t val)
+{
+	DipFrequency freq;
 	char vendor[9];
 	char description[17];
 
-	load_infoframe(transcoder, &frame, DIP_SPD);
-	val = INREG(reg);
 
 	printf("SPD InfoFrame:\n");
 
@@ -559,26 +569,34 @@ static void dump_spd_info(Transcoder transcoder)
 	freq = (val & DIP_CTL_FREQUENCY) >> 16;
 	printf("- frequency: %s\n", dip_frequency_names[freq]);
 
-	dump_raw_infoframe(&frame);
+	dump_raw_infoframe(frame);
 
 	printf("- type: %x, version: %x, length: %x, ecc: %x, checksum: %x\n",
-	       frame.spd.header.type, frame.spd.header.version,
-	       frame.spd.header.length, frame.spd.header.ecc,
-	       frame.spd.checksum);
+	       frame->spd.header.type, frame->spd.header.version,
+	       frame->spd.header.length, frame->spd.header.ecc,
+	       frame->spd.checksum);
 
-	memcpy(vendor, frame.spd.vendor, 8);
+	memcpy(vendor, frame->spd.vendor, 8);
 	vendor[8] = '\0';
-	memcpy(description, frame.spd.description, 16);
+	memcpy(description, frame->spd.description, 16);
 	description[16] = '\0';
 
 	printf("- vendor: %s\n", vendor);
 	printf("- description: %s\n", description);
-	printf("- source: %s\n", spd_source_to_string(frame.spd.source));
+	printf("- source: %s\n", spd_source_to_string(frame->spd.source));
 
-	if (!infoframe_valid_checksum(&frame))
+	if (!infoframe_valid_checksum(frame))
 		printf("Invalid InfoFrame checksum!\n");
 }
 
+static void dump_spd_info(Transcoder transcoder)
+{
+	DipInfoFrame frame;
+
+	load_infoframe(transcoder, &frame, DIP_SPD);
+	dump_spd_frame(&frame, INREG(get_dip_ctl_reg(transcoder)));
+}
+
 static void dump_transcoder_info(Transcoder transcoder)
 {
 	Register reg = get_dip_ctl_reg(transcoder);
@@ -632,6 +650,301 @@ static void dump_all_info(void)
 	}
 }
 
+/*
+ * Monitor mode: each poll reads the port and DIP control registers and then
+ * only the buffers of the enabled infoframes.  A frame is only decoded and
+ * logged when its hash differs from the previous poll, so an idle link costs
+ * a few register reads per poll.  Logged events can also be recorded to a
+ * timeline file and replayed later without the hardware.
+ */
+#define TIMELINE_MAGIC		"IFTL"
+#define TIMELINE_VERSION	1
+
+enum {
+	EVENT_PORT,
+	EVENT_DIP_CTL,
+	EVENT_FRAME,
+};
+
+struct timeline_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t gen;
+	uint32_t pch;
+};
+
+struct timeline_record {
+	uint64_t usecs;
+	uint8_t event;
+	uint8_t index;		/* port index or transcoder */
+	uint8_t type;		/* DipType, for frame events */
+	uint8_t pad;
+	uint32_t value;		/* port or DIP control register */
+	uint32_t data[16];	/* infoframe buffer, for frame events */
+};
+
+static const uint32_t dip_enable_bits[] = {
+	[DIP_AVI] = DIP_CTL_AVI_ENABLE,
+	[DIP_VENDOR] = DIP_CTL_VENDOR_ENABLE,
+	[DIP_GAMUT] = DIP_CTL_GAMUT_ENABLE,
+	[DIP_SPD] = DIP_CTL_SPD_ENABLE,
+};
+static const char * const dip_names[] = {
+	"AVI",
+	"Vendor",
+	"Gamut",
+	"SPD"
+};
+
+static volatile int monitor_stop;
+static const char *timeline_file;
+static FILE *timeline;
+
+static uint32_t last_port[3];
+static uint32_t last_ctl[3];
+static uint32_t last_hash[3][4];
+static int monitor_primed;
+
+static void monitor_sigint(int sig)
+{
+	monitor_stop = 1;
+}
+
+static int num_transcoders(void)
+{
+	return gen == 4 ? 1 : ARRAY_SIZE(pch_dip_ctl_regs);
+}
+
+static int num_hdmi_ports(void)
+{
+	return gen == 4 ? ARRAY_SIZE(gen4_hdmi_ports) :
+			  ARRAY_SIZE(pch_hdmi_ports);
+}
+
+/* the DIP control bits we change ourselves when reading the buffers */
+static uint32_t dip_ctl_access_mask(void)
+{
+	uint32_t mask = DIP_CTL_BUFFER_INDEX | DIP_CTL_FREQUENCY |
+			DIP_CTL_BUFFER_SIZE | DIP_CTL_ACCESS_ADDR;
+
+	if (gen == 4)
+		mask |= DIP_CTL_BUFFER_TRANS_ACTIVE_GEN4;
+
+	return mask;
+}
+
+static uint32_t hash_frame(const DipInfoFrame *frame, uint32_t ctl)
+{
+	uint32_t hash = 2166136261u;
+	unsigned int i;
+
+	for (i = 0; i < 64; i++) {
+		hash ^= frame->data8[i];
+		hash *= 16777619;
+	}
+	hash ^= ctl & DIP_CTL_FREQUENCY;
+	hash *= 16777619;
+
+	/* 0 means "not seen yet" */
+	return hash ? hash : 1;
+}
+
+static void log_event(const struct timeline_record *rec)
+{
+	DipInfoFrame frame;
+	uint32_t val = rec->value;
+	unsigned int i;
+
+	printf("[%5llu.%06llu] ",
+	       (unsigned long long)(rec->usecs / 1000000),
+	       (unsigned long long)(rec->usecs % 1000000));
+
+	switch (rec->event) {
+	case EVENT_PORT:
+		printf("port %s changed", hdmi_port_names[rec->index]);
+		dump_port_state(rec->index, val);
+		break;
+	case EVENT_DIP_CTL:
+		printf("transcoder %s: DIP %s", transcoder_names[rec->index],
+		       val & DIP_CTL_ENABLE ? "enabled" : "disabled");
+		if (val & DIP_CTL_ENABLE) {
+			for (i = 0; i < ARRAY_SIZE(dip_enable_bits); i++)
+				if (val & dip_enable_bits[i])
+					printf(" %s", dip_names[i]);
+			if (val & DIP_CTL_GCP_ENABLE)
+				printf(" GCP");
+		}
+		printf("\n");
+		break;
+	case EVENT_FRAME:
+		printf("transcoder %s: ", transcoder_names[rec->index]);
+		memset(&frame, 0, sizeof(frame));
+		memcpy(frame.data32, rec->data, sizeof(rec->data));
+		switch (rec->type) {
+		case DIP_AVI:
+			dump_avi_frame(&frame, val);
+			break;
+		case DIP_VENDOR:
+			dump_vendor_frame(&frame, val);
+			break;
+		case DIP_GAMUT:
+			dump_gamut_frame(&frame, val);
+			break;
+		case DIP_SPD:
+			dump_spd_frame(&frame, val);
+			break;
+		}
+		break;
+	}
+	fflush(stdout);
+
+	if (timeline && fwrite(rec, sizeof(*rec), 1, timeline) != 1) {
+		fprintf(stderr, "failed to write %s\n", timeline_file);
+		fclose(timeline);
+		timeline = NULL;
+	}
+}
+
+static void monitor_poll(uint64_t usecs)
+{
+	struct timeline_record rec;
+	uint32_t mask = dip_ctl_access_mask();
+	int i, t;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.usecs = usecs;
+
+	for (i = 0; i < num_hdmi_ports(); i++) {
+		uint32_t val = INREG(get_hdmi_port(i));
+
+		if (monitor_primed && val == last_port[i])
+			continue;
+		last_port[i] = val;
+
+		rec.event = EVENT_PORT;
+		rec.index = i;
+		rec.value = val;
+		log_event(&rec);
+	}
+
+	for (t = 0; t < num_transcoders(); t++) {
+		uint32_t ctl = INREG(get_dip_ctl_reg(t));
+		DipType type;
+
+		if (!monitor_primed || (ctl & ~mask) != (last_ctl[t] & ~mask)) {
+			last_ctl[t] = ctl;
+
+			rec.event = EVENT_DIP_CTL;
+			rec.index = t;
+			rec.value = ctl;
+			log_event(&rec);
+		}
+
+		for (type = DIP_AVI; type < DIP_INVALID; type++) {
+			DipInfoFrame frame;
+			uint32_t hash;
+
+			if (!(ctl & DIP_CTL_ENABLE) ||
+			    !(ctl & dip_enable_bits[type])) {
+				/* report the frame again once re-enabled */
+				last_hash[t][type] = 0;
+				continue;
+			}
+
+			load_infoframe(t, &frame, type);
+			rec.value = INREG(get_dip_ctl_reg(t));
+			hash = hash_frame(&frame, rec.value);
+			if (hash == last_hash[t][type])
+				continue;
+			last_hash[t][type] = hash;
+
+			rec.event = EVENT_FRAME;
+			rec.index = t;
+			rec.type = type;
+			memcpy(rec.data, frame.data32, sizeof(rec.data));
+			log_event(&rec);
+		}
+	}
+
+	monitor_primed = 1;
+}
+
+static int monitor_infoframes(int interval_ms)
+{
+	struct timeval start, now;
+	uint64_t usecs;
+
+	if (timeline_file) {
+		struct timeline_header header;
+
+		timeline = fopen(timeline_file, "w");
+		if (!timeline) {
+			printf("Couldn't open %s: %s\n", timeline_file,
+			       strerror(errno));
+			return 1;
+		}
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, TIMELINE_MAGIC, 4);
+		header.version = TIMELINE_VERSION;
+		header.gen = gen;
+		header.pch = pch;
+		fwrite(&header, sizeof(header), 1, timeline);
+	}
+
+	signal(SIGINT, monitor_sigint);
+	signal(SIGTERM, monitor_sigint);
+
+	gettimeofday(&start, NULL);
+	while (!monitor_stop) {
+		gettimeofday(&now, NULL);
+		usecs = (now.tv_sec - start.tv_sec) * 1000000ULL +
+			now.tv_usec - start.tv_usec;
+		monitor_poll(usecs);
+		usleep(interval_ms * 1000);
+	}
+
+	if (timeline)
+		fclose(timeline);
+
+	return 0;
+}
+
+static int replay_timeline(const char *file)
+{
+	struct timeline_header header;
+	struct timeline_record rec;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f) {
+		printf("Couldn't open %s: %s\n", file, strerror(errno));
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, TIMELINE_MAGIC, 4) ||
+	    header.version != TIMELINE_VERSION) {
+		printf("%s is not an infoframe timeline\n", file);
+		fclose(f);
+		return 1;
+	}
+
+	gen = header.gen;
+	pch = header.pch;
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (rec.index >= 3 || rec.type >= DIP_INVALID) {
+			printf("corrupt record in %s\n", file);
+			break;
+		}
+		log_event(&rec);
+	}
+
+	fclose(f);
+	return 0;
+}
+
 static void write_infoframe(Transcoder transcoder, DipType type,
 			    DipInfoFrame *frame)
 {
@@ -957,6 +1270,13 @@ printf("Options:\n"
 "          select transcoder (A, B or C)\n"
 "  -f, --infoframe\n"
 "          select infoframe (AVI, Vendor, Gamut or SPD)\n"
+"  -m, --monitor [interval]\n"
+"          poll the enabled infoframes every interval milliseconds and log\n"
+"          every change until interrupted\n"
+"  -o, --record [file]\n"
+"          also save the changes logged by --monitor to a timeline file\n"
+"  -r, --replay [file]\n"
+"          print the changes stored in a timeline file, no hardware needed\n"
 "  -h, --help\n"
 "          prints this message\n"
 "\n"
@@ -979,6 +1299,9 @@ printf("Options:\n"
 "                           -t C --disable-infoframes \\\n"
 "                           -d\n"
 "\n"
+"  Log infoframe changes every 100ms and keep a timeline of them:\n"
+"          intel_infoframes -o hdmi.tl -m 100\n"
+"\n"
 "  Even more:\n"
 "  - print the help message\n"
 "  - completely disable all infoframes on all transcoders\n"
@@ -1024,12 +1347,13 @@ int main(int argc, char *argv[])
 {
 	int opt;
 	int ret = 0;
+	int monitor_interval = -1;
 	struct pci_device *pci_dev;
 	Transcoder transcoder = TRANSC_INVALID;
 	DipType dip = DIP_INVALID;
 	Register hdmi_port;
 
-	char short_opts[] = "dc:k:q:nNxXp:P:t:f:h";
+	char short_opts[] = "dc:k:q:nNxXp:P:t:f:m:o:r:h";
 	struct option long_opts[] = {
 		{ "dump",               no_argument,       NULL, 'd' },
 		{ "change-fields",      required_argument, NULL, 'c' },
@@ -1043,9 +1367,31 @@ int main(int argc, char *argv[])
 		{ "enable-hdmi-port",   required_argument, NULL, 'P' },
 		{ "transcoder" ,        required_argument, NULL, 't' },
 		{ "infoframe",          required_argument, NULL, 'f' },
+		{ "monitor",            required_argument, NULL, 'm' },
+		{ "record",             required_argument, NULL, 'o' },
+		{ "replay",             required_argument, NULL, 'r' },
 		{ "help",               no_argument,       NULL, 'h' },
+		{ 0 }
 	};
 
+	/*
+	 * Replaying a timeline needs no hardware. Monitoring starts once all
+	 * the other options have been acted upon, so pick up its settings
+	 * here, wherever they appear.
+	 */
+	opterr = 0;
+	while ((opt = getopt_long(argc, argv, short_opts, long_opts,
+				  NULL)) != -1) {
+		if (opt == 'r')
+			return replay_timeline(optarg);
+		else if (opt == 'o')
+			timeline_file = optarg;
+		else if (opt == 'm')
+			monitor_interval = atoi(optarg);
+	}
+	optind = 1;
+	opterr = 1;
+
 	printf("WARNING: This is just a debugging tool! Don't expect it to work"
 	       " perfectly: the Kernel might undo our changes.\n");
 
@@ -1187,6 +1533,10 @@ int main(int argc, char *argv[])
 				goto out;
 			}
 			break;
+		case 'o':
+		case 'm':
+			/* handled above */
+			break;
 		case 'h':
 			print_usage();
 			break;
@@ -1197,6 +1547,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (monitor_interval >= 0)
+		ret = monitor_infoframes(monitor_interval);
+
 out:
 	intel_register_access_fini();
 	return ret;
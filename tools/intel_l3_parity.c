@@ -40,6 +40,7 @@
 #define NUM_BANKS 4
 #define NUM_SUBBANKS 8
 #define NUM_REGS (NUM_BANKS * NUM_SUBBANKS)
+#define NUM_ROWS 2048
 
 struct __attribute__ ((__packed__)) l3_log_register {
 	uint32_t row0_enable	: 1;
@@ -93,67 +94,323 @@ static int disable_rbs(int row, int bank, int sbank)
 	return 0;
 }
 
-static int do_parse(int argc, char *argv[])
+static int rbs_valid(int row, int bank, int sbank)
 {
-	int row, bank, sbank, i, ret;
+	return row >= 0 && row < NUM_ROWS &&
+	       bank >= 0 && bank < NUM_BANKS &&
+	       sbank >= 0 && sbank < NUM_SUBBANKS;
+}
+
+static int parse_rbs(const char *s, int *row, int *bank, int *sbank)
+{
+	if (sscanf(s, "%d,%d,%d", row, bank, sbank) != 3)
+		return -1;
 
-	for (i = 1; i < argc; i++) {
-		ret = sscanf(argv[i], "%d,%d,%d", &row, &bank, &sbank);
-		if (ret != 3)
+	if (!rbs_valid(*row, *bank, *sbank))
+		return -1;
+
+	return 0;
+}
+
+static int do_parse(int argc, char *argv[], int first)
+{
+	int row, bank, sbank, i;
+
+	for (i = first; i < argc; i++) {
+		if (parse_rbs(argv[i], &row, &bank, &sbank))
 			return i;
 		assert(disable_rbs(row, bank, sbank) == 0);
 	}
 	return 0;
 }
 
-int main(int argc, char *argv[])
+/*
+ * Remap planner.  Parity errors are counted per row; since every subbank
+ * has its own two remap slots, filling each subbank's free slots with its
+ * most frequently failing rows is an optimal plan for covering as many
+ * of the logged errors as possible.  Rows that are already remapped keep
+ * their slot.
+ */
+static unsigned int error_count[NUM_BANKS][NUM_SUBBANKS][NUM_ROWS];
+
+/*
+ * Accepts "row,bank,subbank" lines, the output of this tool ("Row r, Bank
+ * b, Subbank s ...") and L3 parity uevent environments ("ROW=r BANK=b
+ * SUBBANK=s", on one line or spread over several).
+ */
+static int read_events(const char *file)
 {
-	const int device = drm_get_card(0);
-	char *path;
-	unsigned int devid;
-	int drm_fd, fd, ret;
+	char line[256];
+	int row = 0, bank = 0, sbank = 0;
+	int events = 0, lineno = 0, seen = 0;
+	FILE *f;
+
+	f = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	if (!f) {
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *tok;
+
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
 
-	drm_fd = drm_open_any();
-	devid = intel_get_drm_devid(drm_fd);
+		/* syntax first, the range is checked the same for all forms */
+		if (sscanf(line, "%d,%d,%d", &row, &bank, &sbank) == 3 ||
+		    sscanf(line, "Row %d, Bank %d, Subbank %d",
+			   &row, &bank, &sbank) == 3) {
+			seen = 7;
+		} else {
+			for (tok = strtok(line, " \t\n"); tok;
+			     tok = strtok(NULL, " \t\n")) {
+				if (!strncmp(tok, "ROW=", 4)) {
+					row = atoi(tok + 4);
+					seen |= 1;
+				} else if (!strncmp(tok, "BANK=", 5)) {
+					bank = atoi(tok + 5);
+					seen |= 2;
+				} else if (!strncmp(tok, "SUBBANK=", 8)) {
+					sbank = atoi(tok + 8);
+					seen |= 4;
+				}
+			}
+			if (seen != 7)
+				continue;
+		}
 
-	ret = asprintf(&path, "/sys/class/drm/card%d/l3_parity", device);
-	assert(ret != -1);
+		if (!rbs_valid(row, bank, sbank)) {
+			fprintf(stderr, "%s:%d: row/bank/subbank out of range\n",
+				file, lineno);
+			exit(EXIT_FAILURE);
+		}
 
-	fd = open(path, O_RDWR);
-	if (fd == -1 && IS_IVYBRIDGE(devid)) {
-		perror("Opening sysfs");
+		error_count[bank][sbank][row]++;
+		events++;
+		seen = 0;
+	}
+
+	if (f != stdin)
+		fclose(f);
+
+	return events;
+}
+
+static int row_remapped(const struct l3_log_register *reg, int row)
+{
+	return (reg->row0_enable && reg->row0 == row) ||
+	       (reg->row1_enable && reg->row1 == row);
+}
+
+static void plan_remaps(int events, unsigned int threshold)
+{
+	int bank, sbank, row, slot;
+	int covered = 0, remapped = 0, unrepaired_rows = 0, unrepaired = 0;
+
+	for (bank = 0; bank < NUM_BANKS; bank++) {
+		for (sbank = 0; sbank < NUM_SUBBANKS; sbank++) {
+			struct l3_log_register *reg = &l3log[bank][sbank];
+			unsigned int *count = error_count[bank][sbank];
+			int free_slots = !reg->row0_enable + !reg->row1_enable;
+
+			/* errors on rows that are already remapped */
+			for (row = 0; row < NUM_ROWS; row++)
+				if (count[row] && row_remapped(reg, row))
+					covered += count[row];
+
+			for (slot = 0; slot < free_slots; slot++) {
+				int best = -1;
+
+				for (row = 0; row < NUM_ROWS; row++) {
+					if (count[row] < threshold ||
+					    row_remapped(reg, row))
+						continue;
+					if (best < 0 || count[row] > count[best])
+						best = row;
+				}
+				if (best < 0)
+					break;
+
+				printf("remap: row %d, bank %d, subbank %d (%u errors)\n",
+				       best, bank, sbank, count[best]);
+				assert(disable_rbs(best, bank, sbank) == 0);
+				covered += count[best];
+				remapped++;
+			}
+
+			for (row = 0; row < NUM_ROWS; row++) {
+				if (!count[row] || row_remapped(reg, row))
+					continue;
+				if (count[row] >= threshold)
+					printf("unrepairable: row %d, bank %d, subbank %d (%u errors), no free slot\n",
+					       row, bank, sbank, count[row]);
+				unrepaired_rows++;
+				unrepaired += count[row];
+			}
+		}
+	}
+
+	printf("%d events: %d new remaps, %d events on remapped rows, "
+	       "%d events on %d rows left\n",
+	       events, remapped, covered, unrepaired, unrepaired_rows);
+}
+
+static void load_image(const char *file)
+{
+	int fd, ret;
+
+	fd = open(file, O_RDONLY);
+	if (fd == -1) {
+		perror(file);
 		exit(EXIT_FAILURE);
-	} else if (fd == -1)
-		exit(EXIT_SUCCESS);
+	}
 
 	ret = read(fd, l3log, NUM_REGS * sizeof(uint32_t));
-	if (ret == -1) {
-		perror("Reading sysfs");
+	if (ret != NUM_REGS * sizeof(uint32_t)) {
+		fprintf(stderr, "%s: not an L3LOG image\n", file);
 		exit(EXIT_FAILURE);
 	}
 
-	assert(lseek(fd, 0, SEEK_SET) == 0);
+	close(fd);
+}
 
-	if (argc == 1) {
-		dumpit();
-		exit(EXIT_SUCCESS);
-	} else if (!strncmp("-c", argv[1], 2)) {
-		memset(l3log, 0, sizeof(l3log));
+static void save_image(const char *file)
+{
+	int fd, ret;
+
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+
+	ret = write(fd, l3log, NUM_REGS * sizeof(uint32_t));
+	if (ret != NUM_REGS * sizeof(uint32_t)) {
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options] [row,bank,subbank ...]\n"
+		"\n"
+		"Without arguments, the currently remapped rows are listed.\n"
+		"\n"
+		"  -c          clear all remaps\n"
+		"  -p file     plan remaps from a log of parity errors ('-' for stdin)\n"
+		"  -t count    only remap rows with at least count errors (default 1)\n"
+		"  -n          dry run: print the result instead of writing it\n"
+		"  -f file     work on a saved L3LOG image instead of the hardware\n"
+		"  -o file     write the resulting L3LOG image to file instead of\n"
+		"              the hardware (on its own, saves the current image)\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *events_file = NULL, *image_in = NULL, *image_out = NULL;
+	unsigned int threshold = 1;
+	int clear = 0, dry_run = 0, events = 0;
+	int fd = -1, ret, opt;
+
+	while ((opt = getopt(argc, argv, "cp:t:nf:o:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			clear = 1;
+			break;
+		case 'p':
+			events_file = optarg;
+			break;
+		case 't':
+			threshold = strtoul(optarg, NULL, 0);
+			if (!threshold)
+				threshold = 1;
+			break;
+		case 'n':
+			dry_run = 1;
+			break;
+		case 'f':
+			image_in = optarg;
+			break;
+		case 'o':
+			image_out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (image_in) {
+		load_image(image_in);
 	} else {
-		ret = do_parse(argc, argv);
-		if (ret != 0) {
-			fprintf(stderr, "Malformed command line at %s\n", argv[ret]);
+		const int device = drm_get_card(0);
+		unsigned int devid;
+		char *path;
+		int drm_fd;
+
+		drm_fd = drm_open_any();
+		devid = intel_get_drm_devid(drm_fd);
+
+		ret = asprintf(&path, "/sys/class/drm/card%d/l3_parity", device);
+		assert(ret != -1);
+
+		fd = open(path, O_RDWR);
+		if (fd == -1 && IS_IVYBRIDGE(devid)) {
+			perror("Opening sysfs");
+			exit(EXIT_FAILURE);
+		} else if (fd == -1)
+			exit(EXIT_SUCCESS);
+
+		ret = read(fd, l3log, NUM_REGS * sizeof(uint32_t));
+		if (ret == -1) {
+			perror("Reading sysfs");
 			exit(EXIT_FAILURE);
 		}
+
+		assert(lseek(fd, 0, SEEK_SET) == 0);
 	}
 
-	ret = write(fd, l3log, NUM_REGS * sizeof(uint32_t));
-	if (ret == -1) {
-		perror("Writing sysfs");
+	if (!clear && !events_file && optind == argc && !image_out) {
+		dumpit();
+		exit(EXIT_SUCCESS);
+	}
+
+	if (clear)
+		memset(l3log, 0, sizeof(l3log));
+
+	ret = do_parse(argc, argv, optind);
+	if (ret != 0) {
+		fprintf(stderr, "Malformed command line at %s\n", argv[ret]);
 		exit(EXIT_FAILURE);
 	}
 
-	close(fd);
+	if (events_file) {
+		events = read_events(events_file);
+		plan_remaps(events, threshold);
+	}
+
+	/* all changes go out in a single write */
+	if (dry_run || (image_in && !image_out)) {
+		dumpit();
+	} else if (image_out) {
+		save_image(image_out);
+	} else {
+		ret = write(fd, l3log, NUM_REGS * sizeof(uint32_t));
+		if (ret == -1) {
+			perror("Writing sysfs");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (fd != -1)
+		close(fd);
 
 	exit(EXIT_SUCCESS);
 }
@@ -20,78 +20,79 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+/*
+ * The checks are expressed as a table of rules, each comparing the bits
+ * selected by a mask of one register against an expected value. Rules
+ * that share a register are kept next to each other so that the
+ * register is read once per group. At startup the table is filtered
+ * down to the rules that apply to the device, and the remaining rules
+ * are evaluated in a single pass over either the live MMIO BAR or a
+ * register snapshot taken with intel_reg_snapshot.
+ */
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <err.h>
 #include <string.h>
 #include <stdbool.h>
+#include <strings.h>
 #include "intel_gpu_tools.h"
 
-static uint32_t devid;
-static int gen;
-
-static inline uint32_t
-read_reg(uint32_t reg)
-{
-	return *(volatile uint32_t *)((volatile char *)mmio + reg);
-}
-
-static uint32_t
-read_and_print_reg(const char *name, uint32_t reg)
-{
-	uint32_t val = read_reg(reg);
-
-	printf("%s (0x%x): 0x%08x\n", name, reg, val);
-
-	return val;
-}
-
-static void
-check_chicken_unset(const char *name, uint32_t reg)
-{
-	uint32_t val = read_and_print_reg(name, reg);
-
-
-	if (val != 0) {
-		fprintf(stderr, "           WARN: chicken bits set\n");
-	} else {
-		printf("           OK:   chicken bits unset\n");
-	}
-}
-
-static void
-check_bit(uint32_t val, int bit, const char *bitname, bool set)
+enum rule_severity {
+	RULE_MUST,	/* required for correct operation */
+	RULE_PERF,	/* costs performance when violated */
+	RULE_WARN,	/* unexpected debug/chicken bits */
+};
+
+struct reg_rule {
+	const char *reg_name;
+	uint32_t reg;
+	uint32_t mask;
+	uint32_t expected;
+	enum rule_severity severity;
+	unsigned gens;
+	bool (*applies)(uint32_t devid);
+	const char *name;
+	const char *impact;
+};
+
+#define GEN(n)		(1 << (n))
+#define GEN_ALL		(GEN(4) | GEN(5) | GEN(6) | GEN(7))
+#define GEN_PRE7	(GEN(4) | GEN(5) | GEN(6))
+#define GEN_PRE6	(GEN(4) | GEN(5))
+#define GEN_6_7		(GEN(6) | GEN(7))
+
+#define BIT_RULE(sev, gens, reg_name, reg, bit, set, name, impact) \
+	{ reg_name, reg, 1u << (bit), (set) ? 1u << (bit) : 0, \
+	  sev, gens, NULL, name, impact }
+#define MUST(gens, reg_name, reg, bit, set, name) \
+	BIT_RULE(RULE_MUST, gens, reg_name, reg, bit, set, name, NULL)
+#define PERF(gens, reg_name, reg, bit, set, name, impact) \
+	BIT_RULE(RULE_PERF, gens, reg_name, reg, bit, set, name, impact)
+#define UNSET(gens, reg_name, reg, mask, name) \
+	{ reg_name, reg, mask, 0, RULE_WARN, gens, NULL, name, NULL }
+#define CHICKEN(gens, reg_name, reg) \
+	UNSET(gens, reg_name, reg, 0xffffffff, "chicken bits")
+
+static bool
+is_snb_gt1(uint32_t devid)
 {
-	if (!!(val & (1 << bit)) != set) {
-		fprintf(stderr, "  (bit %2d) FAIL: %s must be %s\n",
-			bit, bitname, set ? "set" : "unset");
-	} else {
-		printf("  (bit %2d) OK:   %s\n", bit, bitname);
-	}
+	return devid == PCI_CHIP_SANDYBRIDGE_GT1 ||
+	       devid == PCI_CHIP_SANDYBRIDGE_M_GT1;
 }
 
-static void
-check_perf_bit(uint32_t val, int bit, const char *bitname, bool set)
+static bool
+is_snb_gt2(uint32_t devid)
 {
-	if (!!(val & (1 << bit)) != set) {
-		printf("  (bit %2d) PERF: %s should be %s\n",
-			bit, bitname, set ? "set" : "unset");
-	} else {
-		printf("  (bit %2d) OK:   %s\n", bit, bitname);
-	}
+	return IS_GEN6(devid) && !is_snb_gt1(devid);
 }
 
-static void
-check_mi_mode(void)
-{
+static const struct reg_rule rules[] = {
 	/* Described in page 14-16 of the IHD_OS_Vol1_Part3.pdf
 	 * specification.
-	 */
-
-	uint32_t mi_mode = read_and_print_reg("MI_MODE", 0x209c);
-
-	/* From page 14:
+	 *
+	 * From page 14:
 	 *
 	 * Async Flip Performance mode
 	 * Project: All
@@ -99,111 +100,83 @@ check_mi_mode(void)
 	 * Format: U1
 	 * [DevSNB] This bit must be set to ‘1’
 	 */
-	if (gen == 6)
-		check_bit(mi_mode, 14, "Async Flip Performance mode", true);
-	else
-		check_perf_bit(mi_mode, 14, "Async Flip Performance mode",
-			       false);
-
-	check_perf_bit(mi_mode, 13, "Flush Performance Mode", false);
-
+	MUST(GEN(6), "MI_MODE", 0x209c, 14, true,
+	     "Async Flip Performance mode"),
+	PERF(GEN(4) | GEN(5) | GEN(7), "MI_MODE", 0x209c, 14, false,
+	     "Async Flip Performance mode", NULL),
+	PERF(GEN_ALL, "MI_MODE", 0x209c, 13, false,
+	     "Flush Performance Mode", NULL),
 	/* Our driver relies on MI_FLUSH, unfortunately. */
-	if (gen >= 6)
-		check_bit(mi_mode, 12, "MI_FLUSH enable", true);
-
+	MUST(GEN_6_7, "MI_MODE", 0x209c, 12, true, "MI_FLUSH enable"),
 	/* From page 15:
 	 *
 	 *     "1h: LRA mode of allocation. Used for validation purposes"
 	 */
-	if (gen < 7)
-		check_bit(mi_mode, 7, "Vertex Shader Cache Mode", false);
-
+	MUST(GEN_PRE7, "MI_MODE", 0x209c, 7, false,
+	     "Vertex Shader Cache Mode"),
 	/* From page 16:
 	 *
 	 *     "To avoid deadlock conditions in hardware this bit
 	 *      needs to be set for normal operation.
 	 */
-	check_bit(mi_mode, 6, "Vertex Shader Timer Dispatch Enable", true);
-}
+	MUST(GEN_ALL, "MI_MODE", 0x209c, 6, true,
+	     "Vertex Shader Timer Dispatch Enable"),
 
-static void
-check_gfx_mode(void)
-{
 	/* Described in page 17-19 of the IHD_OS_Vol1_Part3.pdf
 	 * specification.
-	 */
-	uint32_t gfx_mode;
-
-	if (gen < 6)
-		return;
-
-	if (gen == 6)
-		gfx_mode = read_and_print_reg("GFX_MODE", 0x2520);
-	else
-		gfx_mode = read_and_print_reg("GFX_MODE", 0x229c);
-
-	/* Our driver only updates page tables at batchbuffer
+	 *
+	 * Our driver only updates page tables at batchbuffer
 	 * boundaries, so we don't need TLB flushes at other times.
 	 */
-	check_perf_bit(gfx_mode, 13, "Flush TLB Invalidation Mode", true);
-}
+	PERF(GEN(6), "GFX_MODE", 0x2520, 13, true,
+	     "Flush TLB Invalidation Mode", "extra TLB invalidations"),
+	PERF(GEN(7), "GFX_MODE", 0x229c, 13, true,
+	     "Flush TLB Invalidation Mode", "extra TLB invalidations"),
 
-static void
-check_gt_mode(void)
-{
 	/* Described in page 20-22 of the IHD_OS_Vol1_Part3.pdf
 	 * specification.
 	 */
-	uint32_t gt_mode;
-
-	if (gen < 6)
-		return;
-
-	if (gen == 6)
-		gt_mode = read_and_print_reg("GT_MODE", 0x20d0);
-	else
-		gt_mode = read_and_print_reg("GT_MODE", 0x7008);
-
-	if (gen == 6)
-		check_perf_bit(gt_mode, 8, "Full Rate Sampler Disable", false);
-
+	PERF(GEN(6), "GT_MODE", 0x20d0, 8, false,
+	     "Full Rate Sampler Disable", "sampler runs at half rate"),
 	/* For DevSmallGT, this bit must be set, which means disable
 	 * hashing.
 	 */
-	if (devid == PCI_CHIP_SANDYBRIDGE_GT1 ||
-	    devid == PCI_CHIP_SANDYBRIDGE_M_GT1)
-		check_bit(gt_mode, 6, "WIZ Hashing disable", true);
-	else if (gen == 6)
-		check_perf_bit(gt_mode, 6, "WIZ Hashing disable", false);
-
-	if (gen == 6) {
-		check_perf_bit(gt_mode, 5, "TD Four Row Dispatch Disable",
-			       false);
-		check_perf_bit(gt_mode, 4, "Full Size URB Disable", false);
-		check_perf_bit(gt_mode, 3, "Full Size SF FIFO Disable", false);
-		check_perf_bit(gt_mode, 1, "VS Quad Thread Dispatch Disable",
-			       false);
-	}
-}
+	{ "GT_MODE", 0x20d0, 1 << 6, 1 << 6, RULE_MUST, GEN(6), is_snb_gt1,
+	  "WIZ Hashing disable", NULL },
+	{ "GT_MODE", 0x20d0, 1 << 6, 0, RULE_PERF, GEN(6), is_snb_gt2,
+	  "WIZ Hashing disable", "unbalanced pixel dispatch" },
+	PERF(GEN(6), "GT_MODE", 0x20d0, 5, false,
+	     "TD Four Row Dispatch Disable", NULL),
+	PERF(GEN(6), "GT_MODE", 0x20d0, 4, false,
+	     "Full Size URB Disable", "smaller URB, fewer threads in flight"),
+	PERF(GEN(6), "GT_MODE", 0x20d0, 3, false,
+	     "Full Size SF FIFO Disable", NULL),
+	PERF(GEN(6), "GT_MODE", 0x20d0, 1, false,
+	     "VS Quad Thread Dispatch Disable", "fewer VS threads"),
+	/* On gen7 GT_MODE moved, and none of the above bits apply. */
+	{ "GT_MODE", 0x7008, 0, 0, RULE_WARN, GEN(7), NULL, NULL, NULL },
 
-static void
-check_cache_mode_0(void)
-{
 	/* Described in page 23-25 of the IHD_OS_Vol1_Part3.pdf
 	 * specification.
 	 */
-	uint32_t cache_mode_0;
-
-	if (gen >= 7)
-		cache_mode_0 = read_and_print_reg("CACHE_MODE_0", 0x7000);
-	else
-		cache_mode_0 = read_and_print_reg("CACHE_MODE_0", 0x2120);
-
-	check_perf_bit(cache_mode_0, 15, "Sampler L2 Disable", false);
-	check_perf_bit(cache_mode_0, 9, "Sampler L2 TLB Prefetch Enable", true);
-	check_perf_bit(cache_mode_0, 8,
-		       "Depth Related Cache Pipelined Flush Disable", false);
-
+#define CACHE_MODE_0_RULES(gens, reg) \
+	PERF(gens, "CACHE_MODE_0", reg, 15, false, \
+	     "Sampler L2 Disable", "sampler misses go to memory"), \
+	PERF(gens, "CACHE_MODE_0", reg, 9, true, \
+	     "Sampler L2 TLB Prefetch Enable", "sampler TLB misses stall"), \
+	PERF(gens, "CACHE_MODE_0", reg, 8, false, \
+	     "Depth Related Cache Pipelined Flush Disable", \
+	     "depth cache flushes stall the pipeline"), \
+	MUST(gens, "CACHE_MODE_0", reg, 5, false, \
+	     "STC LRA Eviction Policy"), \
+	MUST((gens) & GEN_6_7, "CACHE_MODE_0", reg, 4, false, \
+	     "RCC LRA Eviction Policy"), \
+	PERF(gens, "CACHE_MODE_0", reg, 3, false, \
+	     "Hierarchical Z Disable", "no HiZ depth rejection"), \
+	PERF((gens) & GEN(6), "CACHE_MODE_0", reg, 2, false, \
+	     "Hierarchical Z RAW Stall Optimization Disable", NULL), \
+	MUST(gens, "CACHE_MODE_0", reg, 0, false, \
+	     "Render Cache Operational Flush")
 	/* From page 24:
 	 *
 	 *     "If this bit is set, RCCunit will have LRA as
@@ -213,143 +186,318 @@ check_cache_mode_0(void)
 	 *      is not supported."
 	 *
 	 * And the same for STC Eviction Policy.
-	 */
-	check_bit(cache_mode_0, 5, "STC LRA Eviction Policy", false);
-	if (gen >= 6)
-		check_bit(cache_mode_0, 4, "RCC LRA Eviction Policy", false);
-
-	check_perf_bit(cache_mode_0, 3, "Hierarchical Z Disable", false);
-
-	if (gen == 6) {
-		check_perf_bit(cache_mode_0, 2,
-			       "Hierarchical Z RAW Stall Optimization "
-			       "Disable", false);
-	}
-
-	/* From page 25:
+	 *
+	 * From page 25:
 	 *
 	 *     "This bit must be 0. Operational Flushes [DevSNB] are
 	 *      not supported in [DevSNB].  SW must flush the render
 	 *      target after front buffer rendering."
 	 */
-	check_bit(cache_mode_0, 0, "Render Cache Operational Flush", false);
-}
-
+	CACHE_MODE_0_RULES(GEN_PRE7, 0x2120),
+	CACHE_MODE_0_RULES(GEN(7), 0x7000),
 
-static void
-check_cache_mode_1(void)
-{
 	/* Described in page 23-25 of the IHD_OS_Vol1_Part3.pdf
 	 * specification.
-	 */
-	uint32_t cache_mode_1;
-
-	if (gen >= 7)
-		cache_mode_1 = read_and_print_reg("CACHE_MODE_1", 0x7004);
-	else
-		cache_mode_1 = read_and_print_reg("CACHE_MODE_1", 0x2124);
-
-	if (gen >= 7) {
-		check_perf_bit(cache_mode_1, 13,
-			       "STC Address Lookup Optimization Disable",
-			       false);
-	}
-
-	/* From page 24:
+	 *
+	 * From page 24:
 	 *
 	 *     "If this bit is set, Hizunit will have LRA as
 	 *      replacement policy. The default value i.e.  (when this
 	 *      bit is reset) indicates the non-LRA eviction
 	 *      policy. For performance reasons, this bit must be
 	 *      reset."
+	 *
+	 * Page 26 describes bits 9-11 as reserved (debug only).
+	 *
+	 * In a later update of the documentation, it says about bit 3:
+	 *
+	 *     "[DevSNB:A0{WKA1}] [DevSNB]: This bit must be
+	 *      set for depth buffer format
+	 *      D24_UNORM_S8_UINT."
+	 *
+	 * XXX: Does that mean A0 only, or all DevSNB?
 	 */
-	check_bit(cache_mode_1, 12, "HIZ LRA Eviction Policy", false);
-
-	/* Page 26 describes these bits as reserved (debug only). */
-	check_bit(cache_mode_1, 11,
-		  "DAP Instruction and State Cache Invalidate", false);
-	check_bit(cache_mode_1, 10,
-		  "Instruction L1 Cache and In-Flight Queue Disable",
-		  false);
-	check_bit(cache_mode_1, 9, "Instruction L2 Cache Fill Buffers Disable",
-		  false);
-
-
-	if (gen >= 7) {
-		check_perf_bit(cache_mode_1, 6,
-			       "Pixel Backend sub-span collection "
-			       "Optimization Disable",
-			       false);
-		check_perf_bit(cache_mode_1, 5, "MCS Cache Disable", false);
-	}
-	check_perf_bit(cache_mode_1, 4, "Data Disable", false);
-
-	if (gen == 6) {
-		/* In a later update of the documentation, it says:
-		 *
-		 *     "[DevSNB:A0{WKA1}] [DevSNB]: This bit must be
-		 *      set for depth buffer format
-		 *      D24_UNORM_S8_UINT."
-		 *
-		 * XXX: Does that mean A0 only, or all DevSNB?
-		 */
-		check_perf_bit(cache_mode_1, 3,
-			       "Depth Read Hit Write-Only Optimization "
-			       "Disable", false);
-
-		check_perf_bit(cache_mode_1, 2,
-			       "Depth Cache LRA Hunt Feature Disable",
-			       false);
-	}
-
-	check_bit(cache_mode_1, 1, "Instruction and State L2 Cache Disable",
-		  false);
-	check_bit(cache_mode_1, 0, "Instruction and State L1 Cache Disable",
-		  false);
-}
+#define CACHE_MODE_1_RULES(gens, reg) \
+	PERF((gens) & GEN(7), "CACHE_MODE_1", reg, 13, false, \
+	     "STC Address Lookup Optimization Disable", NULL), \
+	MUST(gens, "CACHE_MODE_1", reg, 12, false, \
+	     "HIZ LRA Eviction Policy"), \
+	MUST(gens, "CACHE_MODE_1", reg, 11, false, \
+	     "DAP Instruction and State Cache Invalidate"), \
+	MUST(gens, "CACHE_MODE_1", reg, 10, false, \
+	     "Instruction L1 Cache and In-Flight Queue Disable"), \
+	MUST(gens, "CACHE_MODE_1", reg, 9, false, \
+	     "Instruction L2 Cache Fill Buffers Disable"), \
+	PERF((gens) & GEN(7), "CACHE_MODE_1", reg, 6, false, \
+	     "Pixel Backend sub-span collection Optimization Disable", \
+	     NULL), \
+	PERF((gens) & GEN(7), "CACHE_MODE_1", reg, 5, false, \
+	     "MCS Cache Disable", "MSAA compression data not cached"), \
+	PERF(gens, "CACHE_MODE_1", reg, 4, false, "Data Disable", NULL), \
+	PERF((gens) & GEN(6), "CACHE_MODE_1", reg, 3, false, \
+	     "Depth Read Hit Write-Only Optimization Disable", NULL), \
+	PERF((gens) & GEN(6), "CACHE_MODE_1", reg, 2, false, \
+	     "Depth Cache LRA Hunt Feature Disable", NULL), \
+	MUST(gens, "CACHE_MODE_1", reg, 1, false, \
+	     "Instruction and State L2 Cache Disable"), \
+	MUST(gens, "CACHE_MODE_1", reg, 0, false, \
+	     "Instruction and State L1 Cache Disable")
+	CACHE_MODE_1_RULES(GEN_PRE7, 0x2124),
+	CACHE_MODE_1_RULES(GEN(7), 0x7004),
+
+	CHICKEN(GEN_PRE7, "3D_CHICKEN", 0x2084),
+	CHICKEN(GEN_PRE7, "3D_CHICKEN2", 0x208c),
+	CHICKEN(GEN(7), "FF_SLICE_CHICKEN", 0x2088),
+	CHICKEN(GEN_6_7, "3D_CHICKEN3", 0x2090),
+
+	PERF(GEN(6), "3D_CHICKEN4", 0x20d4, 6, true,
+	     "3D Scoreboard Hashing Enable", "scoreboard serialises threads"),
+	UNSET(GEN(6), "3D_CHICKEN4", 0x20d4, 0x0fbf,
+	      "other non-thread deps bits"),
+
+	CHICKEN(GEN(7), "FF_SLICE_CS_CHICKEN1", 0x20e0),
+	CHICKEN(GEN(7), "FF_SLICE_CS_CHICKEN2", 0x20e4),
+	CHICKEN(GEN(7), "FF_SLICE_CS_CHICKEN3", 0x20e8),
+	CHICKEN(GEN(7), "COMMON_SLICE_CHICKEN1", 0x7010),
+	CHICKEN(GEN(7), "COMMON_SLICE_CHICKEN2", 0x7014),
+	CHICKEN(GEN(7), "WM_CHICKEN", 0x5580),
+	CHICKEN(GEN(7), "HALF_SLICE_CHICKEN", 0xe100),
+	CHICKEN(GEN(7), "HALF_SLICE_CHICKEN2", 0xe180),
+	CHICKEN(GEN(7), "ROW_CHICKEN", 0xe4f0),
+	CHICKEN(GEN(7), "ROW_CHICKEN2", 0xe4f4),
+
+	CHICKEN(GEN_ALL, "ECOSKPD", 0x21d0),
 
+	/* This is needed for framebuffer compression for us to be
+	 * able to access the framebuffer by the CPU through the GTT.
+	 */
+	MUST(GEN(6), "DPFC_CONTROL_SA", 0x100100, 29, true,
+	     "CPU Fence Enable"),
+};
+
+enum rule_result {
+	RESULT_OK,
+	RESULT_FAIL,
+	RESULT_PERF,
+	RESULT_WARN,
+	RESULT_MISSING,
+	NUM_RESULTS
+};
+
+static const char *result_names[NUM_RESULTS] = {
+	"ok", "fail", "perf", "warn", "missing"
+};
+
+static const struct reg_rule *active[ARRAY_SIZE(rules)];
+static int num_active;
+
+static const char *source = "live";
+static size_t mmio_size;
+static struct intel_dump_range *dump_ranges;	/* NULL for live registers */
+static uint32_t num_dump_ranges;
+static uint32_t devid;
+static int gen;
+static bool quiet, csv;
 
+/*
+ * Keep the rules that apply to this device, preserving table order so
+ * rules on the same register stay adjacent.
+ */
 static void
-check_3d_chicken4(void)
+select_rules(void)
 {
-	/* Described in page 23-25 of the IHD_OS_Vol1_Part3.pdf
-	 * specification.
-	 */
-	uint32_t _3d_chicken4 = read_and_print_reg("3D_CHICKEN4", 0x20d4);
+	unsigned i;
 
-	check_perf_bit(_3d_chicken4, 6, "3D Scoreboard Hashing Enable", true);
+	for (i = 0; i < ARRAY_SIZE(rules); i++) {
+		const struct reg_rule *r = &rules[i];
 
-	if (_3d_chicken4 & 0x0fbf) {
-		fprintf(stderr,
-			"         WARN:   other non-thread deps bits set\n");
-	} else {
-		printf("           OK:   other non-thread deps bits unset\n");
+		if (!(r->gens & GEN(gen)))
+			continue;
+		if (r->applies && !r->applies(devid))
+			continue;
+		active[num_active++] = r;
 	}
 }
 
+static inline uint32_t
+read_reg(uint32_t reg)
+{
+	return *(volatile uint32_t *)((volatile char *)mmio + reg);
+}
+
 static void
-check_dpfc_control_sa(void)
+print_rule(const struct reg_rule *r, uint32_t val, enum rule_result result)
 {
-	uint32_t dpfc_control_sa;
+	bool set = r->expected != 0;
+	int bit = ffs(r->mask) - 1;
 
-	if (gen != 6)
+	if (csv) {
+		printf("%s,0x%04x,%s,0x%x,0x%08x,0x%08x,0x%08x,%s,\"%s\"\n",
+		       source, devid, r->reg_name, r->reg, val, r->mask,
+		       r->expected, result_names[result], r->name);
 		return;
+	}
 
-	dpfc_control_sa = read_and_print_reg("DPFC_CONTROL_SA", 0x100100);
+	if (quiet && result == RESULT_OK)
+		return;
 
-	/* This is needed for framebuffer compression for us to be
-	 * able to access the framebuffer by the CPU through the GTT.
-	 */
-	check_bit(dpfc_control_sa, 29, "CPU Fence Enable", true);
+	switch (result) {
+	case RESULT_OK:
+		if (r->severity == RULE_WARN)
+			printf("           OK:   %s unset\n", r->name);
+		else
+			printf("  (bit %2d) OK:   %s\n", bit, r->name);
+		break;
+	case RESULT_FAIL:
+		fprintf(stderr, "  (bit %2d) FAIL: %s must be %s\n",
+			bit, r->name, set ? "set" : "unset");
+		break;
+	case RESULT_PERF:
+		printf("  (bit %2d) PERF: %s should be %s",
+		       bit, r->name, set ? "set" : "unset");
+		if (r->impact)
+			printf(" (%s)", r->impact);
+		printf("\n");
+		break;
+	case RESULT_WARN:
+		fprintf(stderr, "           WARN: %s set (0x%08x)\n",
+			r->name, val & r->mask);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Sparse dumps read back 0 outside what they captured, don't trust that */
+static bool
+reg_captured(uint32_t reg)
+{
+	uint32_t i;
+
+	if (!dump_ranges)
+		return true;
+
+	for (i = 0; i < num_dump_ranges; i++)
+		if (reg >= dump_ranges[i].base &&
+		    reg - dump_ranges[i].base + 4 <= dump_ranges[i].size)
+			return true;
+
+	return false;
+}
+
+static void
+check_rules(unsigned counts[NUM_RESULTS])
+{
+	const struct reg_rule *r;
+	enum rule_result result;
+	uint32_t val = 0;
+	bool missing = false, shown = false;
+	int i;
+
+	for (i = 0; i < num_active; i++) {
+		r = active[i];
+
+		if (i == 0 || r->reg != active[i - 1]->reg) {
+			missing = !reg_captured(r->reg);
+			if (!missing)
+				val = read_reg(r->reg);
+
+			shown = false;
+			if (missing && !csv)
+				fprintf(stderr, "%s (0x%x): not in snapshot\n",
+					r->reg_name, r->reg);
+		}
+
+		/* Register only printed, nothing to check */
+		if (!r->name) {
+			if (!csv && !quiet && !missing) {
+				printf("%s (0x%x): 0x%08x\n",
+				       r->reg_name, r->reg, val);
+				shown = true;
+			}
+			continue;
+		}
+
+		if (missing)
+			result = RESULT_MISSING;
+		else if ((val & r->mask) == r->expected)
+			result = RESULT_OK;
+		else if (r->severity == RULE_MUST)
+			result = RESULT_FAIL;
+		else if (r->severity == RULE_PERF)
+			result = RESULT_PERF;
+		else
+			result = RESULT_WARN;
+
+		counts[result]++;
+		if (missing)
+			continue;
+
+		/* In quiet mode only name registers that have violations */
+		if (!csv && !shown && (!quiet || result != RESULT_OK)) {
+			printf("%s (0x%x): 0x%08x\n", r->reg_name, r->reg, val);
+			shown = true;
+		}
+		print_rule(r, val, result);
+	}
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"  -f file   check a register snapshot instead of the hardware\n"
+		"  -d devid  device id of the snapshot (default: from the dump)\n"
+		"  -q        only report rules that are violated\n"
+		"  -c        print one CSV line per rule\n"
+		"  -h        this help\n"
+		"Exits with 1 if any required setting is violated.\n", prog);
 }
 
 int main(int argc, char** argv)
 {
-	struct pci_device *dev;
+	unsigned counts[NUM_RESULTS] = { 0 };
+	char *file = NULL;
+	uint32_t dump_devid = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:d:qch")) != -1) {
+		switch (opt) {
+		case 'f':
+			file = optarg;
+			break;
+		case 'd':
+			devid = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		case 'c':
+			csv = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
-	dev = intel_get_pci_device();
-	devid = dev->device_id;
-	intel_get_mmio(dev);
+	if (file) {
+		mmio = intel_load_dump_ranges(file, &mmio_size, &dump_devid,
+					      &dump_ranges, &num_dump_ranges);
+		if (!devid)
+			devid = dump_devid;
+		if (!devid)
+			errx(1, "%s doesn't record a device id, use -d", file);
+		source = file;
+	} else {
+		struct pci_device *dev = intel_get_pci_device();
+
+		devid = dev->device_id;
+		intel_get_mmio(dev);
+	}
 
 	if (IS_GEN7(devid))
 		gen = 7;
@@ -360,40 +508,20 @@ int main(int argc, char** argv)
 	else
 		gen = 4;
 
-	check_mi_mode();
-	check_gfx_mode();
-	check_gt_mode();
-	check_cache_mode_0();
-	check_cache_mode_1();
-
-	if (gen < 7) {
- 		check_chicken_unset("3D_CHICKEN", 0x2084);
- 		check_chicken_unset("3D_CHICKEN2", 0x208c);
-	} else {
-		check_chicken_unset("FF_SLICE_CHICKEN", 0x2088);
+	select_rules();
+	check_rules(counts);
+
+	if (!csv) {
+		printf("%u rules: %u ok, %u perf, %u fail, %u warn",
+		       counts[RESULT_OK] + counts[RESULT_PERF] +
+		       counts[RESULT_FAIL] + counts[RESULT_WARN] +
+		       counts[RESULT_MISSING], counts[RESULT_OK], counts[RESULT_PERF],
+		       counts[RESULT_FAIL], counts[RESULT_WARN]);
+		if (counts[RESULT_MISSING])
+			printf(", %u not in snapshot", counts[RESULT_MISSING]);
+		printf("\n");
 	}
-	if (gen >= 6)
-		check_chicken_unset("3D_CHICKEN3", 0x2090);
-	if (gen == 6)
-		check_3d_chicken4();
-
-	if (gen >= 7) {
-		check_chicken_unset("FF_SLICE_CS_CHICKEN1", 0x20e0);
-		check_chicken_unset("FF_SLICE_CS_CHICKEN2", 0x20e4);
-		check_chicken_unset("FF_SLICE_CS_CHICKEN3", 0x20e8);
-		check_chicken_unset("COMMON_SLICE_CHICKEN1", 0x7010);
-		check_chicken_unset("COMMON_SLICE_CHICKEN2", 0x7014);
-		check_chicken_unset("WM_CHICKEN", 0x5580);
-		check_chicken_unset("HALF_SLICE_CHICKEN", 0xe100);
-		check_chicken_unset("HALF_SLICE_CHICKEN2", 0xe180);
-		check_chicken_unset("ROW_CHICKEN", 0xe4f0);
-		check_chicken_unset("ROW_CHICKEN2", 0xe4f4);
-	}
-
-	check_chicken_unset("ECOSKPD", 0x21d0);
 
-	check_dpfc_control_sa();
-
-	return 0;
+	free(dump_ranges);
+	return counts[RESULT_FAIL] ? 1 : 0;
 }
-
@@ -33,6 +33,7 @@
 #include <string.h>
 #include <err.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include "intel_gpu_tools.h"
 
 static uint32_t devid = 0;
@@ -2011,27 +2012,138 @@ dump_reg(struct reg_debug *reg, uint32_t val, const char *prefix)
 	}
 }
 
+/*
+ * Lookup indices over all known_registers[] entries, sorted by address and
+ * by name, so that decoding a register is a binary search rather than a
+ * scan of every table. Built on first use.
+ */
+struct reg_index {
+	struct reg_debug *reg;
+	const char *description;
+	int table;
+	int order;
+};
+
+static struct reg_index *regs_by_addr, *regs_by_name;
+static int num_indexed_regs;
+
+static int
+reg_index_addr_cmp(const void *a, const void *b)
+{
+	const struct reg_index *x = a, *y = b;
+
+	if (x->reg->reg != y->reg->reg)
+		return x->reg->reg < y->reg->reg ? -1 : 1;
+	/* keep the table order for identical addresses */
+	return x->order - y->order;
+}
+
+static int
+reg_index_name_cmp(const void *a, const void *b)
+{
+	const struct reg_index *x = a, *y = b;
+	int ret;
+
+	ret = strcasecmp(x->reg->name, y->reg->name);
+	if (ret)
+		return ret;
+	return x->order - y->order;
+}
+
 static void
-str_to_upper(char *str)
+build_reg_index(void)
+{
+	int i, j, n = 0;
+
+	if (regs_by_addr)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(known_registers); i++)
+		n += known_registers[i].count;
+
+	regs_by_addr = malloc(2 * n * sizeof(*regs_by_addr));
+	if (regs_by_addr == NULL)
+		err(1, "failed to allocate register index");
+	regs_by_name = regs_by_addr + n;
+
+	n = 0;
+	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
+		for (j = 0; j < known_registers[i].count; j++) {
+			regs_by_addr[n].reg = &known_registers[i].regs[j];
+			regs_by_addr[n].description =
+				known_registers[i].description;
+			regs_by_addr[n].table = i;
+			regs_by_addr[n].order = n;
+			n++;
+		}
+	}
+	num_indexed_regs = n;
+
+	memcpy(regs_by_name, regs_by_addr, n * sizeof(*regs_by_addr));
+	qsort(regs_by_addr, n, sizeof(*regs_by_addr), reg_index_addr_cmp);
+	qsort(regs_by_name, n, sizeof(*regs_by_name), reg_index_name_cmp);
+}
+
+/* Index of the first entry in regs_by_name not ordered before @name */
+static int
+lookup_reg_name(const char *name)
+{
+	int lo = 0, hi = num_indexed_regs;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (strcasecmp(regs_by_name[mid].reg->name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Index of the first entry in regs_by_addr not below @address */
+static int
+lookup_reg_address(int address)
 {
-	while(*str) {
-		*str = toupper(*str);
-		str++;
+	int lo = 0, hi = num_indexed_regs;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (regs_by_addr[mid].reg->reg < address)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+
+	return lo;
 }
 
 static void
-decode_register_name(char *name, uint32_t val)
+decode_register_name(const char *name, uint32_t val)
 {
-	int i, j;
+	int i, found = 0;
 
-	str_to_upper(name);
+	build_reg_index();
 
+	for (i = lookup_reg_name(name); i < num_indexed_regs &&
+	     strcasecmp(regs_by_name[i].reg->name, name) == 0; i++) {
+		dump_reg(regs_by_name[i].reg, val,
+			 regs_by_name[i].description);
+		found++;
+	}
+
+	if (found)
+		return;
+
+	/* no exact match, fall back to a partial name lookup */
 	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
 		struct reg_debug *regs = known_registers[i].regs;
+		int j;
 
 		for (j = 0; j < known_registers[i].count; j++)
-			if (strstr(regs[j].name, name))
+			if (strcasestr(regs[j].name, name))
 				dump_reg(&regs[j], val,
 					 known_registers[i].description);
 	}
@@ -2040,20 +2152,18 @@ decode_register_name(char *name, uint32_t val)
 static void
 decode_register_address(int address, uint32_t val)
 {
-	int i, j;
+	int i;
 
-	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
-		struct reg_debug *regs = known_registers[i].regs;
+	build_reg_index();
 
-		for (j = 0; j < known_registers[i].count; j++)
-			if (regs[j].reg == address)
-				dump_reg(&regs[j], val,
-					 known_registers[i].description);
-	}
+	for (i = lookup_reg_address(address); i < num_indexed_regs &&
+	     regs_by_addr[i].reg->reg == address; i++)
+		dump_reg(regs_by_addr[i].reg, val,
+			 regs_by_addr[i].description);
 }
 
 static void
-decode_register(char *name, uint32_t val)
+decode_register(const char *name, uint32_t val)
 {
 	long int address;
 	char *end;
@@ -2067,6 +2177,184 @@ decode_register(char *name, uint32_t val)
 		decode_register_name(name, val);
 }
 
+/*
+ * Batch mode: decode "register value" pairs, one per line, read from
+ * stdin. Blank lines and lines starting with '#' are skipped.
+ */
+static void
+decode_register_stream(FILE *file)
+{
+	char *line = NULL, *name, *value, *end;
+	size_t line_size = 0;
+	int line_number = 0;
+	uint32_t val;
+
+	while (getline(&line, &line_size, file) > 0) {
+		line_number++;
+
+		name = line + strspn(line, " \t");
+		if (*name == '#' || *name == '\n' || *name == '\0')
+			continue;
+
+		value = name + strcspn(name, " \t=:");
+		if (*value == '\0' || *value == '\n') {
+			fprintf(stderr, "line %d: missing value\n",
+				line_number);
+			continue;
+		}
+		*value++ = '\0';
+		value += strspn(value, " \t=:");
+
+		val = strtoul(value, &end, 0);
+		if (end == value) {
+			fprintf(stderr, "line %d: invalid value\n",
+				line_number);
+			continue;
+		}
+
+		decode_register(name, val);
+	}
+
+	free(line);
+}
+
+/*
+ * Diff mode: compare a sequence of register snapshots and only decode the
+ * registers from the tables applicable to devid whose value changed.
+ */
+struct snapshot {
+	const char *filename;
+	void *map;
+	size_t size;
+	uint32_t devid;
+};
+
+static void
+map_snapshot(struct snapshot *snap, const char *filename)
+{
+	snap->filename = filename;
+	snap->map = intel_load_dump(filename, &snap->size, &snap->devid);
+}
+
+static void
+unmap_snapshot(struct snapshot *snap)
+{
+	munmap(snap->map, snap->size);
+}
+
+static bool
+table_applies(int table)
+{
+	struct reg_debug *regs = known_registers[table].regs;
+
+	if (regs == ironlake_debug_regs)
+		return HAS_PCH_SPLIT(devid);
+	if (regs == i945gm_mi_regs)
+		return IS_945GM(devid);
+	if (regs == intel_debug_regs)
+		return !HAS_PCH_SPLIT(devid);
+	if (regs == gen6_rp_debug_regs)
+		return IS_GEN6(devid) || IS_GEN7(devid);
+	if (regs == haswell_debug_regs)
+		return IS_HASWELL(devid);
+
+	return false;
+}
+
+static uint32_t
+snapshot_read(struct snapshot *snap, uint32_t reg)
+{
+	uint32_t val;
+
+	memcpy(&val, (char *)snap->map + reg, sizeof(val));
+	return val;
+}
+
+static void
+diff_reg(struct reg_debug *reg, struct snapshot *old, struct snapshot *new)
+{
+	uint32_t old_val = snapshot_read(old, reg->reg);
+	uint32_t new_val = snapshot_read(new, reg->reg);
+	char old_debug[1024], new_debug[1024];
+
+	if (old_val == new_val)
+		return;
+
+	if (reg->debug_output == NULL) {
+		printf("%30.30s: 0x%08x -> 0x%08x\n",
+		       reg->name, old_val, new_val);
+		return;
+	}
+
+	/* some decoders peek at related registers through INREG() */
+	mmio = old->map;
+	reg->debug_output(old_debug, sizeof(old_debug), reg->reg, old_val);
+	mmio = new->map;
+	reg->debug_output(new_debug, sizeof(new_debug), reg->reg, new_val);
+
+	printf("%30.30s: 0x%08x (%s) -> 0x%08x (%s)\n",
+	       reg->name, old_val, old_debug, new_val, new_debug);
+}
+
+static void
+diff_snapshots(struct snapshot *old, struct snapshot *new)
+{
+	const size_t page = 4096;
+	size_t size = (old->size < new->size ? old->size : new->size) & ~3;
+	const uint32_t *a = old->map, *b = new->map;
+	int last = -1, i;
+	size_t offset, w;
+
+	printf("--- %s\n+++ %s\n", old->filename, new->filename);
+
+	for (offset = 0; offset < size; offset += page) {
+		size_t len = size - offset < page ? size - offset : page;
+
+		/* let libc do the wide compares, almost all pages match */
+		if (memcmp(a + offset / 4, b + offset / 4, len) == 0)
+			continue;
+
+		for (w = offset / 4; w < (offset + len) / 4; w++) {
+			int addr = w * 4;
+
+			if (a[w] == b[w])
+				continue;
+
+			/* catch registers that are not dword aligned too */
+			for (i = lookup_reg_address(addr - 3);
+			     i < num_indexed_regs &&
+			     regs_by_addr[i].reg->reg < addr + 4; i++) {
+				struct reg_debug *reg = regs_by_addr[i].reg;
+
+				if (reg->reg <= last ||
+				    reg->reg + 4 > size ||
+				    !table_applies(regs_by_addr[i].table))
+					continue;
+
+				diff_reg(reg, old, new);
+				last = reg->reg;
+			}
+		}
+	}
+}
+
+static void
+diff_snapshot_files(char **files, int count)
+{
+	struct snapshot snap[2];
+	int i;
+
+	build_reg_index();
+
+	map_snapshot(&snap[0], files[0]);
+	for (i = 1; i < count; i++) {
+		map_snapshot(&snap[i & 1], files[i]);
+		diff_snapshots(&snap[~i & 1], &snap[i & 1]);
+		unmap_snapshot(&snap[~i & 1]);
+	}
+	unmap_snapshot(&snap[~i & 1]);
+}
+
 static void
 intel_dump_other_regs(void)
 {
@@ -2276,7 +2564,12 @@ static void print_usage(void)
 {
 	printf("Usage: intel_reg_dumper [options] [file]\n"
 	       "       intel_reg_dumper [options] register value\n"
+	       "       intel_reg_dumper [options] -b < pairs\n"
+	       "       intel_reg_dumper [options] -D file file...\n"
 	       "Options:\n"
+	       "  -b      decode 'register value' pairs read from stdin\n"
+	       "  -D      only decode registers that changed between "
+	       "consecutive dump files\n"
 	       "  -d id   when a dump file is used, use 'id' as device id (in "
 	       "hex)\n"
 	       "  -h      prints this help\n");
@@ -2288,9 +2581,16 @@ int main(int argc, char** argv)
 	int opt, n_args;
 	char *file = NULL, *reg_name = NULL;
 	uint32_t reg_val;
+	bool batch = false, diff = false;
 
-	while ((opt = getopt(argc, argv, "d:h")) != -1) {
+	while ((opt = getopt(argc, argv, "bDd:h")) != -1) {
 		switch (opt) {
+		case 'b':
+			batch = true;
+			break;
+		case 'D':
+			diff = true;
+			break;
 		case 'd':
 			devid = strtol(optarg, NULL, 16);
 			break;
@@ -2304,7 +2604,12 @@ int main(int argc, char** argv)
 	}
 
 	n_args = argc - optind;
-	if (n_args == 1) {
+	if (diff) {
+		if (n_args < 2) {
+			print_usage();
+			return 1;
+		}
+	} else if (n_args == 1) {
 		file = argv[optind];
 	} else if (n_args == 2) {
 		reg_name = argv[optind];
@@ -2314,6 +2619,15 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
+	if (batch) {
+		if (n_args) {
+			print_usage();
+			return 1;
+		}
+		decode_register_stream(stdin);
+		return 0;
+	}
+
 	/* the tool operates in "single" mode, decode a single register given
 	 * on the command line: intel_reg_dumper PCH_PP_CONTROL 0xabcd0002 */
 	if (reg_name) {
@@ -2321,8 +2635,21 @@ int main(int argc, char** argv)
 		return 0;
 	}
 
-	if (file) {
-		intel_map_file(file);
+	if (file || diff) {
+		uint32_t dump_devid = 0;
+
+		if (file) {
+			mmio = intel_load_dump(file, NULL, &dump_devid);
+		} else {
+			struct snapshot snap;
+
+			/* sparse dumps record the device they come from */
+			map_snapshot(&snap, argv[optind]);
+			dump_devid = snap.devid;
+			unmap_snapshot(&snap);
+		}
+		if (!devid)
+			devid = dump_devid;
 		if (devid) {
 			if (IS_GEN5(devid))
 				pch = PCH_IBX;
@@ -2334,6 +2661,11 @@ int main(int argc, char** argv)
 			devid = 0x0042;
 			pch = PCH_IBX;
 		}
+
+		if (diff) {
+			diff_snapshot_files(argv + optind, n_args);
+			return 0;
+		}
 	} else {
 		pci_dev = intel_get_pci_device();
 		devid = pci_dev->device_id;
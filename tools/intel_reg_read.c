@@ -25,11 +25,16 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <err.h>
 #include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include "intel_gpu_tools.h"
 
 static void bit_decode(uint32_t reg)
@@ -54,6 +59,219 @@ static void dump_range(uint32_t start, uint32_t end)
 		       *(volatile uint32_t *)((volatile char*)mmio + i));
 }
 
+/*
+ * Watch mode: a sampler thread polls the requested registers and pushes
+ * every value transition into a single producer/single consumer ring, the
+ * main thread drains the ring to stdout or to a binary log.
+ */
+#define WATCH_RING_SIZE (1 << 16)
+
+struct watch_event {
+	uint64_t timestamp; /* CLOCK_MONOTONIC, ns */
+	uint32_t reg;
+	uint32_t old_val;
+	uint32_t new_val;
+	uint32_t pad;
+};
+
+/* Binary log layout: this header followed by struct watch_event records */
+struct watch_log_header {
+	char magic[4]; /* "IRWL" */
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t pad;
+};
+
+static struct {
+	uint32_t *regs;
+	uint32_t *vals;
+	int count;
+	int interval_us;
+	int cpu;
+
+	struct watch_event ring[WATCH_RING_SIZE];
+	unsigned int head; /* written by the sampler */
+	unsigned int tail; /* written by the consumer */
+	unsigned long dropped;
+	unsigned long samples;
+	volatile int done;
+} watch;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void watch_push(uint64_t timestamp, uint32_t reg,
+		       uint32_t old_val, uint32_t new_val)
+{
+	unsigned int head = watch.head;
+	struct watch_event *ev;
+
+	if (head - __atomic_load_n(&watch.tail, __ATOMIC_ACQUIRE) ==
+	    WATCH_RING_SIZE) {
+		watch.dropped++;
+		return;
+	}
+
+	ev = &watch.ring[head & (WATCH_RING_SIZE - 1)];
+	ev->timestamp = timestamp;
+	ev->reg = reg;
+	ev->old_val = old_val;
+	ev->new_val = new_val;
+	ev->pad = 0;
+
+	__atomic_store_n(&watch.head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void *watch_sampler(void *arg)
+{
+	int i;
+
+	if (watch.cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(watch.cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set))
+			warn("failed to pin sampler to cpu %d", watch.cpu);
+	}
+
+	for (i = 0; i < watch.count; i++)
+		watch.vals[i] = INREG(watch.regs[i]);
+
+	while (!watch.done) {
+		uint64_t timestamp = now_ns();
+
+		for (i = 0; i < watch.count; i++) {
+			uint32_t val = INREG(watch.regs[i]);
+
+			if (val != watch.vals[i]) {
+				watch_push(timestamp, watch.regs[i],
+					   watch.vals[i], val);
+				watch.vals[i] = val;
+			}
+		}
+		watch.samples++;
+
+		if (watch.interval_us)
+			usleep(watch.interval_us);
+	}
+
+	return NULL;
+}
+
+static void print_event(const struct watch_event *ev, uint64_t start,
+			int decode_bits)
+{
+	uint32_t changed = ev->old_val ^ ev->new_val;
+	uint64_t t = ev->timestamp - start;
+	int i;
+
+	printf("%llu.%09llu 0x%05X : 0x%08X -> 0x%08X",
+	       (unsigned long long)(t / 1000000000),
+	       (unsigned long long)(t % 1000000000),
+	       ev->reg, ev->old_val, ev->new_val);
+
+	if (decode_bits) {
+		for (i = 31; i >= 0; i--)
+			if (changed & (1u << i))
+				printf(" %c%d",
+				       ev->new_val & (1u << i) ? '+' : '-', i);
+	}
+	printf("\n");
+}
+
+static void watch_drain(FILE *out, uint64_t start, int decode_bits)
+{
+	unsigned int head = __atomic_load_n(&watch.head, __ATOMIC_ACQUIRE);
+	unsigned int tail = watch.tail;
+
+	while (tail != head) {
+		struct watch_event *ev =
+			&watch.ring[tail & (WATCH_RING_SIZE - 1)];
+
+		if (out)
+			fwrite(ev, sizeof(*ev), 1, out);
+		else
+			print_event(ev, start, decode_bits);
+		tail++;
+	}
+
+	__atomic_store_n(&watch.tail, tail, __ATOMIC_RELEASE);
+}
+
+static void watch_stop(int sig)
+{
+	watch.done = 1;
+}
+
+static int watch_registers(uint32_t *regs, int count, int interval_us,
+			   int cpu, int duration, const char *log,
+			   int decode_bits)
+{
+	struct watch_log_header header = {
+		.magic = "IRWL",
+		.version = 1,
+		.record_size = sizeof(struct watch_event),
+	};
+	FILE *out = NULL;
+	pthread_t thread;
+	uint64_t start, end;
+	int ret;
+
+	watch.regs = regs;
+	watch.count = count;
+	watch.vals = calloc(count, sizeof(*watch.vals));
+	watch.interval_us = interval_us;
+	watch.cpu = cpu;
+	if (watch.vals == NULL)
+		err(1, "failed to allocate watch state");
+
+	if (log) {
+		out = fopen(log, "w");
+		if (out == NULL)
+			err(1, "failed to open %s", log);
+		fwrite(&header, sizeof(header), 1, out);
+	}
+
+	signal(SIGINT, watch_stop);
+	signal(SIGTERM, watch_stop);
+
+	start = now_ns();
+	end = duration ? start + duration * 1000000000ULL : 0;
+
+	ret = pthread_create(&thread, NULL, watch_sampler, NULL);
+	if (ret)
+		errx(1, "failed to start sampler: %s", strerror(ret));
+
+	while (!watch.done) {
+		watch_drain(out, start, decode_bits);
+
+		if (end && now_ns() >= end)
+			break;
+		usleep(10000);
+	}
+
+	watch.done = 1;
+	pthread_join(thread, NULL);
+	watch_drain(out, start, decode_bits);
+
+	if (out)
+		fclose(out);
+	else
+		fflush(stdout);
+
+	fprintf(stderr, "%lu samples in %.3fs, %lu events dropped\n",
+		watch.samples, (now_ns() - start) / 1e9, watch.dropped);
+
+	free(watch.vals);
+	return 0;
+}
+
 static void usage(char *cmdname)
 {
 	printf("Usage: %s [-f|-d] [addr1] [addr2] .. [addrN]\n", cmdname);
@@ -61,6 +279,12 @@ static void usage(char *cmdname)
 	printf("\t      WARNING! This option may result in a machine hang!\n");
 	printf("\t -d : decode register bits.\n");
 	printf("\t -c : number of dwords to dump (can't be used with -f/-d).\n");
+	printf("\t -w usecs : watch the registers, polling every usecs, and\n");
+	printf("\t            print each value change (-d shows flipped bits).\n");
+	printf("\t            Can't be used with -f.\n");
+	printf("\t -t secs : stop watching after secs seconds.\n");
+	printf("\t -C cpu : pin the watch sampler to cpu.\n");
+	printf("\t -o file : write watch events to file in binary form.\n");
 	printf("\t addr : in 0xXXXX format\n");
 }
 
@@ -73,9 +297,23 @@ int main(int argc, char** argv)
 	int full_dump = 0;
 	int decode_bits = 0;
 	int dwords = 1;
+	int interval_us = -1, duration = 0, cpu = -1;
+	char *log = NULL;
 
-	while ((ch = getopt(argc, argv, "dfhc:")) != -1) {
+	while ((ch = getopt(argc, argv, "dfhc:w:t:C:o:")) != -1) {
 		switch(ch) {
+		case 'w':
+			interval_us = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			duration = strtol(optarg, NULL, 0);
+			break;
+		case 'C':
+			cpu = strtol(optarg, NULL, 0);
+			break;
+		case 'o':
+			log = optarg;
+			break;
 		case 'd':
 			decode_bits = 1;
 			break;
@@ -100,7 +338,16 @@ int main(int argc, char** argv)
 		goto out;
 	}
 
-	if ((dwords > 1) && (argc != 1 || full_dump || decode_bits)) {
+	/* the full range is dumped once, there is nothing to watch */
+	if (full_dump && interval_us >= 0) {
+		fprintf(stderr, "-f can't be combined with -w\n");
+		usage(cmdname);
+		ret = 1;
+		goto out;
+	}
+
+	if ((dwords > 1) && interval_us < 0 &&
+	    (argc != 1 || full_dump || decode_bits)) {
 		usage(cmdname);
 		ret = 1;
 		goto out;
@@ -108,7 +355,24 @@ int main(int argc, char** argv)
 
 	intel_register_access_init(intel_get_pci_device(), 0);
 
-	if (full_dump) {
+	if (interval_us >= 0) {
+		uint32_t *regs;
+		int j, n = 0;
+
+		regs = malloc(argc * dwords * sizeof(*regs));
+		if (regs == NULL)
+			err(1, "failed to allocate register list");
+
+		for (i = 0; i < argc; i++) {
+			sscanf(argv[i], "0x%x", &reg);
+			for (j = 0; j < dwords; j++)
+				regs[n++] = reg + j * 4;
+		}
+
+		ret = watch_registers(regs, n, interval_us, cpu, duration,
+				      log, decode_bits);
+		free(regs);
+	} else if (full_dump) {
 		dump_range(0x00000, 0x00fff);   /* VGA registers */
 		dump_range(0x02000, 0x02fff);   /* instruction, memory, interrupt control registers */
 		dump_range(0x03000, 0x031ff);   /* FENCE and PPGTT control registers */
@@ -24,16 +24,532 @@
  *	Adam Jackson <ajax@redhat.com>
  */
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <err.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include "intel_gpu_tools.h"
 
+/*
+ * Time series mode writes a stream of snapshots where only the 4KiB pages
+ * that changed since the previous snapshot are stored. Every few snapshots
+ * a keyframe holding every page is written, and a sidecar index file
+ * (<file>.idx) records where each snapshot starts so that the image at
+ * any point in time can be rebuilt by replaying from the closest keyframe.
+ *
+ * Pages are stored either raw or, with -z, as the run length encoding of
+ * the XOR with the previous image (zero for keyframes): register pages
+ * change a few dwords at a time, so that is mostly runs of zeroes.
+ */
+#define SERIES_MAGIC "IRTS"
+#define SERIES_VERSION 1
+#define PAGE_SIZE 4096
+#define PAGE_DWORDS (PAGE_SIZE / 4)
+
+#define SNAPSHOT_KEYFRAME (1 << 0)
+
+#define PAGE_RAW 0
+#define PAGE_XOR_RLE 1
+
+struct series_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t devid;
+	uint32_t page_size;
+	uint64_t image_size;
+};
+
+struct snapshot_record {
+	uint64_t timestamp; /* ns since the start of the series */
+	uint32_t num_pages;
+	uint32_t flags;
+};
+
+struct page_record {
+	uint32_t page;
+	uint16_t encoding;
+	uint16_t pad;
+	uint32_t length; /* of the payload following this record */
+};
+
+struct index_record {
+	uint64_t timestamp;
+	uint64_t offset;
+	uint32_t flags;
+	uint32_t pad;
+};
+
+static volatile int done;
+
+static void stop(int sig)
+{
+	done = 1;
+}
+
+static uint64_t time_ns(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000000ULL +
+		(now.tv_usec - start->tv_usec) * 1000ULL;
+}
+
+/*
+ * Ranges of the BAR that are safe to read, as per intel_get_register_map(),
+ * with adjacent ranges merged so that they can be copied in one go. Without
+ * a register map (gen2/3) the whole BAR is read.
+ */
+static struct intel_dump_range ranges[256];
+static int num_ranges;
+
+static void collect_ranges(uint32_t devid, size_t size)
+{
+	struct intel_register_map map;
+	struct intel_register_range *r;
+
+	num_ranges = 0;
+
+	if (intel_gen(devid) < 4) {
+		ranges[num_ranges].base = 0;
+		ranges[num_ranges].size = size;
+		num_ranges++;
+		return;
+	}
+
+	map = intel_get_register_map(devid);
+	for (r = map.map; !(r->flags & INTEL_RANGE_END); r++) {
+		uint32_t base = r->base, end = r->base + r->size + 1;
+
+		if (!(r->flags & INTEL_RANGE_READ) || base >= size)
+			continue;
+		if (end > size)
+			end = size;
+
+		if (num_ranges &&
+		    ranges[num_ranges - 1].base +
+		    ranges[num_ranges - 1].size == base) {
+			ranges[num_ranges - 1].size += end - base;
+			continue;
+		}
+
+		assert(num_ranges < ARRAY_SIZE(ranges));
+		ranges[num_ranges].base = base;
+		ranges[num_ranges].size = end - base;
+		num_ranges++;
+	}
+}
+
+static void capture_range(uint32_t *dst, uint32_t base, uint32_t size)
+{
+	uint32_t i;
+
+	for (i = 0; i < size / 4; i++)
+		dst[i] = INREG(base + i * 4);
+}
+
+/* Reads the safe ranges into the flat image @dst, the rest stays as is. */
+static void capture(uint32_t *dst)
+{
+	int i;
+
+	for (i = 0; i < num_ranges; i++)
+		capture_range(dst + ranges[i].base / 4,
+			      ranges[i].base, ranges[i].size);
+}
+
+/*
+ * Encodes @cur ^ @prev as a sequence of (zero dwords, literal dwords)
+ * 16 bit pairs each followed by the literals. Returns the encoded size in
+ * bytes, or 0 if that would not be smaller than the raw page.
+ */
+static size_t encode_page(const uint32_t *cur, const uint32_t *prev,
+			  uint32_t *out)
+{
+	uint32_t *o = out;
+	int i = 0;
+
+	while (i < PAGE_DWORDS) {
+		uint16_t zeros = 0, literals = 0;
+		int j;
+
+		while (i < PAGE_DWORDS && (cur[i] ^ prev[i]) == 0) {
+			zeros++;
+			i++;
+		}
+		while (i + literals < PAGE_DWORDS &&
+		       (cur[i + literals] ^ prev[i + literals]) != 0)
+			literals++;
+
+		if (o - out + 1 + literals >= PAGE_DWORDS)
+			return 0;
+
+		*o++ = zeros | literals << 16;
+		for (j = 0; j < literals; j++, i++)
+			*o++ = cur[i] ^ prev[i];
+	}
+
+	return (o - out) * 4;
+}
+
+static int decode_page(const uint32_t *in, size_t length, uint32_t *page)
+{
+	const uint32_t *end = in + length / 4;
+	int i = 0;
+
+	while (in < end) {
+		int zeros = *in & 0xffff, literals = *in >> 16;
+
+		in++;
+		i += zeros;
+		if (i + literals > PAGE_DWORDS || in + literals > end)
+			return -1;
+		while (literals--)
+			page[i++] ^= *in++;
+	}
+
+	return 0;
+}
+
+static void xwrite(FILE *file, const void *data, size_t size)
+{
+	if (size && fwrite(data, size, 1, file) != 1)
+		err(1, "write failed");
+}
+
+static int record_series(const char *filename, uint32_t devid, size_t size,
+			 int interval_ms, int count, int keyframe_interval,
+			 int compress)
+{
+	struct series_header header = {
+		.magic = SERIES_MAGIC,
+		.version = SERIES_VERSION,
+		.devid = devid,
+		.page_size = PAGE_SIZE,
+		.image_size = size,
+	};
+	uint32_t *cur, *prev, *zero, *encoded;
+	size_t num_pages = size / PAGE_SIZE, page;
+	uint64_t bytes = 0;
+	struct timeval start;
+	FILE *out, *idx;
+	char *idx_name;
+	int n;
+
+	size = num_pages * PAGE_SIZE;
+	cur = calloc(size, 1);
+	prev = calloc(size, 1);
+	zero = calloc(PAGE_SIZE, 1);
+	encoded = malloc(PAGE_SIZE);
+	if (!cur || !prev || !zero || !encoded)
+		err(1, "failed to allocate snapshot buffers");
+
+	if (asprintf(&idx_name, "%s.idx", filename) < 0)
+		err(1, "failed to allocate index name");
+	out = fopen(filename, "w");
+	if (out == NULL)
+		err(1, "couldn't open %s", filename);
+	idx = fopen(idx_name, "w");
+	if (idx == NULL)
+		err(1, "couldn't open %s", idx_name);
+
+	xwrite(out, &header, sizeof(header));
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	gettimeofday(&start, NULL);
+
+	for (n = 0; !done && (!count || n < count); n++) {
+		struct snapshot_record snap = { 0 };
+		struct index_record index = { 0 };
+		int keyframe = n % keyframe_interval == 0;
+		uint32_t *tmp;
+
+		snap.timestamp = time_ns(&start);
+		capture(cur);
+
+		for (page = 0; page < num_pages; page++) {
+			uint32_t *p = cur + page * PAGE_DWORDS;
+			uint32_t *q = prev + page * PAGE_DWORDS;
+
+			if (keyframe || memcmp(p, q, PAGE_SIZE))
+				snap.num_pages++;
+		}
+		snap.flags = keyframe ? SNAPSHOT_KEYFRAME : 0;
+
+		index.timestamp = snap.timestamp;
+		index.offset = ftello(out);
+		index.flags = snap.flags;
+		xwrite(idx, &index, sizeof(index));
+		xwrite(out, &snap, sizeof(snap));
+
+		for (page = 0; page < num_pages; page++) {
+			uint32_t *p = cur + page * PAGE_DWORDS;
+			uint32_t *q = keyframe ? zero : prev + page * PAGE_DWORDS;
+			struct page_record rec = { .page = page };
+			const void *payload = p;
+
+			if (!keyframe && !memcmp(p, q, PAGE_SIZE))
+				continue;
+
+			rec.encoding = PAGE_RAW;
+			rec.length = PAGE_SIZE;
+			if (compress) {
+				size_t len = encode_page(p, q, encoded);
+
+				if (len) {
+					rec.encoding = PAGE_XOR_RLE;
+					rec.length = len;
+					payload = encoded;
+				}
+			}
+
+			xwrite(out, &rec, sizeof(rec));
+			xwrite(out, payload, rec.length);
+			bytes += sizeof(rec) + rec.length;
+		}
+
+		fflush(out);
+		fflush(idx);
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+
+		if (interval_ms && !done)
+			usleep(interval_ms * 1000);
+	}
+
+	fprintf(stderr, "%d snapshots, %llu bytes of page data (%.1f%% of raw)\n",
+		n, (unsigned long long)bytes,
+		n ? 100. * bytes / ((double)n * size) : 0.);
+
+	fclose(idx);
+	fclose(out);
+	free(idx_name);
+	free(encoded);
+	free(zero);
+	free(prev);
+	free(cur);
+	return 0;
+}
+
+/* Writes a sparse dump of the safe ranges to stdout. */
+static int write_sparse_dump(uint32_t devid, size_t size)
+{
+	struct intel_dump_header header = {
+		.magic = INTEL_DUMP_MAGIC,
+		.version = INTEL_DUMP_VERSION,
+		.devid = devid,
+		.image_size = size,
+		.num_ranges = num_ranges,
+	};
+	uint32_t *buf;
+	int i;
+
+	buf = malloc(size);
+	if (buf == NULL)
+		err(1, "failed to allocate snapshot buffer");
+
+	xwrite(stdout, &header, sizeof(header));
+	xwrite(stdout, ranges, num_ranges * sizeof(ranges[0]));
+	for (i = 0; i < num_ranges; i++) {
+		capture_range(buf, ranges[i].base, ranges[i].size);
+		xwrite(stdout, buf, ranges[i].size);
+	}
+	fflush(stdout);
+
+	free(buf);
+	return 0;
+}
+
+static void *map_file(const char *filename, size_t *size)
+{
+	struct stat st;
+	void *ptr;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		err(1, "couldn't open %s", filename);
+	if (fstat(fd, &st))
+		err(1, "couldn't stat %s", filename);
+	ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (ptr == MAP_FAILED)
+		err(1, "couldn't mmap %s", filename);
+	close(fd);
+
+	*size = st.st_size;
+	return ptr;
+}
+
+/* Writes to stdout the image as it was at @timestamp in the series. */
+static int rebuild_snapshot(const char *filename, uint64_t timestamp)
+{
+	const struct series_header *header;
+	const struct index_record *index;
+	size_t size, idx_size, pos;
+	int lo, hi, n, key, i;
+	char *idx_name, *data;
+	uint32_t *image;
+
+	data = map_file(filename, &size);
+	header = (const void *)data;
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, SERIES_MAGIC, 4) ||
+	    header->version != SERIES_VERSION ||
+	    header->page_size != PAGE_SIZE)
+		errx(1, "%s is not a register snapshot series", filename);
+
+	if (asprintf(&idx_name, "%s.idx", filename) < 0)
+		err(1, "failed to allocate index name");
+	index = map_file(idx_name, &idx_size);
+	n = idx_size / sizeof(*index);
+	if (n == 0)
+		errx(1, "%s is empty", idx_name);
+
+	/* last snapshot taken at or before timestamp */
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (index[mid].timestamp <= timestamp)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	n = lo ? lo - 1 : 0;
+
+	for (key = n; key > 0; key--)
+		if (index[key].flags & SNAPSHOT_KEYFRAME)
+			break;
+
+	image = calloc(header->image_size, 1);
+	if (image == NULL)
+		err(1, "failed to allocate image");
+
+	for (i = key; i <= n; i++) {
+		const struct snapshot_record *snap;
+		uint32_t p;
+
+		pos = index[i].offset;
+		if (pos + sizeof(*snap) > size)
+			errx(1, "truncated snapshot %d", i);
+		snap = (const void *)(data + pos);
+		pos += sizeof(*snap);
+
+		if (snap->flags & SNAPSHOT_KEYFRAME)
+			memset(image, 0, header->image_size);
+
+		for (p = 0; p < snap->num_pages; p++) {
+			const struct page_record *rec = (const void *)(data + pos);
+			uint32_t *page;
+
+			if (pos + sizeof(*rec) > size ||
+			    pos + sizeof(*rec) + rec->length > size ||
+			    (rec->page + 1) * (uint64_t)PAGE_SIZE >
+			    header->image_size)
+				errx(1, "corrupt snapshot %d", i);
+			pos += sizeof(*rec);
+
+			page = image + rec->page * PAGE_DWORDS;
+			if (rec->encoding == PAGE_RAW) {
+				if (rec->length != PAGE_SIZE)
+					errx(1, "corrupt page in snapshot %d", i);
+				memcpy(page, data + pos, PAGE_SIZE);
+			} else if (decode_page((const void *)(data + pos),
+					       rec->length, page)) {
+				errx(1, "corrupt page in snapshot %d", i);
+			}
+			pos += rec->length;
+		}
+	}
+
+	fprintf(stderr, "snapshot %d at %.3fs, device 0x%04x\n",
+		n, index[n].timestamp / 1e9, header->devid);
+
+	if (write(1, image, header->image_size) != (ssize_t)header->image_size)
+		err(1, "write failed");
+
+	free(image);
+	free(idx_name);
+	return 0;
+}
+
+static void usage(const char *cmdname)
+{
+	printf("Usage: %s [-a]\n", cmdname);
+	printf("       %s -i ms -o file [-n count] [-k keyframes] [-z]\n", cmdname);
+	printf("       %s -r file -t secs\n", cmdname);
+	printf("  -a : dump the whole BAR, even ranges that may hang the machine\n");
+	printf("  -i ms : take a snapshot every ms milliseconds, storing only changed pages\n");
+	printf("  -o file : series output file, an index goes to file.idx\n");
+	printf("  -n count : stop after count snapshots (default: until interrupted)\n");
+	printf("  -k keyframes : store every page each keyframes snapshots (default 64)\n");
+	printf("  -z : compress pages against the previous snapshot\n");
+	printf("  -r file -t secs : write the snapshot taken secs into series file to stdout\n");
+}
+
 int main(int argc, char** argv)
 {
 	struct pci_device *pci_dev;
 	uint32_t devid;
 	int mmio_bar;
 	int ret;
+	int interval_ms = -1, count = 0, keyframe_interval = 64, compress = 0;
+	int all = 0;
+	size_t size;
+	char *output = NULL, *series = NULL;
+	double at = 0;
+
+	while ((ret = getopt(argc, argv, "ai:o:n:k:zr:t:h")) != -1) {
+		switch (ret) {
+		case 'a':
+			all = 1;
+			break;
+		case 'i':
+			interval_ms = strtol(optarg, NULL, 0);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'n':
+			count = strtol(optarg, NULL, 0);
+			break;
+		case 'k':
+			keyframe_interval = strtol(optarg, NULL, 0);
+			break;
+		case 'z':
+			compress = 1;
+			break;
+		case 'r':
+			series = optarg;
+			break;
+		case 't':
+			at = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return ret == 'h' ? 0 : 1;
+		}
+	}
+
+	if (series)
+		return rebuild_snapshot(series, at * 1e9);
+
+	if (interval_ms >= 0 && (output == NULL || keyframe_interval < 1)) {
+		usage(argv[0]);
+		return 1;
+	}
 
 	pci_dev = intel_get_pci_device();
 	devid = pci_dev->device_id;
@@ -44,6 +560,20 @@ int main(int argc, char** argv)
 	else
 		mmio_bar = 0;
 
+	/* intel_get_mmio() only maps the register part of the BAR */
+	size = pci_dev->regions[mmio_bar].size;
+	if (size > (intel_gen(devid) < 5 ? 512 : 2048) * 1024)
+		size = (intel_gen(devid) < 5 ? 512 : 2048) * 1024;
+
+	collect_ranges(devid, size);
+
+	if (interval_ms >= 0)
+		return record_series(output, devid, size, interval_ms, count,
+				     keyframe_interval, compress);
+
+	if (!all)
+		return write_sparse_dump(devid, size);
+
 	ret = write(1, mmio, pci_dev->regions[mmio_bar].size);
 	assert(ret > 0);
 
@@ -28,31 +28,215 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <err.h>
+#include <sys/time.h>
 #include "intel_gpu_tools.h"
 
-int main(int argc, char** argv)
+/*
+ * Batch mode executes a script of register operations in one process,
+ * with register access (and so forcewake) set up only once. One step per
+ * line, numbers in any base strtoul() accepts, '#' starts a comment:
+ *
+ *   write <reg> <value>
+ *   rmw <reg> <mask> <value>           only update the bits in mask
+ *   wait <reg> <mask> <value> [ms]     poll until (reg & mask) == value
+ *   delay <usecs>
+ *   read <reg>
+ */
+#define DEFAULT_WAIT_TIMEOUT_MS 1000
+
+static double elapsed_us(struct timeval *start)
 {
-	uint32_t reg, value;
-	volatile uint32_t *ptr;
-
-	if (argc < 3) {
-		printf("Usage: %s addr value\n", argv[0]);
-		printf("  WARNING: This is dangerous to you and your system's health.\n");
-		printf("           Only for use in debugging.\n");
-		exit(1);
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1e6 +
+		(now.tv_usec - start->tv_usec);
+}
+
+static int parse_args(char *args, uint32_t *val, int max)
+{
+	char *tok, *end;
+	int n = 0;
+
+	while ((tok = strtok(args, " \t\n")) != NULL) {
+		args = NULL;
+		if (n == max)
+			return -1;
+		val[n++] = strtoul(tok, &end, 0);
+		if (*end)
+			return -1;
 	}
 
-	intel_register_access_init(intel_get_pci_device(), 0);
-	sscanf(argv[1], "0x%x", &reg);
-	sscanf(argv[2], "0x%x", &value);
-	ptr = (volatile uint32_t *)((volatile char *)mmio + reg);
+	return n;
+}
 
-	printf("Value before: 0x%X\n", *ptr);
-	*ptr = value;
-	printf("Value after: 0x%X\n", *ptr);
+static int run_step(char *line, int line_number)
+{
+	struct timeval start;
+	uint32_t arg[4], old, val;
+	char *op;
+	int n;
 
-	intel_register_access_fini();
+	line[strcspn(line, "#")] = '\0';
+	op = strtok(line, " \t\n");
+	if (op == NULL)
+		return 0;
+
+	n = parse_args(NULL, arg, 4);
+	if (n < 0)
+		goto bad;
+
+	gettimeofday(&start, NULL);
+
+	if (!strcmp(op, "write") && n == 2) {
+		if (intel_register_write_checked(arg[0], arg[1]))
+			return -1;
+		printf("%4d: write 0x%05x = 0x%08x", line_number,
+		       arg[0], arg[1]);
+	} else if (!strcmp(op, "rmw") && n == 3) {
+		old = intel_register_read(arg[0]);
+		val = (old & ~arg[1]) | (arg[2] & arg[1]);
+		if (intel_register_write_checked(arg[0], val))
+			return -1;
+		printf("%4d: rmw   0x%05x: 0x%08x -> 0x%08x", line_number,
+		       arg[0], old, val);
+	} else if (!strcmp(op, "wait") && (n == 3 || n == 4)) {
+		uint32_t timeout_ms = n == 4 ? arg[3] : DEFAULT_WAIT_TIMEOUT_MS;
+
+		while (((val = intel_register_read(arg[0])) & arg[1]) != arg[2]) {
+			if (elapsed_us(&start) > timeout_ms * 1000.) {
+				printf("%4d: wait  0x%05x & 0x%08x == 0x%08x "
+				       "timed out after %ums (0x%08x)\n",
+				       line_number, arg[0], arg[1], arg[2],
+				       timeout_ms, val);
+				return -1;
+			}
+		}
+		printf("%4d: wait  0x%05x & 0x%08x == 0x%08x", line_number,
+		       arg[0], arg[1], arg[2]);
+	} else if (!strcmp(op, "delay") && n == 1) {
+		usleep(arg[0]);
+		printf("%4d: delay %uus", line_number, arg[0]);
+	} else if (!strcmp(op, "read") && n == 1) {
+		val = intel_register_read(arg[0]);
+		printf("%4d: read  0x%05x = 0x%08x", line_number, arg[0], val);
+	} else {
+		goto bad;
+	}
+
+	printf(" (%.1fus)\n", elapsed_us(&start));
 	return 0;
+
+bad:
+	fprintf(stderr, "%d: invalid step\n", line_number);
+	return -1;
+}
+
+static int run_script(FILE *file)
+{
+	struct timeval start;
+	char *line = NULL;
+	size_t line_size = 0;
+	int line_number = 0, steps = 0, ret = 0;
+
+	gettimeofday(&start, NULL);
+
+	while (getline(&line, &line_size, file) > 0) {
+		line_number++;
+		ret = run_step(line, line_number);
+		if (ret)
+			break;
+		steps++;
+	}
+
+	printf("%d steps in %.1fus\n", steps, elapsed_us(&start));
+
+	free(line);
+	return ret;
 }
 
+static void usage(char *cmdname)
+{
+	printf("Usage: %s addr value\n", cmdname);
+	printf("       %s [-n dump -d devid] -f script|-\n", cmdname);
+	printf("  -f script : run the register operations of script ('-' for stdin)\n");
+	printf("  -n dump : dry run against a register dump instead of the hardware\n");
+	printf("  -d devid : device id the dump was taken from (in hex)\n");
+	printf("  WARNING: This is dangerous to you and your system's health.\n");
+	printf("           Only for use in debugging.\n");
+}
+
+int main(int argc, char** argv)
+{
+	struct pci_device *pci_dev;
+	char *script = NULL, *dump = NULL;
+	uint32_t reg, value, devid = 0;
+	FILE *file;
+	int ch, ret;
+
+	while ((ch = getopt(argc, argv, "f:n:d:h")) != -1) {
+		switch (ch) {
+		case 'f':
+			script = optarg;
+			break;
+		case 'n':
+			dump = optarg;
+			break;
+		case 'd':
+			devid = strtoul(optarg, NULL, 16);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (script == NULL) {
+		if (argc - optind < 2 || dump) {
+			usage(argv[0]);
+			exit(1);
+		}
+
+		reg = strtoul(argv[optind], NULL, 16);
+		value = strtoul(argv[optind + 1], NULL, 16);
+
+		intel_register_access_init(intel_get_pci_device(), 0);
+
+		printf("Value before: 0x%X\n", intel_register_read(reg));
+		intel_register_write(reg, value);
+		printf("Value after: 0x%X\n", intel_register_read(reg));
+
+		intel_register_access_fini();
+		return 0;
+	}
+
+	if (!strcmp(script, "-")) {
+		file = stdin;
+	} else {
+		file = fopen(script, "r");
+		if (file == NULL)
+			err(1, "Couldn't open %s", script);
+	}
+
+	/* scripts go through the safe register map where there is one */
+	if (dump) {
+		if (!devid)
+			errx(1, "-n requires the device id (-d)");
+		intel_register_access_init_file(dump, devid,
+						intel_gen(devid) >= 4);
+	} else {
+		pci_dev = intel_get_pci_device();
+		intel_register_access_init(pci_dev,
+					   intel_gen(pci_dev->device_id) >= 4);
+	}
+
+	ret = run_script(file);
+
+	intel_register_access_fini();
+	if (file != stdin)
+		fclose(file);
+
+	return ret ? 1 : 0;
+}